@@ -0,0 +1,256 @@
+//
+//  blockcache.h
+//  myfs
+//
+
+#ifndef blockcache_h
+#define blockcache_h
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "blockdevice.h"
+
+#define BLOCK_CACHE_SIZE 8192           // default number of cached blocks
+#define BLOCK_CACHE_DIRTY_RATIO 20      // default percentage of dirty slots that starts writing back all blocks
+#define BLOCK_CACHE_DIRTY_EXPIRE 5000   // default time in ms after that a dirty block is written back
+#define BLOCK_CACHE_FLUSH_BATCH 256     // maximal number of blocks written back with one call
+#define BLOCK_CACHE_FLUSH_DEPTH 16      // maximal number of write back requests in flight at the same time
+#define BLOCK_CACHE_PREFETCH_RUN 32     // maximal number of blocks of one prefetch request
+#define BLOCK_CACHE_PREFETCH_QUEUE 32   // maximal number of pending prefetch requests
+
+/// @brief Replacement policy of a BlockCache
+///
+/// A policy decides which slot of the cache receives a block that is not cached yet. The cache tells it about every
+/// access, so it can keep the blocks that are likely to be accessed again.
+class CachePolicy {
+public:
+    virtual ~CachePolicy() {}
+
+    /// @brief The block in slot has been accessed.
+    virtual void access(uint32_t slot) = 0;
+
+    /// @brief Choose the slot for a block that is not cached.
+    ///
+    /// The returned slot is either free or holds the block to evict. Afterwards the policy considers blockNo to be in
+    /// this slot.
+    /// \param [in] blockNo Number of the block to cache.
+    /// \return Index of the slot.
+    virtual uint32_t place(uint32_t blockNo) = 0;
+
+    /// @brief The block in slot has been dropped, the slot is free.
+    virtual void remove(uint32_t slot) = 0;
+};
+
+/// @brief CLOCK replacement, an approximation of LRU with one reference bit per slot
+class ClockPolicy : public CachePolicy {
+private:
+    std::vector<bool> referenced;
+    std::vector<bool> used;
+    std::vector<uint32_t> freeSlots;
+    uint32_t hand;
+
+public:
+    ClockPolicy(uint32_t numSlots);
+
+    virtual void access(uint32_t slot);
+
+    virtual uint32_t place(uint32_t blockNo);
+
+    virtual void remove(uint32_t slot);
+};
+
+/// @brief Adaptive replacement cache (ARC, Megiddo & Modha)
+///
+/// Cached blocks are kept in two LRU lists, T1 for blocks accessed once and T2 for blocks accessed repeatedly. The
+/// ghost lists B1 and B2 remember recently evicted block numbers of both lists. Hits on ghosts move the target size
+/// of T1 towards the list that would have kept the block, so the cache adapts to recency and frequency and is not
+/// flushed by a single scan.
+class ArcPolicy : public CachePolicy {
+private:
+    enum ListId { T1, T2, B1, B2 };
+    struct Entry {
+        ListId list;
+        std::list<uint32_t>::iterator pos;
+        uint32_t slot;
+    };
+
+    uint32_t capacity;
+    uint32_t target;                // target size of T1 (p)
+    std::list<uint32_t> lists[4];   // block numbers, most recently used first
+    std::unordered_map<uint32_t, Entry> entries;
+    std::vector<uint32_t> slotBlock;
+    std::vector<bool> used;
+    std::vector<uint32_t> freeSlots;
+
+    void moveTo(uint32_t blockNo, Entry &entry, ListId list);
+    void dropLru(ListId list);
+    uint32_t replace(bool inB2);
+
+public:
+    ArcPolicy(uint32_t numSlots);
+
+    virtual void access(uint32_t slot);
+
+    virtual uint32_t place(uint32_t blockNo);
+
+    virtual void remove(uint32_t slot);
+};
+
+/// @brief Counters of a BlockCache
+struct BlockCacheStats {
+    uint64_t hits;          // blocks read from the cache
+    uint64_t misses;        // blocks read from the block device
+    uint64_t evictions;     // cached blocks replaced by other blocks
+    uint64_t writebacks;    // dirty blocks written to the block device
+    uint64_t prefetched;    // blocks read into the cache ahead of time
+};
+
+/// @brief Cache blocks of another block device in memory
+///
+/// The cache keeps up to numSlots blocks of the underlying block device and serves reads of cached blocks without
+/// accessing it. Blocks are found by a hash table keyed by block number, the slot for a new block is chosen by a
+/// CachePolicy. Writes go to the block device right away and update the cache (write-through, write-allocate).
+///
+/// After enableWriteBack(), writes only update the cache and mark the blocks dirty. A background thread writes dirty
+/// blocks back once they are older than a given age, or all of them once the share of dirty slots exceeds a given
+/// ratio. Dirty blocks are written in ascending order, consecutive blocks with a single request. Up to
+/// BLOCK_CACHE_FLUSH_DEPTH requests are submitted to the block device at once, so a block device like
+/// UringBlockDevice keeps them in flight together. A dirty block that is evicted is written back right away. flush()
+/// and sync() write back all dirty blocks, close() does so before the block device is closed.
+///
+/// advise() with BD_ADVICE_WILLNEED queues the blocks for a second background thread, which reads those that are not
+/// cached and adds them to the cache. It takes several queued requests at once and submits the missing blocks as one
+/// batch of runs of up to BLOCK_CACHE_PREFETCH_RUN blocks. It does not hold the lock while reading. Blocks written
+/// meanwhile are not added, so the cache never gets older content than the block device.
+///
+/// blockPtr() hands out the blocks of a block device that maps the container as long as none of them is dirty in the
+/// cache, clean cached blocks have the same content. Reads through the pointer bypass the cache, so blocks of a mapped
+/// container are not held twice in memory. For the same reason advise() leaves prefetching mapped blocks to the block
+/// device.
+///
+/// submit() passes requests that the cache cannot serve better on to the block device, they are in flight there until
+/// reap() returns them. Reads of blocks that are all cached or partly dirty and writes in write-back mode are performed
+/// by the cache right away. A write passed on drops the blocks from the cache, they must not be read through the cache
+/// before the write has been reaped.
+///
+/// All methods may be called from several threads at the same time, the cache is protected by a single lock. The
+/// cache takes ownership of the block device.
+class BlockCache : public BlockDevice {
+private:
+    BlockDevice *device;
+    CachePolicy *policy;
+    uint32_t numSlots;
+    char *slots;                                    // numSlots blocks
+    std::vector<uint32_t> slotBlock;                // block number held by a slot
+    std::vector<bool> slotUsed;
+    std::unordered_map<uint32_t, uint32_t> index;   // block number -> slot
+    BlockCacheStats counters;
+    std::mutex cacheLock;
+
+    bool writeBack;
+    uint32_t dirtyLimit;                            // number of dirty slots that starts writing back all blocks
+    std::chrono::milliseconds dirtyExpire;
+    std::vector<bool> slotDirty;
+    std::vector<std::chrono::steady_clock::time_point> slotDirtySince;
+    uint32_t dirtyCount;
+    std::vector<char> flushData;                    // content of the blocks of a write back batch
+    int writeError;                                 // failed write back of an evicted block, reported by flush()
+    std::thread flusher;
+    std::condition_variable flusherWake;
+    bool stopThreads;
+
+    std::deque<std::pair<uint32_t, uint32_t>> prefetchQueue;    // first block and number of blocks
+    std::thread prefetcher;
+    std::condition_variable prefetchWake;
+    std::condition_variable prefetchIdle;
+    bool prefetching;                               // prefetcher is reading, the lock is not held
+    std::vector<BlockRequest> prefetchBatch;        // runs the prefetcher is reading
+    std::vector<bool> prefetchStale;                // the run has been written meanwhile
+    uint64_t prefetchEpoch;                         // incremented when pending requests are dropped
+
+    /*
+     *  Requests of callers of submit() that are in flight at the block device, and finished ones that have not been
+     *  returned by reap() yet in completed. Requests of the flusher and the prefetcher point with userData to the
+     *  number of requests of their batch that are still in flight. Whoever holds reapLock reaps for all of them.
+     */
+    std::unordered_set<BlockRequest *> passedOn;
+    std::mutex reapLock;
+
+    char *slotData(uint32_t slot);
+    void markDirty(uint32_t slot);
+    void markClean(uint32_t slot);
+    void drop(uint32_t slot);
+    void clear();
+    void store(uint32_t blockNo, const char *buffer, bool dirty);
+    int readCached(uint32_t blockNo, uint32_t numBlocks, const struct iovec *iov, int iovcnt);
+    int writeCached(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+    int writeBackDirty(bool all, std::unique_lock<std::mutex> &guard);
+    void submitBatch(std::vector<BlockRequest> &batch, int *pending);
+    int reapDevice(int *pending);
+    void runFlusher();
+    void noteWrite(uint32_t blockNo, uint32_t numBlocks);
+    bool writeInFlight(uint32_t blockNo);
+    void waitPrefetch(std::unique_lock<std::mutex> &guard);
+    void runPrefetcher();
+
+public:
+    /// @brief Create a new block cache.
+    ///
+    /// \param device Block device to cache, it is deleted with the cache.
+    /// \param numSlots Number of blocks the cache can hold.
+    /// \param policy Replacement policy, "clock" or "arc".
+    BlockCache(BlockDevice *device, uint32_t numSlots = BLOCK_CACHE_SIZE, const char *policy = "clock");
+
+    virtual ~BlockCache();
+
+    /// @brief Get the counters of the cache.
+    ///
+    /// \return Number of hits, misses, evictions and written back blocks since the cache has been created.
+    BlockCacheStats stats();
+
+    /// @brief Switch the cache to write-back mode and start the flusher thread.
+    ///
+    /// \param dirtyRatio Percentage of dirty slots that makes the flusher write back all dirty blocks.
+    /// \param dirtyExpire Time in ms after that a dirty block is written back.
+    void enableWriteBack(unsigned dirtyRatio = BLOCK_CACHE_DIRTY_RATIO,
+                         unsigned dirtyExpire = BLOCK_CACHE_DIRTY_EXPIRE);
+
+    virtual int open(const char *path);
+
+    virtual int create(const char *path);
+
+    virtual int close();
+
+    virtual int read(uint32_t blockNo, char *buffer);
+
+    virtual int write(uint32_t blockNo, char *buffer);
+
+    virtual int readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer);
+
+    virtual int writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer);
+
+    virtual int readv(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int writev(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int submit(BlockRequest **requests, int count);
+
+    virtual int reap(BlockRequest **done, int minRequests, int maxRequests);
+
+    virtual int flush();
+
+    virtual int sync();
+
+    virtual int advise(uint32_t blockNo, uint32_t numBlocks, BlockAdvice advice);
+
+    virtual const char *blockPtr(uint32_t blockNo, uint32_t numBlocks);
+};
+
+#endif /* blockcache_h */
@@ -13,19 +13,60 @@
 
 #include <stdio.h>
 #include <cstdint>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <deque>
+#include <mutex>
 
 #define BD_BLOCK_SIZE 512
 
+/// @brief Access pattern hints for BlockDevice::advise().
+enum BlockAdvice {
+    BD_ADVICE_NORMAL,       // no particular pattern
+    BD_ADVICE_SEQUENTIAL,   // blocks will be accessed in ascending order
+    BD_ADVICE_RANDOM,       // blocks will be accessed in random order
+    BD_ADVICE_WILLNEED,     // blocks will be accessed soon
+    BD_ADVICE_DONTNEED      // blocks will not be accessed soon
+};
+
+/// @brief A transfer of consecutive blocks that is submitted with BlockDevice::submit().
+///
+/// The request and its buffer are owned by the caller and must stay valid until the request has been returned by
+/// BlockDevice::reap().
+struct BlockRequest {
+    bool write;             // true = write buffer to the blocks, false = read the blocks into buffer
+    uint32_t blockNo;       // first block of the transfer
+    uint32_t numBlocks;     // number of consecutive blocks
+    char *buffer;           // numBlocks blocks
+    int result;             // 0 on success, -ERRNO on failure; valid once the request has been reaped
+    void *userData;         // not used by the block device
+};
+
 /// @brief Emulate a block device
 ///
 /// This class emulates access to a generic block device (e.g. a hard disc or USB drive partition) using the
 /// local file system.
+///
+/// All block transfers use positional I/O (pread/pwrite and friends) and do not change any state of the object. Once a
+/// container file is attached, the read and write methods may be called from several threads at the same time.
+/// Concurrent transfers of the same block are not ordered against each other. open(), create() and close() must not
+/// run concurrently with any other method.
+///
+/// Besides the synchronous methods, batches of BlockRequest can be handed over with submit() and collected with reap().
+/// This class performs them synchronously inside submit(); subclasses may keep them in flight (see UringBlockDevice).
 class BlockDevice {
-private:
+protected:
     uint32_t blockSize;
     int contFile;
+    int openFlags;      // additional flags for opening the container file
     // uint32_t size;
-    
+
+    std::mutex completedLock;
+    std::deque<BlockRequest *> completed;   // finished requests that have not been reaped yet
+
+    int preadvAt(off_t pos, const struct iovec *iov, int iovcnt);
+    int pwritevAt(off_t pos, const struct iovec *iov, int iovcnt);
+
 public:
     /// @brief Create a new block device.
     ///
@@ -33,12 +74,19 @@ public:
     /// \param blockSize Block size.
     BlockDevice(uint32_t blockSize);
 
+    virtual ~BlockDevice();
+
+    /// @brief Get the block size.
+    ///
+    /// \return Block size in bytes.
+    uint32_t getBlockSize() const;
+
     /// @brief Open an existing container file.
     ///
     /// This methods opens an existing container file and attaches it to the block device object.
     /// \param path Path of the container file.
     /// \return 0 on success, -ERRNO on failure.
-    int open(const char* path);
+    virtual int open(const char* path);
 
     /// @brief Create a new container file.
     ///
@@ -47,13 +95,13 @@ public:
     ///
     /// \param path Path of the container file.
     /// \return 0 on success, -ERRNO on failure.
-    int create(const char* path);
+    virtual int create(const char* path);
 
     /// @brief Close a container file.
     ///
     /// This method closes a container file.
     /// \return 0 on success, -ERRNO on failure.
-    int close();
+    virtual int close();
 
     /// @brief Read a block.
     ///
@@ -62,7 +110,7 @@ public:
     /// \param [in] blockNo Number of the block to read.
     /// \param [out] buffer Buffer for storing the content of the block.
     /// \return 0 on success, -ERRNO on failure.
-    int read(uint32_t blockNo, char *buffer);
+    virtual int read(uint32_t blockNo, char *buffer);
 
     /// @brief Write a block
     ///
@@ -71,7 +119,103 @@ public:
     /// \param [in] blockNo Number of the block to write.
     /// \param [out] buffer Buffer storing the content to write.
     /// \return 0 on success, -ERRNO on failure.
-    int write(uint32_t blockNo, char *buffer);
+    virtual int write(uint32_t blockNo, char *buffer);
+
+    /// @brief Read consecutive blocks.
+    ///
+    /// This method reads numBlocks blocks starting with the block blockNo from the container file with a single
+    /// system call. Note that the size of the buffer must be at least numBlocks blocks.
+    /// \param [in] blockNo Number of the first block to read.
+    /// \param [in] numBlocks Number of blocks to read.
+    /// \param [out] buffer Buffer for storing the content of the blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer);
+
+    /// @brief Write consecutive blocks.
+    ///
+    /// This method writes numBlocks blocks starting with the block blockNo into the container file with a single
+    /// system call. Note that the size of the buffer must be at least numBlocks blocks.
+    /// \param [in] blockNo Number of the first block to write.
+    /// \param [in] numBlocks Number of blocks to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer);
+
+    /// @brief Read consecutive blocks into several buffers (scatter).
+    ///
+    /// This method reads consecutive blocks starting with the block blockNo and distributes their content over the
+    /// given buffers in order. The total length of the buffers must be a multiple of the block size. Blocks beyond the
+    /// end of the container file read as zeros.
+    /// \param [in] blockNo Number of the first block to read.
+    /// \param [in] iov Buffers for storing the content of the blocks.
+    /// \param [in] iovcnt Number of buffers.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int readv(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    /// @brief Write consecutive blocks from several buffers (gather).
+    ///
+    /// This method writes the content of the given buffers in order to consecutive blocks starting with the block
+    /// blockNo. The total length of the buffers must be a multiple of the block size.
+    /// \param [in] blockNo Number of the first block to write.
+    /// \param [in] iov Buffers storing the content to write.
+    /// \param [in] iovcnt Number of buffers.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int writev(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    /// @brief Submit a batch of block transfers.
+    ///
+    /// This method hands over count requests to the block device. The transfers may run in any order and may still be
+    /// in flight when the method returns. Each request is returned exactly once by reap(), its result field then holds
+    /// the outcome of the transfer.
+    /// \param [in] requests Requests to submit.
+    /// \param [in] count Number of requests.
+    /// \return 0 on success, -ERRNO if the requests could not be submitted. In that case none of them is in flight.
+    virtual int submit(BlockRequest **requests, int count);
+
+    /// @brief Collect finished block transfers.
+    ///
+    /// This method stores up to maxRequests finished requests in done. If fewer than minRequests requests are finished,
+    /// it waits for more of them. minRequests must not exceed the number of submitted requests that have not been
+    /// reaped yet.
+    /// \param [out] done Buffer for the finished requests.
+    /// \param [in] minRequests Minimal number of requests to wait for.
+    /// \param [in] maxRequests Size of done.
+    /// \return Number of requests stored in done, -ERRNO on failure.
+    virtual int reap(BlockRequest **done, int minRequests, int maxRequests);
+
+    /// @brief Write buffered blocks to the container file.
+    ///
+    /// Block devices that hold written blocks in memory (see BlockCache) write them to the container file, so they can
+    /// be read from it by other processes. Unlike sync(), this does not wait until the blocks are durable.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int flush();
+
+    /// @brief Make written blocks durable.
+    ///
+    /// This method returns after all blocks written so far have reached the storage of the container file.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int sync();
+
+    /// @brief Announce how blocks will be accessed.
+    ///
+    /// This method passes a hint to the operating system, e.g. to start reading blocks that will be needed soon. Hints
+    /// never change the content of blocks and may be ignored.
+    /// \param [in] blockNo Number of the first block the hint applies to.
+    /// \param [in] numBlocks Number of blocks the hint applies to, 0 for all blocks up to the end of the container.
+    /// \param [in] advice Expected access pattern.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int advise(uint32_t blockNo, uint32_t numBlocks, BlockAdvice advice);
+
+    /// @brief Get direct access to the content of consecutive blocks.
+    ///
+    /// Block devices that keep the container in memory return a pointer to the content of the blocks, so callers can
+    /// read it without copying it into a buffer first. The content must not be modified through the pointer.
+    /// \param [in] blockNo Number of the first block.
+    /// \param [in] numBlocks Number of consecutive blocks.
+    /// \return Pointer to numBlocks blocks, NULL if the block device does not support direct access or the blocks are
+    /// not available (e.g. beyond the end of the container file). The pointer is valid until the container file grows
+    /// or is closed.
+    virtual const char *blockPtr(uint32_t blockNo, uint32_t numBlocks);
 };
 
 #endif /* blockdevice_h */
@@ -0,0 +1,79 @@
+//
+//  directblockdevice.h
+//  myfs
+//
+
+#ifndef directblockdevice_h
+#define directblockdevice_h
+
+#include <vector>
+
+#include "blockdevice.h"
+
+#define DIRECT_POOL_BUFFERS 8               // aligned bounce buffers kept by the pool
+#define DIRECT_BUFFER_SIZE (128 * 1024)     // size of a bounce buffer in bytes
+#define DIRECT_DEFAULT_ALIGNMENT 4096       // used if the file system does not report its alignment
+
+/// @brief Emulate a block device that bypasses the page cache of the host
+///
+/// The container file is opened with O_DIRECT (F_NOCACHE on macOS), so blocks are not cached a second time by the host
+/// while the kernel caches the mounted files. Direct I/O requires buffers, offsets and lengths to be aligned to values
+/// given by the file system. Transfers that meet them go straight to the container, all others go through aligned
+/// bounce buffers from a pool. Writes that only cover part of an aligned chunk read the chunk first. If the alignment
+/// is larger than the block size, writes are serialized to keep these read-modify-write cycles from overwriting each
+/// other.
+///
+/// If the file system does not support direct I/O (e.g. tmpfs), the container is opened normally and the object
+/// behaves like a BlockDevice.
+class DirectBlockDevice : public BlockDevice {
+private:
+    bool direct;                // container file is opened for direct I/O
+    size_t memAlign;            // alignment of buffers
+    size_t offsetAlign;         // alignment of offsets and lengths
+
+    std::mutex poolLock;
+    std::vector<char *> pool;   // free bounce buffers
+    std::mutex writeLock;
+
+    int attach(bool create, const char *path);
+    void queryAlignment();
+    char *takeBuffer();
+    void returnBuffer(char *buffer);
+    bool isAligned(uint64_t pos, const void *buffer, size_t length);
+    int readDirect(uint64_t pos, char *buffer, size_t length);
+    int writeDirect(uint64_t pos, const char *buffer, size_t length);
+    int readAt(uint64_t pos, char *buffer, size_t length);
+    int writeAt(uint64_t pos, const char *buffer, size_t length);
+
+public:
+    /// @brief Create a new direct I/O block device.
+    ///
+    /// Create a block device object with a given block size.
+    /// \param blockSize Block size.
+    DirectBlockDevice(uint32_t blockSize);
+
+    virtual ~DirectBlockDevice();
+
+    /// @brief Check if the container file bypasses the page cache.
+    ///
+    /// \return true if direct I/O is used, false if the file system does not support it.
+    bool usesDirectIO() const;
+
+    virtual int open(const char *path);
+
+    virtual int create(const char *path);
+
+    virtual int read(uint32_t blockNo, char *buffer);
+
+    virtual int write(uint32_t blockNo, char *buffer);
+
+    virtual int readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer);
+
+    virtual int writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer);
+
+    virtual int readv(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int writev(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+};
+
+#endif /* directblockdevice_h */
@@ -0,0 +1,85 @@
+//
+//  mmapblockdevice.h
+//  myfs
+//
+
+#ifndef mmapblockdevice_h
+#define mmapblockdevice_h
+
+#include <atomic>
+
+#include "blockdevice.h"
+
+#define MMAP_GROW_SIZE (1 << 20)        // the container file grows in steps of this many bytes
+#define MMAP_SEQUENTIAL_BLOCKS 64       // consecutive blocks read in order before the mapping is marked sequential
+#define MMAP_READAHEAD_BLOCKS 256       // blocks requested ahead of a sequential reader at once
+
+/// @brief Emulate a block device using a memory mapping of the container file
+///
+/// The container file is mapped into memory when it is attached, reads and writes copy from and to the mapping. As long
+/// as the container is in the page cache, no transfer needs a system call. The container file grows in steps of
+/// MMAP_GROW_SIZE bytes when blocks beyond its end are written.
+///
+/// Reads are watched for sequential access. After MMAP_SEQUENTIAL_BLOCKS blocks have been read in order, the mapping is
+/// marked sequential and the kernel is asked to load the next MMAP_READAHEAD_BLOCKS blocks ahead of the reader. Random
+/// access marks the mapping normal again.
+///
+/// The mapping covers at least maxBlocks blocks, so it does not move while the container file stays within that size.
+/// Writing beyond maxBlocks moves the mapping and must not run concurrently with any other method. Apart from that, the
+/// thread-safety guarantees of BlockDevice hold.
+class MmapBlockDevice : public BlockDevice {
+private:
+    char *mapping;
+    size_t mappingSize;
+    uint64_t maxSize;
+    std::atomic<uint64_t> fileSize;
+    std::mutex growLock;
+
+    // access pattern of reads, only used for hints
+    std::atomic<uint32_t> nextBlock;
+    std::atomic<uint32_t> sequentialBlocks;
+    std::atomic<uint32_t> readaheadEnd;
+    std::atomic<bool> sequential;
+
+    int map();
+    void unmap();
+    int grow(uint64_t end);
+    void copyOut(uint64_t pos, char *buffer, size_t length);
+    void trackRead(uint32_t blockNo, uint32_t numBlocks);
+
+public:
+    /// @brief Create a new memory mapped block device.
+    ///
+    /// Create a block device object with a given block size.
+    /// \param blockSize Block size.
+    /// \param maxBlocks Expected maximal number of blocks of the container, 0 if unknown.
+    MmapBlockDevice(uint32_t blockSize, uint32_t maxBlocks = 0);
+
+    virtual ~MmapBlockDevice();
+
+    virtual int open(const char *path);
+
+    virtual int create(const char *path);
+
+    virtual int close();
+
+    virtual int read(uint32_t blockNo, char *buffer);
+
+    virtual int write(uint32_t blockNo, char *buffer);
+
+    virtual int readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer);
+
+    virtual int writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer);
+
+    virtual int readv(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int writev(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int sync();
+
+    virtual int advise(uint32_t blockNo, uint32_t numBlocks, BlockAdvice advice);
+
+    virtual const char *blockPtr(uint32_t blockNo, uint32_t numBlocks);
+};
+
+#endif /* mmapblockdevice_h */
@@ -11,9 +11,29 @@
 #ifndef myfs_info_h
 #define myfs_info_h
 
+#define ATIME_STRICT 0              // every access of a file updates its access time
+#define ATIME_RELATIME 1            // only accesses after a change or once a day update the access time
+#define ATIME_NOATIME 2             // accesses never update the access time
+
 struct MyFsInfo {
     char *logFile;
     char *contFile;
+    unsigned int blockSize;     // block size of a new container in bytes, 0 for the default
+    unsigned int dataBlocks;    // number of data blocks of a new container, 0 for the default
+    unsigned int dirEntries;    // number of directory entries of a new container, 0 for the default
+    char *backend;              // block device implementation: NULL or "pread", "uring", "mmap", "direct"
+    unsigned int queueDepth;    // submission queue entries of the io_uring backend, 0 for the default
+    int noCache;                // 1 to access the block device without BlockCache
+    unsigned int cacheSize;     // blocks held by the cache, 0 for the default
+    char *cachePolicy;          // replacement policy of the cache: NULL or "clock", "arc"
+    int writeBack;              // 1 to hold written blocks in the cache and write them back in the background
+    unsigned int dirtyRatio;    // percentage of dirty cached blocks that starts writing back, 0 for the default
+    unsigned int dirtyExpire;   // time in ms after that a dirty block is written back, 0 for the default
+    int delayedAlloc;           // 1 to allocate the blocks of appended data when the file is flushed
+    unsigned int commitInterval; // time in ms after that changed metadata is committed, 0 for the default
+    int shadowPaging;           // 1 to commit the metadata of a new container by switching superblocks, not by a journal
+    int atimeMode;              // ATIME_STRICT, ATIME_RELATIME or ATIME_NOATIME
+    int lazyTime;               // 1 to keep changed timestamps in memory until other metadata of the file is written
 };
 
 #endif /* myfs_info_h */
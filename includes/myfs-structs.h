@@ -9,11 +9,35 @@
 #ifndef myfs_structs_h
 #define myfs_structs_h
 
+#include <vector>
+
 #define NAME_LENGTH 255
-#define BLOCK_SIZE 512
-#define NUM_DIR_ENTRIES 64
+#define BLOCK_SIZE 512              // default and smallest block size of a container
+#define MAX_BLOCK_SIZE 65536
+#define NUM_DIR_ENTRIES 64          // default number of directory entries of a container
 #define NUM_OPEN_FILES 64
-#define NUM_DATA_BLOCKS 1 << 16 // 65.536 = 2^16
+#define NUM_DATA_BLOCKS (1 << 16) // 65.536 = 2^16, default number of data blocks of a container
+#define MAX_DIR_ENTRIES (1 << 20)
+#define MAX_DATA_BLOCKS (1 << 30)   // block numbers stay positive 32 bit values, including the metadata in front
+#define MAX_FILE_BLOCKS 0x7fffffff  // logical block numbers inside a file are positive 32 bit values, as in the LMAP
+#define METADATA_BATCH_BLOCKS 256   // maximal number of metadata blocks read or written with one call
+#define FORMAT_VERSION 7            // version 0 containers have NUM_DATA_BLOCKS blocks and NUM_DIR_ENTRIES entries
+#define FORMAT_VERSION_BITMAP 2     // first version with one bit per block in the DMAP, one byte before
+#define FORMAT_VERSION_SPARSE 3     // first version with the LMAP, files may have holes
+#define FORMAT_VERSION_JOURNAL 4    // first version with the metadata journal
+#define FORMAT_VERSION_SHADOW 5     // first version that may have shadow slots for the metadata instead of the journal
+#define FORMAT_VERSION_PACKED_ROOT 6 // first version with packed directory entries and their names in a name heap
+#define FORMAT_VERSION_BOUNDED_JOURNAL 7 // first version with a journal of at most JOURNAL_MAX_SIZE bytes
+#define JOURNAL_MAGIC 0x4a53594d    // "MYSJ", starts the journal header and every transaction
+#define JOURNAL_COMMIT_INTERVAL 5000         // time in ms after that changed metadata is committed
+#define JOURNAL_MAX_SIZE (4 * 1024 * 1024)   // size in bytes of the journal of a container with a lot of metadata
+#define JOURNAL_COMMIT_SHARE 25              // percentage of the journal a transaction fills before it is committed
+#define RELATIME_INTERVAL (24 * 60 * 60)     // time in s after that relatime updates the access time of a file again
+#define LAZYTIME_INTERVAL (12 * 60 * 60)     // time in s after that timestamps kept in memory by lazytime are written
+#define READAHEAD_MIN_SIZE 4096              // readahead window of a new file handle and after random reads
+#define READAHEAD_MAX_SIZE (128 * 1024)      // readahead window of a long sequential read
+#define DELALLOC_MAX_SIZE (1024 * 1024)      // delayed data of a file that is written without waiting for a flush
+#define ZERO_FILL_SIZE (256 * 1024)          // zeros written with one call by zeroRange()
 
 #define POS_NULLPTR -124 //used for empty files which need a blocknumber
 #define ERROR_BLOCKNUMBER 4294967296 // 2^32
@@ -47,6 +71,63 @@ struct MyFsDiskInfo {
     char cPath[NAME_LENGTH + 1];   // Path to the file    256bit
 };
 
+struct MyFsDirEntry {
+    uint64_t size;              // Data Size
+    int32_t data;               // Block Pos
+    uint32_t uid;               // User ID
+    uint32_t gid;               // Gruppen ID
+    uint32_t mode;              // File mode
+    int64_t atime;              // Time of last access.
+    int64_t mtime;              // Time of last modification.
+    int64_t ctime;              // Time of last status change.
+    uint32_t nameOffset;        // Position of the path inside the name heap
+    uint16_t nameLength;        // Length of the path without terminating zero, 0 for an empty entry
+    uint16_t reserved;
+};
+
+struct FatCursor {
+    int32_t logicalBlock;       // Block number inside the file, -1 = not set
+    int32_t physicalBlock;      // Block number inside the data segment
+    int32_t extent;             // Index of the extent holding the block, -1 = not set
+};
+
+struct Extent {
+    int32_t logicalStart;       // First block number inside the file
+    int32_t physicalStart;      // First block number inside the data segment
+    int32_t length;             // Number of consecutive blocks
+};
+
+struct Readahead {
+    int32_t nextBlock;          // Block number inside the file a sequential read continues with
+    int32_t window;             // Number of blocks to read ahead
+    int32_t end;                // First block number inside the file behind the blocks read ahead
+};
+
+struct DelayedWrite {
+    int32_t firstBlock;         // Block number inside the file the data starts with, at or behind the allocated blocks
+    std::vector<char> data;     // Written data from firstBlock on, the rest of the file is a hole
+};
+
+struct JournalHeader {
+    uint32_t magic;             // JOURNAL_MAGIC
+    uint32_t reserved;
+    uint64_t sequence;          // Sequence number of the transaction starting in the block behind the header
+};
+
+struct JournalTransaction {
+    uint32_t magic;             // JOURNAL_MAGIC
+    uint32_t numBlocks;         // Journal blocks of the transaction, starting with the one holding this header
+    uint64_t sequence;          // One more than the transaction in front
+    uint32_t length;            // Bytes of records behind this header
+    uint32_t checksum;          // Hash of the sequence number and the records, a torn transaction does not match
+};
+
+struct JournalRecord {
+    uint32_t blockNo;           // Metadata block of the container
+    uint32_t offset;            // First changed byte inside the block
+    uint32_t length;            // Number of changed bytes, their new content follows the record
+};
+
 struct SuperBlock {
     //Informationen zum File-System (z.B. Größe, Positionen der Einträge unten...)
     size_t infoSize;
@@ -57,6 +138,17 @@ struct SuperBlock {
     int32_t rootPos;
     int32_t dataPos;
     int32_t numFreeBlocks;
+    uint32_t blockSize;         // 0 in containers created before it was stored, they use BLOCK_SIZE
+    uint32_t version;           // FORMAT_VERSION of the container
+    uint32_t numDataBlocks;     // since version 1
+    uint32_t numDirEntries;     // since version 1
+    int32_t lmapPos;            // since version 3
+    int32_t journalPos;         // since version 4
+    uint32_t shadowPaging;      // since version 5, 1 if every metadata block has two slots and there are two superblocks
+    int32_t slotMapPos;         // since version 5
+    uint64_t generation;        // since version 5, number of commits, the superblock with the higher one is current
+    uint32_t checksum;          // since version 5, hash of the superblock with this field being 0
+    int32_t namesPos;           // since version 6
 };
 
 #endif /* myfs_structs_h */
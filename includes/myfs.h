@@ -68,6 +68,8 @@ public:
     virtual int fuseFsyncdir(const char *path, int datasync, struct fuse_file_info *fileInfo);
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseCreate(const char *, mode_t, struct fuse_file_info *);
+    virtual int fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo);
+    virtual off_t fuseLseek(const char *path, off_t offset, int whence, struct fuse_file_info *fileInfo);
     virtual void fuseDestroy();
     
     // TODO: [PART 2] You may add methods of your file system here
@@ -8,8 +8,11 @@
 
 #include <fuse.h>
 #include <cmath>
+#include <string>
+#include <unordered_map>
 
 #include "myfs.h"
+#include "myfs-info.h"
 #include "blockdevice.h"
 #include "myfs-structs.h"
 
@@ -25,6 +28,7 @@ public:
     MyFsFileInfo myFsFiles[NUM_DIR_ENTRIES];
     bool myFsOpenFiles[NUM_DIR_ENTRIES];
     bool myFsEmpty[NUM_DIR_ENTRIES];
+    std::unordered_map<std::string, int> myPathIndex;   // path of every file to its index in myFsFiles
     unsigned int iCounterFiles;
     unsigned int iCounterOpen;
 
@@ -52,6 +56,7 @@ public:
     virtual void fuseDestroy();
 
     // TODO: Add methods of your file system here
+    void* mountMemory(MyFsInfo *fsInfo);
     int iIsPathValid(const char *path, uint64_t fh);
     int iFindEmptySpot();
     int iFindFileIndex(const char *path);
@@ -6,43 +6,181 @@
 #ifndef MYFS_MYONDISKFS_H
 #define MYFS_MYONDISKFS_H
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include "myfs.h"
+#include "myfs-info.h"
+#include "blockcache.h"
 
 /// @brief On-disk implementation of a simple file system.
 class MyOnDiskFS : public MyFS {
 protected:
     // BlockDevice blockDevice;
+    BlockCache *blockCache;     // blockDevice if blocks are cached, NULL otherwise
+    uint32_t blockSize;         // chosen when the container is created, stored in the superblock
+    char *headBuffer;           // one block each, used by readRun() and writeRun()
+    char *tailBuffer;
+
+    ulong numDirEntries;
+    bool packedDmap;            // the DMAP of the container has one bit per block, see FORMAT_VERSION_BITMAP
+    bool sparseFiles;           // the container has an LMAP and files may have holes, see FORMAT_VERSION_SPARSE
+    bool metadataJournal;       // metadata changes are committed to the journal first, see FORMAT_VERSION_JOURNAL
+    bool shadowPaging;          // metadata blocks have two slots, commits switch superblocks, see FORMAT_VERSION_SHADOW
+    bool packedRoot;            // directory entries share root blocks, their paths are in the name heap, see
+                                // FORMAT_VERSION_PACKED_ROOT
+    ulong entriesPerRootBlock;  // 1 in containers without packed root
+    uint32_t commitInterval;    // time in ms after that the running transaction is committed
+    int32_t allocCursor;        // data block behind the last allocation, where allocations without goal start
+    bool delayedAlloc;          // blocks behind the end of the chain are allocated by flushDelayed()
+    int atimeMode;              // ATIME_STRICT, ATIME_RELATIME or ATIME_NOATIME, see touchAtime()
+    bool lazyTime;              // changed timestamps alone do not write the directory entry, see markTimesDirty()
+    uint32_t reservedBlocks;    // empty blocks promised to delayed writes
+    uint32_t pendingBlocks;     // empty blocks in myPendingFrees
 
     ulong blocks4DATA;
-    ulong blocks4SPBlock;
+    ulong blocks4SPBlock;       // 2 with shadow paging
+    ulong blocks4SLOTS;         // per superblock, 0 without shadow paging
     ulong blocks4DMAP;
     ulong blocks4FAT;
+    ulong blocks4LMAP;          // 0 in containers without sparse files
+    ulong blocks4JOURNAL;       // 0 in containers without journal
     ulong blocks4ROOT;
+    ulong blocks4NAMES;         // 0 in containers without packed root
 
     ulong posSPBlock;
+    ulong posSLOTS;
     ulong posDMAP;
     ulong posFAT;
+    ulong posLMAP;
+    ulong posJOURNAL;
     ulong posROOT;
+    ulong posNAMES;
     ulong posDATA;
     ulong posENDofDATA;
+    ulong shadowDistance;       // blocks from the first to the second slot of a metadata block
 
 public:
     static MyOnDiskFS *Instance();
 
     // TODO: [PART 1] Add attributes of your file system here
+    /*
+     *  mySuperBlock, myDmap, myFAT and myRoot are read from the container once in fuseInit() and are the authoritative
+     *  copy afterwards. The fuse* methods only write them back to the container, they never re-read them.
+     *  The arrays are sized by setGeometry() for the container, myFAT, myLogical and a packed myDmap are padded to
+     *  whole blocks.
+     */
     SuperBlock mySuperBlock;
-    bool myDmap[NUM_DATA_BLOCKS];      //Verzeichnis der freien Datenblöcke, 1 = empty, 0 = occupied
+    std::vector<uint64_t> myDmap;     //Verzeichnis der freien Datenblöcke als Bitmap, 1 = empty, 0 = occupied
+    /*
+     *  bit n % 64 of myDmap[n / 64] holds information about the nth block INSIDE the data segment, meaning it is indexed with 0 being the start of the data segment
+     *  Use isFreeBlock() and setFreeBlock(), the latter keeps myDmapSummary up to date.
+     */
+    std::vector<uint64_t> myDmapSummary;  //bit n % 64 of myDmapSummary[n / 64] is set if myDmap[n] has an empty block
+    /*
+     *  The empty blocks of myDmap as runs of consecutive blocks, built when the DMAP is read. myFreeExtents maps the
+     *  first block of a run to its length, myFreeBySize holds (length, first block) to find the best fitting run.
+     */
+    std::map<int32_t, int32_t> myFreeExtents;
+    std::set<std::pair<int32_t, int32_t>> myFreeBySize;
     /*
-     *  myDmap[n] holds information about the nth block INSIDE the data segment, meaning it is indexed with 0 being the start of the data segment
+     *  Runs of blocks freed since the last commit as (first block, length). They are empty in myDmap, which is
+     *  committed with them, but the committed metadata may still point to them. So they only join myFreeExtents once
+     *  the running transaction is committed, see releasePendingFrees().
      */
-    int32_t myFAT[NUM_DATA_BLOCKS];    //File Allocation Table FAT
+    std::vector<std::pair<int32_t, int32_t>> myPendingFrees;
+    std::vector<int32_t> myFAT;       //File Allocation Table FAT
     /*
      *  myFAT[0] returns what block comes after. It is indexed with 0 being the start of the data segment
      *  If one wants to traverse through the FAT, one can simply myFAT[myFAT[myFAT[n]]] do like this, meaning no arithmetics between iterations are needed
      */
-    MyFsDiskInfo myRoot[NUM_DIR_ENTRIES];
-    bool myFsOpenFiles[NUM_DIR_ENTRIES];
-    bool myFsEmpty[NUM_DIR_ENTRIES]; //1 = empty, 0 = occupied
+    /*
+     *  myLogical[n] is the number of data block n inside its file, -1 for empty blocks. The numbers grow along a FAT
+     *  chain, a gap between two blocks of a chain is a hole that reads as zeros. Containers without sparse files have
+     *  no LMAP region, there the numbers are counted along the chains when the container is read.
+     */
+    std::vector<int32_t> myLogical;
+    std::vector<MyFsDiskInfo> myRoot;
+    std::unordered_map<std::string, int> myPathIndex;   // path of every file to its index in myRoot
+    /*
+     *  The name heap of a packed root region, holding the paths of the directory entries without terminating zero.
+     *  myNameOffsets[n] and myNameLengths[n] are the place of the path of entry n, the place is kept for its next path
+     *  if that is not longer. New paths are put behind namesEnd, compactNames() moves the paths together when the
+     *  heap is full. It has room for the longest path of every entry, so a path always fits after compacting.
+     */
+    std::vector<char> myNames;
+    std::vector<uint32_t> myNameOffsets;
+    std::vector<uint16_t> myNameLengths;
+    uint32_t namesEnd;
+    /*
+     *  Dirty flags per metadata block. They are indexed with 0 being the first block of the respective region, e.g.
+     *  myFatDirty[n] is set if the nth block of the FAT region differs from the container. writeDmap(), writeFat() and
+     *  writeRoot(), which writes the name heap, too, only write the blocks that are flagged and clear the flags
+     *  afterwards.
+     *  Containers with a journal never set them after fuseInit(), their changes go to myJournalRanges instead. With
+     *  shadow paging the flagged blocks are written by commitShadow().
+     */
+    bool mySuperBlockDirty;
+    std::vector<bool> myDmapDirty;
+    std::vector<bool> myFatDirty;
+    std::vector<bool> myLogicalDirty;
+    std::vector<bool> myRootDirty;
+    std::vector<bool> myNamesDirty;
+    /*
+     *  With lazytime myLazyTimes[n] is set if only the timestamps of directory entry n changed since it was written.
+     *  markRootDirty() clears it, the entry is written together with its timestamps then. flushLazyTimes() writes
+     *  the remaining ones once the first of them is LAZYTIME_INTERVAL old, runCommitter() and fuseFsync() check that.
+     */
+    std::vector<bool> myLazyTimes;
+    bool lazyTimesPending;
+    std::chrono::steady_clock::time_point myLazySince;  // time of the first timestamp change kept in memory
+    /*
+     *  Changes of the metadata since the last commit, the running transaction. myJournalRanges maps a block of the
+     *  container to the bytes [first, second) that changed inside it, commitJournal() writes their current content as
+     *  records to the journal. The metadata blocks themselves are only written by checkpointJournal(), which replays
+     *  the committed transactions from the journal.
+     */
+    std::map<uint32_t, std::pair<uint32_t, uint32_t>> myJournalRanges;
+    uint64_t journalSequence;   // sequence number of the next transaction
+    ulong journalHead;          // block inside the journal region the next transaction starts at, 1 if it is empty
+    size_t journalBytes;        // size of the running transaction with its header and records, see logChange()
+    /*
+     *  Bit n % 64 of mySlots[n / 64] is set if the nth metadata block behind the slot maps, counted from the start of
+     *  the DMAP, is in its second slot, shadowDistance blocks behind the first one. The map belongs to the superblock
+     *  of the last commit. commitShadow() writes changed blocks to the other slot, which no committed superblock
+     *  refers to, then the map and the superblock with the next generation to the other superblock.
+     */
+    std::vector<uint64_t> mySlots;
+    bool uncommitted;           // the metadata changed since the last commit of the journal or the shadow slots
+    std::chrono::steady_clock::time_point myChangesSince;   // time of the first change since the last commit
+    /*
+     *  The committer thread commits changes older than the commit interval while no operation runs, see
+     *  runCommitter(). fsLock serializes it with the fuse* methods, committerWake ends its wait on unmount.
+     */
+    std::recursive_mutex fsLock;
+    std::thread committer;
+    std::mutex committerLock;
+    std::condition_variable committerWake;
+    bool stopCommitter;
+    std::vector<FatCursor> myCursors;    //last position in the FAT chain per open file, indexed by file handle
+    /*
+     *  myExtents[n] maps the blocks of file n to runs of consecutive blocks inside the data segment, sorted by
+     *  logicalStart. They are built from myFAT and myLogical on first use (myExtentsValid[n]) and kept up to date by
+     *  allocateBlocks() and releaseBlocks(). Holes lie between extents.
+     */
+    std::vector<std::vector<Extent>> myExtents;
+    std::vector<bool> myExtentsValid;
+    std::vector<Readahead> myReadahead;  //sequential read detection per open file, indexed by file handle
+    std::vector<DelayedWrite> myDelayed; //written data without blocks per open file, indexed by file handle
+    std::vector<bool> myFsOpenFiles;
+    std::vector<bool> myFsEmpty; //1 = empty, 0 = occupied
     unsigned int iCounterFiles;
     unsigned int iCounterOpen;
     char *containerFilePath;
@@ -76,8 +214,18 @@ public:
     virtual int
     fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
 
+    virtual int fuseFlush(const char *path, struct fuse_file_info *fileInfo);
+
     virtual int fuseRelease(const char *path, struct fuse_file_info *fileInfo);
 
+    virtual int fuseFsync(const char *path, int datasync, struct fuse_file_info *fileInfo);
+
+#ifdef __APPLE__
+    virtual int fuseGetxattr(const char *path, const char *name, char *value, size_t size, uint x);
+#else
+    virtual int fuseGetxattr(const char *path, const char *name, char *value, size_t size);
+#endif
+
     virtual void *fuseInit(struct fuse_conn_info *conn);
 
     virtual int
@@ -85,10 +233,22 @@ public:
 
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
 
+    virtual int fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo);
+
+    virtual off_t fuseLseek(const char *path, off_t offset, int whence, struct fuse_file_info *fileInfo);
+
     virtual void fuseDestroy();
 
     // TODO: Add methods of your file system here
-    int allocateBlocks(int32_t numBlocks2Allocate, uint64_t fileHandle);
+    void *mountContainer(MyFsInfo *fsInfo);
+
+    size_t findHoles(uint64_t fileHandle, int32_t logicalBlock, int32_t numBlocks,
+                     std::vector<std::pair<int32_t, int32_t>> *holes);
+
+    int allocateBlocks(uint64_t fileHandle, int32_t logicalBlock, int32_t numBlocks,
+                       std::vector<std::pair<int32_t, int32_t>> *filled = NULL);
+
+    int releaseBlocks(uint64_t fileHandle, int32_t logicalBlock, int32_t numBlocks);
 
     int readAll();
 
@@ -106,21 +266,157 @@ public:
 
     int writeFat();
 
+    int readLogical();
+
+    int writeLogical();
+
     int readRoot();
 
+    int readPackedRoot();
+
     int writeRoot();
 
-    size_t findFreeBlock();
+    void noteChange();
+
+    void logChange(ulong blockNo, size_t offset, size_t length);
+
+    ulong journalBlocks(size_t bytes);
+
+    size_t journalRecords(size_t numBlocks);
+
+    size_t nameRecords(size_t index, const char *path);
+
+    size_t journalStep();
+
+    int reserveJournal(size_t records);
+
+    int32_t stepStart(uint64_t fh, int32_t first, int32_t end, size_t maxBlocks);
+
+    int releaseStep(uint64_t fh, int32_t start, size_t maxBlocks);
+
+    const char *metadataBlock(ulong blockNo, char *buffer);
+
+    ulong metadataAddress(ulong blockNo);
+
+    int commitMetadata(bool force);
+
+    void runCommitter();
+
+    void stopCommitThread();
+
+    int commitJournal();
+
+    int checkpointJournal();
+
+    int commitShadow();
+
+    static uint32_t metadataChecksum(uint64_t seed, const char *data, size_t length);
+
+    static bool isCommittedSuperBlock(const SuperBlock *superBlock);
+
+    size_t scanDmap(size_t blockNo, bool free);
+
+    bool isFreeBlock(size_t blockNo);
+
+    void setFreeBlock(size_t blockNo, bool free);
+
+    void buildDmapSummary();
+
+    void buildFreeExtents();
+
+    void addFreeExtent(int32_t start, int32_t length);
+
+    void takeFreeRange(int32_t start, int32_t length);
+
+    size_t allocateExtent(int32_t numBlocks, int32_t goal, int32_t *length);
 
     void initializeHelpers();
 
-    int freeBlocks(int32_t num);
+    static bool isValidBlockSize(uint32_t blockSize);
+
+    bool isAddressable(uint64_t end);
+
+    int readFormat(const char *path, SuperBlock *superBlock);
+
+    void setGeometry(uint32_t version, uint32_t blockSize, uint32_t numDataBlocks, uint32_t numDirEntries,
+                     bool shadowPaging);
+
+    int readMetadata(ulong pos, ulong numBlocks, char *data);
+
+    int writeMetadata(ulong pos, std::vector<bool> &dirty, const char *data);
+
+    void selectBlockDevice(MyFsInfo *fsInfo);
+
+    void markSuperBlockDirty();
+
+    void markDmapDirty(size_t blockNo);
+
+    void markFatDirty(size_t blockNo);
+
+    void markLogicalDirty(size_t blockNo);
+
+    void markRootDirty(size_t index);
+
+    void markNamesDirty(size_t offset, size_t length);
+
+    void storeName(size_t index, const char *path);
+
+    void compactNames(size_t index);
+
+    void touchAtime(size_t index);
+
+    void markTimesDirty(size_t index);
+
+    void flushLazyTimes(bool force);
+
+    int32_t mapRun(uint64_t fh, int32_t logicalBlock, int32_t maxBlocks, int32_t *runLength);
+
+    int readRun(int32_t runBlock, size_t byteOffset, char *dst, size_t bytes);
+
+    int writeRun(int32_t runBlock, off_t runStart, size_t byteOffset, const char *src, size_t bytes, size_t fileSize);
+
+    int readPartialBlock(int32_t block, off_t blockStart, size_t fileSize, char *buffer);
+
+    void invalidateCursor(uint64_t fh);
+
+    void resetReadahead(uint64_t fh);
+
+    void readahead(uint64_t fh, int32_t logicalBlock, int32_t numBlocks);
+
+    int delayWrite(uint64_t fh, const char *src, size_t bytes, off_t offset);
+
+    int flushDelayed(uint64_t fh);
+
+    int zeroRange(uint64_t fh, off_t offset, size_t bytes);
+
+    int zeroBehindEnd(uint64_t fh, off_t newSize);
+
+    void buildExtents(uint64_t fh);
+
+    void insertExtent(uint64_t fh, int32_t index, int32_t logicalBlock, int32_t physicalBlock, int32_t length);
+
+    void invalidateExtents(uint64_t fh);
+
+    int32_t nextExtent(uint64_t fh, int32_t logicalBlock);
+
+    int32_t findExtent(uint64_t fh, int32_t logicalBlock);
+
+    int32_t lookupExtent(uint64_t fh, int32_t logicalBlock);
+
+    int32_t allocatedEnd(uint64_t fh);
+
+    int32_t allocatedBlocks(uint64_t fh);
 
     int containerFull(size_t neededBlocks);
 
+    void releasePendingFrees();
+
+    void commitForSpace(size_t neededBlocks);
+
     int iIsPathValid(const char *path, uint64_t fh);
 
     int iFindEmptySpot();
+    int iFindFileIndex(const char *path);
 };
 
 #endif //MYFS_MYONDISKFS_H
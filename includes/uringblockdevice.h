@@ -0,0 +1,130 @@
+//
+//  uringblockdevice.h
+//  myfs
+//
+
+#ifndef uringblockdevice_h
+#define uringblockdevice_h
+
+#include <vector>
+
+#include "blockdevice.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+#define URING_QUEUE_DEPTH 64
+
+/// @brief Emulate a block device using io_uring
+///
+/// This block device transfers blocks through an io_uring submission queue. Requests handed over with submit() stay in
+/// flight until they are collected with reap(), so callers can keep up to queueDepth transfers running at the same
+/// time. The synchronous methods of BlockDevice are implemented on top of the ring and wait for their own transfer.
+///
+/// The ring is accessed under a lock, so the thread-safety guarantees of BlockDevice still hold. If the kernel does not
+/// provide io_uring (or it is not compiled in, see HAVE_IO_URING), all methods fall back to the pread/pwrite
+/// implementation of BlockDevice at runtime. Transfers the ring rejects or completes only partially are repeated with
+/// the fallback implementation as well.
+class UringBlockDevice : public BlockDevice {
+private:
+    int ringFd;                     // -1 if io_uring is not available
+    bool useFixedFile;              // register the container file with the ring when it is attached
+    bool fileRegistered;
+    std::vector<struct iovec> registeredBuffers;
+
+    std::mutex ringLock;
+    unsigned inFlight;              // submitted requests that have not completed yet
+    unsigned sqEntries;
+    unsigned cqEntries;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+
+    bool setupRing(unsigned queueDepth);
+    void teardownRing();
+    void registerFile();
+    void unregisterFile();
+    unsigned sqRoom();
+    struct io_uring_sqe *nextSqe();
+    void takeBackQueued(unsigned queued);
+    int submitQueued(unsigned queued);
+    int enter(unsigned toSubmit, unsigned minComplete);
+    void processCompletions();
+    int waitForCompletion();
+    int findRegisteredBuffer(const char *buffer, size_t length);
+    void setUserData(struct io_uring_sqe *sqe, uint64_t userData);
+    void prepareFile(struct io_uring_sqe *sqe);
+    void prepareTransfer(struct io_uring_sqe *sqe, bool write, uint32_t blockNo, const struct iovec *iov, int iovcnt);
+    void prepareRequest(struct io_uring_sqe *sqe, BlockRequest *req);
+    void finishRequest(BlockRequest *req, int res);
+    int transfer(bool write, uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+public:
+    /// @brief Create a new io_uring block device.
+    ///
+    /// Create a block device object with a given block size and set up a ring with the given number of submission
+    /// queue entries. If the ring cannot be set up, the object behaves like a BlockDevice.
+    /// \param blockSize Block size.
+    /// \param queueDepth Number of submission queue entries.
+    /// \param fixedFiles Register the container file with the ring to save a file lookup per transfer.
+    UringBlockDevice(uint32_t blockSize, unsigned queueDepth = URING_QUEUE_DEPTH, bool fixedFiles = true);
+
+    virtual ~UringBlockDevice();
+
+    /// @brief Check if transfers go through io_uring.
+    ///
+    /// \return true if the ring has been set up, false if the pread/pwrite fallback is used.
+    bool usesRing() const;
+
+    virtual int open(const char *path);
+
+    virtual int create(const char *path);
+
+    virtual int close();
+
+    virtual int read(uint32_t blockNo, char *buffer);
+
+    virtual int write(uint32_t blockNo, char *buffer);
+
+    virtual int readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer);
+
+    virtual int writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer);
+
+    virtual int readv(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int writev(uint32_t blockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int submit(BlockRequest **requests, int count);
+
+    virtual int reap(BlockRequest **done, int minRequests, int maxRequests);
+
+    /// @brief Register buffers with the ring.
+    ///
+    /// This method pins the given buffers in the kernel. Requests whose buffer lies completely inside one of them are
+    /// transferred without mapping the buffer again for every transfer. Any previously registered buffers are
+    /// replaced. No requests may be in flight.
+    /// \param [in] iov Buffers to register.
+    /// \param [in] iovcnt Number of buffers.
+    /// \return 0 on success, -ERRNO on failure.
+    int registerBuffers(const struct iovec *iov, int iovcnt);
+
+    /// @brief Unregister the buffers registered with registerBuffers().
+    ///
+    /// No requests may be in flight.
+    /// \return 0 on success, -ERRNO on failure.
+    int unregisterBuffers();
+};
+
+#endif /* uringblockdevice_h */
@@ -66,6 +66,8 @@ extern "C" {
     int wrap_fsyncdir(const char *path, int datasync, struct fuse_file_info *fileInfo);
     int wrap_ftruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
     int wrap_create(const char *, mode_t, struct fuse_file_info *);
+    int wrap_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo);
+    off_t wrap_lseek(const char *path, off_t offset, int whence, struct fuse_file_info *fileInfo);
     void wrap_destroy(void *userdata);
     
 #ifdef __cplusplus
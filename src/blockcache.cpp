@@ -0,0 +1,894 @@
+//
+//  blockcache.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+#include "blockcache.h"
+
+// *** CLOCK ***
+
+ClockPolicy::ClockPolicy(uint32_t numSlots) : referenced(numSlots, false), used(numSlots, false) {
+    this->hand = 0;
+    for (uint32_t i = numSlots; i > 0; i--)
+        this->freeSlots.push_back(i - 1);
+}
+
+void ClockPolicy::access(uint32_t slot) {
+    this->referenced[slot] = true;
+}
+
+uint32_t ClockPolicy::place(uint32_t blockNo) {
+    uint32_t slot;
+
+    if (!this->freeSlots.empty()) {
+        slot = this->freeSlots.back();
+        this->freeSlots.pop_back();
+    } else {
+        // give every referenced slot a second chance
+        while (this->referenced[this->hand]) {
+            this->referenced[this->hand] = false;
+            this->hand = (this->hand + 1) % this->used.size();
+        }
+        slot = this->hand;
+        this->hand = (this->hand + 1) % this->used.size();
+    }
+
+    this->used[slot] = true;
+    this->referenced[slot] = true;
+    return slot;
+}
+
+void ClockPolicy::remove(uint32_t slot) {
+    this->used[slot] = false;
+    this->referenced[slot] = false;
+    this->freeSlots.push_back(slot);
+}
+
+// *** ARC ***
+
+ArcPolicy::ArcPolicy(uint32_t numSlots) : slotBlock(numSlots, 0), used(numSlots, false) {
+    this->capacity = numSlots;
+    this->target = 0;
+    for (uint32_t i = numSlots; i > 0; i--)
+        this->freeSlots.push_back(i - 1);
+}
+
+void ArcPolicy::moveTo(uint32_t blockNo, Entry &entry, ListId list) {
+    this->lists[entry.list].erase(entry.pos);
+    this->lists[list].push_front(blockNo);
+    entry.list = list;
+    entry.pos = this->lists[list].begin();
+}
+
+/// forget the least recently used block number of a ghost list
+void ArcPolicy::dropLru(ListId list) {
+    uint32_t blockNo = this->lists[list].back();
+    this->lists[list].pop_back();
+    this->entries.erase(blockNo);
+}
+
+/// evict the least recently used block of T1 or T2 into its ghost list
+/// \return slot of the evicted block
+uint32_t ArcPolicy::replace(bool inB2) {
+    size_t t1 = this->lists[T1].size();
+    ListId from = (t1 > 0 && (t1 > this->target || (inB2 && t1 == this->target))) ? T1 : T2;
+
+    uint32_t victim = this->lists[from].back();
+    Entry &entry = this->entries[victim];
+    moveTo(victim, entry, from == T1 ? B1 : B2);
+
+    return entry.slot;
+}
+
+void ArcPolicy::access(uint32_t slot) {
+    uint32_t blockNo = this->slotBlock[slot];
+    moveTo(blockNo, this->entries[blockNo], T2);
+}
+
+uint32_t ArcPolicy::place(uint32_t blockNo) {
+    size_t t1 = this->lists[T1].size();
+    size_t b1 = this->lists[B1].size();
+    size_t t2 = this->lists[T2].size();
+    size_t b2 = this->lists[B2].size();
+    uint32_t slot = 0;
+    bool haveFree = !this->freeSlots.empty();
+    if (haveFree)
+        slot = this->freeSlots.back();
+
+    std::unordered_map<uint32_t, Entry>::iterator it = this->entries.find(blockNo);
+    if (it != this->entries.end()) {
+        // ghost hit, the list that remembered the block should have been larger
+        bool inB2 = it->second.list == B2;
+        if (inB2)
+            this->target -= std::min((size_t) this->target, std::max(b1 / b2, (size_t) 1));
+        else
+            this->target = std::min((size_t) this->capacity, this->target + std::max(b2 / b1, (size_t) 1));
+
+        if (!haveFree)
+            slot = replace(inB2);
+        moveTo(blockNo, it->second, T2);
+    } else {
+        if (t1 + b1 == this->capacity) {
+            if (t1 < this->capacity) {
+                dropLru(B1);
+                if (!haveFree)
+                    slot = replace(false);
+            } else {
+                // T1 fills the whole cache, its least recently used block is evicted without a ghost
+                uint32_t victim = this->lists[T1].back();
+                slot = this->entries[victim].slot;
+                this->lists[T1].pop_back();
+                this->entries.erase(victim);
+                haveFree = false;
+            }
+        } else {
+            if (t1 + b1 + t2 + b2 == 2 * (size_t) this->capacity)
+                dropLru(B2);
+            if (!haveFree)
+                slot = replace(false);
+        }
+
+        this->lists[T1].push_front(blockNo);
+        Entry entry;
+        entry.list = T1;
+        entry.pos = this->lists[T1].begin();
+        this->entries[blockNo] = entry;
+        it = this->entries.find(blockNo);
+    }
+
+    if (haveFree)
+        this->freeSlots.pop_back();
+    it->second.slot = slot;
+    this->slotBlock[slot] = blockNo;
+    this->used[slot] = true;
+    return slot;
+}
+
+void ArcPolicy::remove(uint32_t slot) {
+    uint32_t blockNo = this->slotBlock[slot];
+    std::unordered_map<uint32_t, Entry>::iterator it = this->entries.find(blockNo);
+    this->lists[it->second.list].erase(it->second.pos);
+    this->entries.erase(it);
+
+    this->used[slot] = false;
+    this->freeSlots.push_back(slot);
+}
+
+// *** Block cache ***
+
+/// copy len bytes from src into the buffers of iov, starting offset bytes after their start
+static void copyToIov(const struct iovec *iov, int iovcnt, size_t offset, const char *src, size_t len) {
+    for (int i = 0; i < iovcnt && len > 0; i++) {
+        if (offset >= iov[i].iov_len) {
+            offset -= iov[i].iov_len;
+            continue;
+        }
+        size_t n = std::min(len, iov[i].iov_len - offset);
+        memcpy((char *) iov[i].iov_base + offset, src, n);
+        src += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+/// get len bytes starting offset bytes into the buffers of iov, copied to tmp only if they span several buffers
+static const char *gatherFromIov(const struct iovec *iov, int iovcnt, size_t offset, char *tmp, size_t len) {
+    int i = 0;
+    while (i < iovcnt && offset >= iov[i].iov_len) {
+        offset -= iov[i].iov_len;
+        i++;
+    }
+    if (offset + len <= iov[i].iov_len)
+        return (const char *) iov[i].iov_base + offset;
+
+    char *dst = tmp;
+    for (; i < iovcnt && len > 0; i++) {
+        size_t n = std::min(len, iov[i].iov_len - offset);
+        memcpy(dst, (const char *) iov[i].iov_base + offset, n);
+        dst += n;
+        len -= n;
+        offset = 0;
+    }
+    return tmp;
+}
+
+BlockCache::BlockCache(BlockDevice *device, uint32_t numSlots, const char *policy)
+        : BlockDevice(device->getBlockSize()), slotBlock(numSlots, 0), slotUsed(numSlots, false),
+          slotDirty(numSlots, false), slotDirtySince(numSlots) {
+    this->device = device;
+    this->numSlots = numSlots;
+    this->writeBack = false;
+    this->dirtyLimit = numSlots;
+    this->dirtyExpire = std::chrono::milliseconds(BLOCK_CACHE_DIRTY_EXPIRE);
+    this->dirtyCount = 0;
+    this->writeError = 0;
+    this->stopThreads = false;
+    this->prefetching = false;
+    this->prefetchEpoch = 0;
+
+    if (policy != NULL && strcmp(policy, "arc") == 0)
+        this->policy = new ArcPolicy(numSlots);
+    else
+        this->policy = new ClockPolicy(numSlots);
+
+    // aligned, so a block device doing direct I/O can use the slots
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, 4096, (size_t) numSlots * this->blockSize) != 0)
+        ptr = NULL;
+    this->slots = (char *) ptr;
+
+    this->index.reserve(numSlots);
+    memset(&this->counters, 0, sizeof(this->counters));
+}
+
+BlockCache::~BlockCache() {
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        this->stopThreads = true;
+    }
+    this->flusherWake.notify_one();
+    this->prefetchWake.notify_one();
+    if (this->flusher.joinable())
+        this->flusher.join();
+    if (this->prefetcher.joinable())
+        this->prefetcher.join();
+
+    free(this->slots);
+    delete this->policy;
+    delete this->device;
+}
+
+BlockCacheStats BlockCache::stats() {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    return this->counters;
+}
+
+void BlockCache::enableWriteBack(unsigned dirtyRatio, unsigned dirtyExpire) {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    if (this->slots == NULL || this->numSlots == 0)
+        return;
+
+    this->writeBack = true;
+    this->dirtyLimit = std::max((uint32_t) ((uint64_t) this->numSlots * std::min(dirtyRatio, 100u) / 100), 1u);
+    this->dirtyExpire = std::chrono::milliseconds(dirtyExpire);
+
+    if (!this->flusher.joinable())
+        this->flusher = std::thread(&BlockCache::runFlusher, this);
+}
+
+char *BlockCache::slotData(uint32_t slot) {
+    return this->slots + (size_t) slot * this->blockSize;
+}
+
+void BlockCache::markDirty(uint32_t slot) {
+    if (this->slotDirty[slot])
+        return;
+
+    this->slotDirty[slot] = true;
+    this->slotDirtySince[slot] = std::chrono::steady_clock::now();
+    this->dirtyCount++;
+    if (this->dirtyCount == this->dirtyLimit)
+        this->flusherWake.notify_one();
+}
+
+void BlockCache::markClean(uint32_t slot) {
+    if (!this->slotDirty[slot])
+        return;
+
+    this->slotDirty[slot] = false;
+    this->dirtyCount--;
+}
+
+/// drop the block in slot from the cache without writing it back
+void BlockCache::drop(uint32_t slot) {
+    markClean(slot);
+    this->policy->remove(slot);
+    this->slotUsed[slot] = false;
+    this->index.erase(this->slotBlock[slot]);
+}
+
+/// drop all cached blocks
+void BlockCache::clear() {
+    for (uint32_t slot = 0; slot < this->numSlots; slot++) {
+        if (this->slotUsed[slot])
+            drop(slot);
+    }
+}
+
+/// put the content of a block into the cache, replacing another block if needed
+/// \param dirty true if the block has not been written to the block device yet
+void BlockCache::store(uint32_t blockNo, const char *buffer, bool dirty) {
+    uint32_t slot;
+    std::unordered_map<uint32_t, uint32_t>::iterator it = this->index.find(blockNo);
+    if (it != this->index.end()) {
+        slot = it->second;
+        this->policy->access(slot);
+    } else {
+        slot = this->policy->place(blockNo);
+        if (this->slotUsed[slot]) {
+            if (this->slotDirty[slot]) {
+                noteWrite(this->slotBlock[slot], 1);
+                int ret = this->device->write(this->slotBlock[slot], slotData(slot));
+                if (ret < 0 && this->writeError == 0)
+                    this->writeError = ret;
+                this->counters.writebacks++;
+                markClean(slot);
+            }
+            this->index.erase(this->slotBlock[slot]);
+            this->counters.evictions++;
+        }
+        this->slotUsed[slot] = true;
+        this->slotBlock[slot] = blockNo;
+        this->index[blockNo] = slot;
+    }
+
+    memcpy(slotData(slot), buffer, this->blockSize);
+    if (dirty)
+        markDirty(slot);
+    else
+        markClean(slot);
+}
+
+/// read blocks into the buffers of iov, blocks that are not cached are read in runs and added to the cache
+/// \return 0 on success, -ERRNO on failure
+int BlockCache::readCached(uint32_t blockNo, uint32_t numBlocks, const struct iovec *iov, int iovcnt) {
+    if (this->slots == NULL || this->numSlots == 0)
+        return this->device->readv(blockNo, iov, iovcnt);
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+
+    std::vector<char> run;
+    uint32_t i = 0;
+    while (i < numBlocks) {
+        std::unordered_map<uint32_t, uint32_t>::iterator it = this->index.find(blockNo + i);
+        if (it != this->index.end()) {
+            copyToIov(iov, iovcnt, (size_t) i * this->blockSize, slotData(it->second), this->blockSize);
+            this->policy->access(it->second);
+            this->counters.hits++;
+            i++;
+            continue;
+        }
+
+        // read all consecutive blocks that are missing with one call
+        uint32_t end = i + 1;
+        while (end < numBlocks && this->index.find(blockNo + end) == this->index.end())
+            end++;
+
+        run.resize((size_t) (end - i) * this->blockSize);
+        int ret = this->device->readBlocks(blockNo + i, end - i, run.data());
+        if (ret < 0)
+            return ret;
+        this->counters.misses += end - i;
+
+        for (uint32_t b = i; b < end; b++) {
+            const char *block = run.data() + (size_t) (b - i) * this->blockSize;
+            copyToIov(iov, iovcnt, (size_t) b * this->blockSize, block, this->blockSize);
+            store(blockNo + b, block, false);
+        }
+        i = end;
+    }
+
+    return 0;
+}
+
+/// update the cache with the written blocks, in write-through mode write them to the block device first
+/// \return 0 on success, -ERRNO on failure
+int BlockCache::writeCached(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    if (this->slots == NULL || this->numSlots == 0)
+        return this->device->writev(blockNo, iov, iovcnt);
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    uint32_t numBlocks = (uint32_t) (total / this->blockSize);
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+
+    if (!this->writeBack) {
+        noteWrite(blockNo, numBlocks);
+        int ret = this->device->writev(blockNo, iov, iovcnt);
+        if (ret < 0) {
+            // the content of the blocks in the container is unknown now
+            for (uint32_t b = 0; b < numBlocks; b++) {
+                std::unordered_map<uint32_t, uint32_t>::iterator it = this->index.find(blockNo + b);
+                if (it != this->index.end())
+                    drop(it->second);
+            }
+            return ret;
+        }
+    }
+
+    std::vector<char> tmp(this->blockSize);
+    for (uint32_t b = 0; b < numBlocks; b++) {
+        const char *block = gatherFromIov(iov, iovcnt, (size_t) b * this->blockSize, tmp.data(), this->blockSize);
+        store(blockNo + b, block, this->writeBack);
+    }
+
+    return 0;
+}
+
+/// write dirty blocks to the block device in ascending order, consecutive blocks with one request; batches of up to
+/// BLOCK_CACHE_FLUSH_DEPTH requests are submitted at once and the lock is released after every batch, so other threads
+/// are not blocked for the whole write back
+/// \param all true to write back all dirty blocks, false for those that have expired
+/// \return 0 on success, -ERRNO if a block could not be written, it stays dirty
+int BlockCache::writeBackDirty(bool all, std::unique_lock<std::mutex> &guard) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::vector<uint32_t> blocks;
+    for (uint32_t slot = 0; slot < this->numSlots && blocks.size() < this->dirtyCount; slot++) {
+        if (this->slotDirty[slot] && (all || now - this->slotDirtySince[slot] >= this->dirtyExpire))
+            blocks.push_back(this->slotBlock[slot]);
+    }
+    std::sort(blocks.begin(), blocks.end());
+
+    int ret = 0;
+    std::vector<uint32_t> batchSlots;   // slots of the blocks of all requests of the batch, in order
+    std::vector<BlockRequest> batch;
+    size_t i = 0;
+    while (i < blocks.size()) {
+        batchSlots.clear();
+        batch.clear();
+        while (i < blocks.size() && batch.size() < BLOCK_CACHE_FLUSH_DEPTH) {
+            // collect a run of consecutive blocks that are still dirty, others may have written them back meanwhile
+            size_t first = batchSlots.size();
+            for (; i < blocks.size() && batchSlots.size() - first < BLOCK_CACHE_FLUSH_BATCH; i++) {
+                std::unordered_map<uint32_t, uint32_t>::iterator it = this->index.find(blocks[i]);
+                bool dirty = it != this->index.end() && this->slotDirty[it->second];
+                if (batchSlots.size() > first && (!dirty || blocks[i] != this->slotBlock[batchSlots.back()] + 1))
+                    break;
+                if (dirty)
+                    batchSlots.push_back(it->second);
+            }
+            if (batchSlots.size() == first)
+                continue;
+
+            BlockRequest req;
+            req.write = true;
+            req.blockNo = this->slotBlock[batchSlots[first]];
+            req.numBlocks = (uint32_t) (batchSlots.size() - first);
+            req.buffer = NULL;
+            req.result = 0;
+            req.userData = NULL;
+            batch.push_back(req);
+        }
+        if (batch.empty())
+            continue;
+
+        // a request needs the blocks of its run next to each other
+        this->flushData.resize(batchSlots.size() * this->blockSize);
+        size_t k = 0;
+        for (size_t r = 0; r < batch.size(); r++) {
+            batch[r].buffer = this->flushData.data() + k * this->blockSize;
+            for (uint32_t b = 0; b < batch[r].numBlocks; b++, k++)
+                memcpy(this->flushData.data() + k * this->blockSize, slotData(batchSlots[k]), this->blockSize);
+            noteWrite(batch[r].blockNo, batch[r].numBlocks);
+        }
+
+        int pending;
+        submitBatch(batch, &pending);
+        reapDevice(&pending);
+
+        k = 0;
+        for (size_t r = 0; r < batch.size(); r++) {
+            if (batch[r].result < 0) {
+                if (ret == 0)
+                    ret = batch[r].result;
+            } else {
+                for (uint32_t b = 0; b < batch[r].numBlocks; b++)
+                    markClean(batchSlots[k + b]);
+                this->counters.writebacks += batch[r].numBlocks;
+            }
+            k += batch[r].numBlocks;
+        }
+
+        guard.unlock();
+        guard.lock();
+    }
+
+    return ret;
+}
+
+/// submit requests of the cache itself to the block device, if it refuses them they are performed right away
+/// \param batch Requests to submit, they must stay in place until they have been reaped.
+/// \param pending Number of the requests in flight, reapDevice() counts it down.
+void BlockCache::submitBatch(std::vector<BlockRequest> &batch, int *pending) {
+    std::vector<BlockRequest *> requests(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        batch[i].userData = pending;
+        requests[i] = &batch[i];
+    }
+    {
+        std::lock_guard<std::mutex> guard(reapLock);
+        *pending = (int) batch.size();
+    }
+
+    if (this->device->submit(requests.data(), (int) requests.size()) < 0) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (batch[i].write)
+                batch[i].result = this->device->writeBlocks(batch[i].blockNo, batch[i].numBlocks, batch[i].buffer);
+            else
+                batch[i].result = this->device->readBlocks(batch[i].blockNo, batch[i].numBlocks, batch[i].buffer);
+        }
+        std::lock_guard<std::mutex> guard(reapLock);
+        *pending = 0;
+    }
+}
+
+/// reap finished requests of the block device until the awaited ones are done; requests passed on by submit() go to
+/// completed, those of a batch of the cache count down the number their userData points to
+/// \param pending Number of requests in flight of the batch to wait for, NULL to wait for requests passed on.
+/// \return 0 on success, -ERRNO if reaping failed while waiting for requests passed on
+int BlockCache::reapDevice(int *pending) {
+    std::lock_guard<std::mutex> guard(reapLock);
+
+    BlockRequest *done[BLOCK_CACHE_FLUSH_DEPTH];
+    while (true) {
+        if (pending != NULL) {
+            if (*pending == 0)
+                return 0;
+        } else {
+            std::lock_guard<std::mutex> completedGuard(completedLock);
+            if (!this->completed.empty() || this->passedOn.empty())
+                return 0;
+        }
+
+        int n = this->device->reap(done, 1, BLOCK_CACHE_FLUSH_DEPTH);
+        if (n < 0) {
+            // the buffers of a batch stay in use until its requests are reaped, so only callers give up
+            if (pending == NULL)
+                return n;
+            continue;
+        }
+
+        std::lock_guard<std::mutex> completedGuard(completedLock);
+        for (int i = 0; i < n; i++) {
+            std::unordered_set<BlockRequest *>::iterator it = this->passedOn.find(done[i]);
+            if (it != this->passedOn.end()) {
+                this->passedOn.erase(it);
+                this->completed.push_back(done[i]);
+            } else {
+                (*(int *) done[i]->userData)--;
+            }
+        }
+    }
+}
+
+/// tell the prefetcher that blocks are written to the block device, content it is reading for them may be outdated
+void BlockCache::noteWrite(uint32_t blockNo, uint32_t numBlocks) {
+    if (!this->prefetching)
+        return;
+
+    for (size_t i = 0; i < this->prefetchBatch.size(); i++) {
+        const BlockRequest &req = this->prefetchBatch[i];
+        if (blockNo < req.blockNo + req.numBlocks && blockNo + numBlocks > req.blockNo)
+            this->prefetchStale[i] = true;
+    }
+}
+
+/// check if a write of the block passed on by submit() is in flight, prefetching it could get its old content
+bool BlockCache::writeInFlight(uint32_t blockNo) {
+    std::lock_guard<std::mutex> guard(completedLock);
+    for (std::unordered_set<BlockRequest *>::iterator it = this->passedOn.begin(); it != this->passedOn.end(); it++) {
+        if ((*it)->write && blockNo >= (*it)->blockNo && blockNo < (*it)->blockNo + (*it)->numBlocks)
+            return true;
+    }
+    return false;
+}
+
+/// drop pending prefetch requests and wait until the prefetcher does not access the block device anymore
+void BlockCache::waitPrefetch(std::unique_lock<std::mutex> &guard) {
+    this->prefetchQueue.clear();
+    this->prefetchEpoch++;
+    this->prefetchIdle.wait(guard, [this] { return !this->prefetching; });
+}
+
+/// body of the prefetch thread
+void BlockCache::runPrefetcher() {
+    std::vector<char> data;
+    std::vector<uint32_t> missing;
+
+    std::unique_lock<std::mutex> guard(cacheLock);
+    while (!this->stopThreads) {
+        if (this->prefetchQueue.empty()) {
+            this->prefetchWake.wait(guard);
+            continue;
+        }
+
+        // take queued requests as long as a batch does not evict blocks prefetched by itself
+        uint32_t limit = std::max(this->numSlots / 4, 1u);
+        uint32_t taken = 0;
+        uint64_t epoch = this->prefetchEpoch;
+        missing.clear();
+        while (!this->prefetchQueue.empty() && (taken == 0 || taken + this->prefetchQueue.front().second <= limit)) {
+            uint32_t blockNo = this->prefetchQueue.front().first;
+            uint32_t end = blockNo + this->prefetchQueue.front().second;
+            taken += this->prefetchQueue.front().second;
+            this->prefetchQueue.pop_front();
+
+            for (uint32_t b = blockNo; b < end; b++) {
+                if (this->index.find(b) == this->index.end() && !writeInFlight(b))
+                    missing.push_back(b);
+            }
+        }
+        std::sort(missing.begin(), missing.end());
+        missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+        // read consecutive missing blocks with one request, long runs are split to be read in parallel
+        this->prefetchBatch.clear();
+        for (size_t i = 0; i < missing.size(); i++) {
+            if (!this->prefetchBatch.empty()) {
+                BlockRequest &last = this->prefetchBatch.back();
+                if (missing[i] == last.blockNo + last.numBlocks && last.numBlocks < BLOCK_CACHE_PREFETCH_RUN) {
+                    last.numBlocks++;
+                    continue;
+                }
+            }
+            BlockRequest req;
+            req.write = false;
+            req.blockNo = missing[i];
+            req.numBlocks = 1;
+            req.buffer = NULL;
+            req.result = 0;
+            req.userData = NULL;
+            this->prefetchBatch.push_back(req);
+        }
+        if (this->prefetchBatch.empty())
+            continue;
+
+        data.resize(missing.size() * this->blockSize);
+        size_t offset = 0;
+        for (size_t i = 0; i < this->prefetchBatch.size(); i++) {
+            this->prefetchBatch[i].buffer = data.data() + offset;
+            offset += (size_t) this->prefetchBatch[i].numBlocks * this->blockSize;
+        }
+        this->prefetchStale.assign(this->prefetchBatch.size(), false);
+        this->prefetching = true;
+
+        guard.unlock();
+        int pending;
+        submitBatch(this->prefetchBatch, &pending);
+        reapDevice(&pending);
+        guard.lock();
+
+        this->prefetching = false;
+        this->prefetchIdle.notify_all();
+
+        for (size_t i = 0; i < this->prefetchBatch.size() && epoch == this->prefetchEpoch; i++) {
+            const BlockRequest &req = this->prefetchBatch[i];
+            if (req.result != 0 || this->prefetchStale[i])
+                continue;
+            for (uint32_t b = 0; b < req.numBlocks; b++) {
+                // blocks read by others meanwhile are already in the cache
+                if (this->index.find(req.blockNo + b) == this->index.end()) {
+                    store(req.blockNo + b, req.buffer + (size_t) b * this->blockSize, false);
+                    this->counters.prefetched++;
+                }
+            }
+        }
+    }
+}
+
+/// body of the flusher thread
+void BlockCache::runFlusher() {
+    // wake up often enough to write back blocks soon after they have expired
+    std::chrono::milliseconds interval = std::max(this->dirtyExpire / 4, std::chrono::milliseconds(10));
+
+    std::unique_lock<std::mutex> guard(cacheLock);
+    while (!this->stopThreads) {
+        this->flusherWake.wait_for(guard, interval);
+        if (this->stopThreads || this->dirtyCount == 0)
+            continue;
+
+        // failed blocks stay dirty, the next flush() reports the error
+        writeBackDirty(this->dirtyCount >= this->dirtyLimit, guard);
+    }
+}
+
+int BlockCache::open(const char *path) {
+    std::unique_lock<std::mutex> guard(cacheLock);
+    waitPrefetch(guard);
+    clear();
+    return this->device->open(path);
+}
+
+int BlockCache::create(const char *path) {
+    std::unique_lock<std::mutex> guard(cacheLock);
+    waitPrefetch(guard);
+    clear();
+    return this->device->create(path);
+}
+
+int BlockCache::close() {
+    std::unique_lock<std::mutex> guard(cacheLock);
+    waitPrefetch(guard);
+    int ret = writeBackDirty(true, guard);
+    if (ret == 0)
+        ret = this->writeError;
+    clear();
+    this->writeError = 0;
+
+    int closed = this->device->close();
+    return ret < 0 ? ret : closed;
+}
+
+int BlockCache::read(uint32_t blockNo, char *buffer) {
+    return readBlocks(blockNo, 1, buffer);
+}
+
+int BlockCache::write(uint32_t blockNo, char *buffer) {
+    return writeBlocks(blockNo, 1, buffer);
+}
+
+int BlockCache::readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) numBlocks * this->blockSize;
+
+    return readCached(blockNo, numBlocks, &iov, 1);
+}
+
+int BlockCache::writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer) {
+    struct iovec iov;
+    iov.iov_base = (void *) buffer;
+    iov.iov_len = (size_t) numBlocks * this->blockSize;
+
+    return writeCached(blockNo, &iov, 1);
+}
+
+int BlockCache::readv(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    return readCached(blockNo, (uint32_t) (total / this->blockSize), iov, iovcnt);
+}
+
+int BlockCache::writev(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    return writeCached(blockNo, iov, iovcnt);
+}
+
+int BlockCache::submit(BlockRequest **requests, int count) {
+    std::vector<BlockRequest *> local;
+    std::vector<BlockRequest *> forward;
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        for (int i = 0; i < count; i++) {
+            BlockRequest *req = requests[i];
+            bool cached = true;
+            bool dirty = false;
+            for (uint32_t b = 0; b < req->numBlocks; b++) {
+                std::unordered_map<uint32_t, uint32_t>::iterator it = this->index.find(req->blockNo + b);
+                if (it == this->index.end())
+                    cached = false;
+                else if (this->slotDirty[it->second])
+                    dirty = true;
+            }
+
+            if (req->write ? this->writeBack : cached || dirty) {
+                local.push_back(req);
+                continue;
+            }
+            if (req->write) {
+                noteWrite(req->blockNo, req->numBlocks);
+                for (uint32_t b = 0; b < req->numBlocks; b++) {
+                    std::unordered_map<uint32_t, uint32_t>::iterator it = this->index.find(req->blockNo + b);
+                    if (it != this->index.end())
+                        drop(it->second);
+                }
+            }
+            forward.push_back(req);
+        }
+
+        // still under the lock, so the prefetcher sees the writes in flight
+        if (!forward.empty()) {
+            {
+                std::lock_guard<std::mutex> completedGuard(completedLock);
+                this->passedOn.insert(forward.begin(), forward.end());
+            }
+            if (this->device->submit(forward.data(), (int) forward.size()) < 0) {
+                std::lock_guard<std::mutex> completedGuard(completedLock);
+                for (size_t i = 0; i < forward.size(); i++) {
+                    BlockRequest *req = forward[i];
+                    this->passedOn.erase(req);
+                    if (req->write)
+                        req->result = this->device->writeBlocks(req->blockNo, req->numBlocks, req->buffer);
+                    else
+                        req->result = this->device->readBlocks(req->blockNo, req->numBlocks, req->buffer);
+                    this->completed.push_back(req);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < local.size(); i++) {
+        BlockRequest *req = local[i];
+        if (req->write)
+            req->result = writeBlocks(req->blockNo, req->numBlocks, req->buffer);
+        else
+            req->result = readBlocks(req->blockNo, req->numBlocks, req->buffer);
+    }
+    std::lock_guard<std::mutex> guard(completedLock);
+    this->completed.insert(this->completed.end(), local.begin(), local.end());
+
+    return 0;
+}
+
+int BlockCache::reap(BlockRequest **done, int minRequests, int maxRequests) {
+    int n = 0;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> guard(completedLock);
+            while (n < maxRequests && !this->completed.empty()) {
+                done[n++] = this->completed.front();
+                this->completed.pop_front();
+            }
+            if (n >= minRequests || n >= maxRequests || this->passedOn.empty())
+                break;
+        }
+
+        int ret = reapDevice(NULL);
+        if (ret < 0)
+            return n > 0 ? n : ret;
+    }
+
+    return n;
+}
+
+int BlockCache::flush() {
+    std::unique_lock<std::mutex> guard(cacheLock);
+    int ret = writeBackDirty(true, guard);
+    if (ret == 0)
+        ret = this->writeError;
+    this->writeError = 0;
+
+    return ret;
+}
+
+int BlockCache::sync() {
+    int ret = flush();
+    int synced = this->device->sync();
+
+    return ret < 0 ? ret : synced;
+}
+
+int BlockCache::advise(uint32_t blockNo, uint32_t numBlocks, BlockAdvice advice) {
+    // mapped blocks are read through blockPtr(), prefetching them into the cache would hold them twice
+    if (advice == BD_ADVICE_WILLNEED && numBlocks > 0 && this->slots != NULL && this->numSlots > 0
+        && this->device->blockPtr(blockNo, numBlocks) == NULL) {
+        std::lock_guard<std::mutex> guard(cacheLock);
+
+        // a prefetch must not evict the blocks prefetched before it is used
+        numBlocks = std::min(numBlocks, std::max(this->numSlots / 4, 1u));
+        if (this->prefetchQueue.size() >= BLOCK_CACHE_PREFETCH_QUEUE)
+            this->prefetchQueue.pop_front();
+        this->prefetchQueue.push_back(std::make_pair(blockNo, numBlocks));
+
+        if (!this->prefetcher.joinable())
+            this->prefetcher = std::thread(&BlockCache::runPrefetcher, this);
+        this->prefetchWake.notify_one();
+    }
+
+    // the block device may start reading on its own, which speeds up the prefetcher
+    return this->device->advise(blockNo, numBlocks, advice);
+}
+
+const char *BlockCache::blockPtr(uint32_t blockNo, uint32_t numBlocks) {
+    std::lock_guard<std::mutex> guard(cacheLock);
+
+    // clean cached blocks have the content of the block device, dirty ones are newer
+    if (this->dirtyCount > 0) {
+        for (uint32_t b = 0; b < numBlocks; b++) {
+            std::unordered_map<uint32_t, uint32_t>::iterator it = this->index.find(blockNo + b);
+            if (it != this->index.end() && this->slotDirty[it->second])
+                return NULL;
+        }
+    }
+
+    return this->device->blockPtr(blockNo, numBlocks);
+}
@@ -16,6 +16,10 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
 #include "macros.h"
 
 #include "blockdevice.h"
@@ -25,6 +29,15 @@
 BlockDevice::BlockDevice(uint32_t blockSize) {
     assert(blockSize % 512 == 0);
     this->blockSize= blockSize;
+    this->contFile= -1;
+    this->openFlags= 0;
+}
+
+BlockDevice::~BlockDevice() {
+}
+
+uint32_t BlockDevice::getBlockSize() const {
+    return this->blockSize;
 }
 
 int BlockDevice::create(const char *path) {
@@ -32,12 +45,12 @@ int BlockDevice::create(const char *path) {
     int ret= 0;
 
     // Open Container file
-    contFile = ::open(path, O_EXCL | O_RDWR | O_CREAT, 0666);
+    contFile = ::open(path, O_EXCL | O_RDWR | O_CREAT | this->openFlags, 0666);
     if (contFile < 0) {
         if (errno == EEXIST) {
             // file already exists, we must open & truncate
             LOG("WARNING: container file already exists, truncating")
-            contFile = ::open(path, O_EXCL | O_RDWR | O_TRUNC);
+            contFile = ::open(path, O_EXCL | O_RDWR | O_TRUNC | this->openFlags);
         }
 
         if(contFile < 0) {
@@ -56,7 +69,7 @@ int BlockDevice::open(const char *path) {
     int ret= 0;
 
     // Open Container file
-    contFile = ::open(path, O_EXCL | O_RDWR);
+    contFile = ::open(path, O_EXCL | O_RDWR | this->openFlags);
     if (contFile < 0) {
         if (errno == ENOENT)
             LOG("ERROR: container file does not exists");
@@ -87,15 +100,24 @@ int BlockDevice::read(uint32_t blockNo, char *buffer) {
     fprintf(stderr, "BlockDevice: Reading block %d\n", blockNo);
 #endif
     off_t pos = (off_t) blockNo * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
-        return -errno;
-    
-    int size = (this->blockSize);
-    ssize_t r = ::read(this->contFile, buffer, size);
-    if (r < 0)
-        return -errno;
-    if (r < size)
-        memset(buffer + r, 0, size - r);
+
+    // positional I/O, there is no shared file offset between concurrent callers
+    size_t size = this->blockSize;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t r = ::pread(this->contFile, buffer + done, size - done, pos + done);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (r == 0) {
+            // end of container file, the rest reads as zeros
+            memset(buffer + done, 0, size - done);
+            break;
+        }
+        done += r;
+    }
 
     return 0;
 }
@@ -106,16 +128,198 @@ int BlockDevice::write(uint32_t blockNo, char *buffer) {
     fprintf(stderr, "BlockDevice: Writing block %d\n", blockNo);
 #endif
     off_t pos = (off_t) blockNo * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
-        return -errno;
 
-    int size = (this->blockSize);
-    ssize_t w = ::write(this->contFile, buffer, size);
-    if (w < 0)
+    // positional I/O, there is no shared file offset between concurrent callers
+    size_t size = this->blockSize;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t w = ::pwrite(this->contFile, buffer + done, size - done, pos + done);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (w == 0)
+            return -ENOSPC;
+        done += w;
+    }
+
+    return 0;
+}
+
+int BlockDevice::readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) numBlocks * this->blockSize;
+
+    return readv(blockNo, &iov, 1);
+}
+
+int BlockDevice::writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer) {
+    struct iovec iov;
+    iov.iov_base = (void *) buffer;
+    iov.iov_len = (size_t) numBlocks * this->blockSize;
+
+    return writev(blockNo, &iov, 1);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readv(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Reading blocks starting at %d\n", blockNo);
+#endif
+    return preadvAt((off_t) blockNo * this->blockSize, iov, iovcnt);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writev(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Writing blocks starting at %d\n", blockNo);
+#endif
+    return pwritevAt((off_t) blockNo * this->blockSize, iov, iovcnt);
+}
+
+// reads at a byte position, this method returns 0 if successful, -errno otherwise
+int BlockDevice::preadvAt(off_t pos, const struct iovec *iov, int iovcnt) {
+
+    // preadv may transfer less than requested, so we need a copy of the vector we can advance
+    std::vector<struct iovec> vec(iov, iov + iovcnt);
+    size_t i = 0;
+
+    while (i < vec.size()) {
+        int cnt = std::min(vec.size() - i, (size_t) IOV_MAX);
+        ssize_t r = ::preadv(this->contFile, &vec[i], cnt, pos);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        if (r == 0) {
+            // end of container file, the rest reads as zeros
+            for (; i < vec.size(); i++)
+                memset(vec[i].iov_base, 0, vec[i].iov_len);
+            break;
+        }
+
+        pos += r;
+        while (i < vec.size() && (size_t) r >= vec[i].iov_len) {
+            r -= vec[i].iov_len;
+            i++;
+        }
+        if (r > 0) {
+            vec[i].iov_base = (char *) vec[i].iov_base + r;
+            vec[i].iov_len -= r;
+        }
+    }
+
+    return 0;
+}
+
+// writes at a byte position, this method returns 0 if successful, -errno otherwise
+int BlockDevice::pwritevAt(off_t pos, const struct iovec *iov, int iovcnt) {
+    // pwritev may transfer less than requested, so we need a copy of the vector we can advance
+    std::vector<struct iovec> vec(iov, iov + iovcnt);
+    size_t i = 0;
+
+    while (i < vec.size()) {
+        int cnt = std::min(vec.size() - i, (size_t) IOV_MAX);
+        ssize_t w = ::pwritev(this->contFile, &vec[i], cnt, pos);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (w == 0)
+            return -ENOSPC;
+
+        pos += w;
+        while (i < vec.size() && (size_t) w >= vec[i].iov_len) {
+            w -= vec[i].iov_len;
+            i++;
+        }
+        if (w > 0) {
+            vec[i].iov_base = (char *) vec[i].iov_base + w;
+            vec[i].iov_len -= w;
+        }
+    }
+
+    return 0;
+}
+
+// the requests are performed right away, reap() only hands them back
+int BlockDevice::submit(BlockRequest **requests, int count) {
+    for (int i = 0; i < count; i++) {
+        BlockRequest *req = requests[i];
+        if (req->write)
+            req->result = writeBlocks(req->blockNo, req->numBlocks, req->buffer);
+        else
+            req->result = readBlocks(req->blockNo, req->numBlocks, req->buffer);
+    }
+
+    std::lock_guard<std::mutex> guard(completedLock);
+    completed.insert(completed.end(), requests, requests + count);
+
+    return 0;
+}
+
+int BlockDevice::reap(BlockRequest **done, int minRequests, int maxRequests) {
+    std::lock_guard<std::mutex> guard(completedLock);
+
+    int n = 0;
+    while (n < maxRequests && !completed.empty()) {
+        done[n++] = completed.front();
+        completed.pop_front();
+    }
+
+    return n;
+}
+
+// blocks are written to the container file right away
+int BlockDevice::flush() {
+    return 0;
+}
+
+int BlockDevice::sync() {
+#ifdef __APPLE__
+    if (::fsync(this->contFile) < 0)
+#else
+    if (::fdatasync(this->contFile) < 0)
+#endif
         return -errno;
-    if (w < size)
-        return -ENOSPC;
 
     return 0;
 }
 
+int BlockDevice::advise(uint32_t blockNo, uint32_t numBlocks, BlockAdvice advice) {
+#ifdef POSIX_FADV_NORMAL
+    int fadvice;
+    switch (advice) {
+        case BD_ADVICE_SEQUENTIAL:
+            fadvice = POSIX_FADV_SEQUENTIAL;
+            break;
+        case BD_ADVICE_RANDOM:
+            fadvice = POSIX_FADV_RANDOM;
+            break;
+        case BD_ADVICE_WILLNEED:
+            fadvice = POSIX_FADV_WILLNEED;
+            break;
+        case BD_ADVICE_DONTNEED:
+            fadvice = POSIX_FADV_DONTNEED;
+            break;
+        default:
+            fadvice = POSIX_FADV_NORMAL;
+    }
+
+    // posix_fadvise returns the error number instead of setting errno
+    return -::posix_fadvise(this->contFile, (off_t) blockNo * this->blockSize, (off_t) numBlocks * this->blockSize,
+                            fadvice);
+#else
+    return 0;
+#endif
+}
+
+// the container is accessed through system calls only
+const char *BlockDevice::blockPtr(uint32_t blockNo, uint32_t numBlocks) {
+    return NULL;
+}
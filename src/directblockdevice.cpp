@@ -0,0 +1,302 @@
+//
+//  directblockdevice.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+#include "directblockdevice.h"
+
+DirectBlockDevice::DirectBlockDevice(uint32_t blockSize) : BlockDevice(blockSize) {
+    this->direct = false;
+    this->memAlign = DIRECT_DEFAULT_ALIGNMENT;
+    this->offsetAlign = DIRECT_DEFAULT_ALIGNMENT;
+
+    for (int i = 0; i < DIRECT_POOL_BUFFERS; i++) {
+        void *buffer;
+        if (posix_memalign(&buffer, DIRECT_DEFAULT_ALIGNMENT, DIRECT_BUFFER_SIZE) == 0)
+            this->pool.push_back((char *) buffer);
+    }
+}
+
+DirectBlockDevice::~DirectBlockDevice() {
+    for (size_t i = 0; i < this->pool.size(); i++)
+        free(this->pool[i]);
+}
+
+bool DirectBlockDevice::usesDirectIO() const {
+    return this->direct;
+}
+
+int DirectBlockDevice::open(const char *path) {
+    return attach(false, path);
+}
+
+int DirectBlockDevice::create(const char *path) {
+    return attach(true, path);
+}
+
+/// Open or create the container file for direct I/O, without it if the file system refuses.
+/// \return 0 on success, -ERRNO on failure.
+int DirectBlockDevice::attach(bool create, const char *path) {
+    int ret;
+    this->direct = false;
+
+#ifdef O_DIRECT
+    this->openFlags = O_DIRECT;
+    ret = create ? BlockDevice::create(path) : BlockDevice::open(path);
+    this->openFlags = 0;
+    if (ret != -EINVAL) {
+        if (ret >= 0) {
+            this->direct = true;
+            queryAlignment();
+        }
+        return ret;
+    }
+#endif
+
+    ret = create ? BlockDevice::create(path) : BlockDevice::open(path);
+#ifdef F_NOCACHE
+    if (ret >= 0 && fcntl(this->contFile, F_NOCACHE, 1) == 0) {
+        // F_NOCACHE has no alignment requirements, but aligned transfers are cheaper
+        this->direct = true;
+        this->memAlign = this->blockSize;
+        this->offsetAlign = this->blockSize;
+    }
+#endif
+    return ret;
+}
+
+/// Ask the file system for the alignment direct I/O needs.
+void DirectBlockDevice::queryAlignment() {
+    this->memAlign = DIRECT_DEFAULT_ALIGNMENT;
+    this->offsetAlign = DIRECT_DEFAULT_ALIGNMENT;
+
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (statx(this->contFile, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) &&
+        stx.stx_dio_offset_align > 0) {
+        this->memAlign = std::max(stx.stx_dio_mem_align, 1u);
+        this->offsetAlign = stx.stx_dio_offset_align;
+    }
+#endif
+}
+
+/// Take a bounce buffer of DIRECT_BUFFER_SIZE bytes from the pool, allocate one if the pool is empty.
+char *DirectBlockDevice::takeBuffer() {
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        if (!this->pool.empty()) {
+            char *buffer = this->pool.back();
+            this->pool.pop_back();
+            return buffer;
+        }
+    }
+
+    void *buffer;
+    if (posix_memalign(&buffer, DIRECT_DEFAULT_ALIGNMENT, DIRECT_BUFFER_SIZE) != 0)
+        return NULL;
+    return (char *) buffer;
+}
+
+void DirectBlockDevice::returnBuffer(char *buffer) {
+    std::lock_guard<std::mutex> guard(poolLock);
+    if (this->pool.size() < DIRECT_POOL_BUFFERS)
+        this->pool.push_back(buffer);
+    else
+        free(buffer);
+}
+
+bool DirectBlockDevice::isAligned(uint64_t pos, const void *buffer, size_t length) {
+    return (uintptr_t) buffer % this->memAlign == 0 && pos % this->offsetAlign == 0 && length % this->offsetAlign == 0;
+}
+
+/// Read an aligned range. Bytes beyond the end of the container file read as zeros.
+/// \return 0 on success, -ERRNO on failure.
+int DirectBlockDevice::readDirect(uint64_t pos, char *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t r = ::pread(this->contFile, buffer + done, length - done, (off_t) (pos + done));
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        done += r;
+        // a read that ends at an unaligned position has reached the end of the file, the next one would be refused
+        if (r == 0 || done % this->offsetAlign != 0)
+            break;
+    }
+    memset(buffer + done, 0, length - done);
+
+    return 0;
+}
+
+/// Write an aligned range.
+/// \return 0 on success, -ERRNO on failure.
+int DirectBlockDevice::writeDirect(uint64_t pos, const char *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t w = ::pwrite(this->contFile, buffer + done, length - done, (off_t) (pos + done));
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (w == 0 || (done + w) % this->offsetAlign != 0)
+            return -EIO;
+        done += w;
+    }
+
+    return 0;
+}
+
+/// Read length bytes at pos, through bounce buffers if the transfer is not aligned.
+/// \return 0 on success, -ERRNO on failure.
+int DirectBlockDevice::readAt(uint64_t pos, char *buffer, size_t length) {
+    if (isAligned(pos, buffer, length))
+        return readDirect(pos, buffer, length);
+
+    char *bounce = takeBuffer();
+    if (bounce == NULL)
+        return -ENOMEM;
+
+    int ret = 0;
+    while (length > 0 && ret == 0) {
+        uint64_t start = pos / this->offsetAlign * this->offsetAlign;
+        size_t skip = pos - start;
+        size_t chunk = std::min(length, DIRECT_BUFFER_SIZE - skip);
+        size_t span = (skip + chunk + this->offsetAlign - 1) / this->offsetAlign * this->offsetAlign;
+
+        ret = readDirect(start, bounce, span);
+        memcpy(buffer, bounce + skip, chunk);
+
+        pos += chunk;
+        buffer += chunk;
+        length -= chunk;
+    }
+
+    returnBuffer(bounce);
+    return ret;
+}
+
+/// Write length bytes at pos, through bounce buffers if the transfer is not aligned. Parts of aligned chunks that are
+/// not written keep their content.
+/// \return 0 on success, -ERRNO on failure.
+int DirectBlockDevice::writeAt(uint64_t pos, const char *buffer, size_t length) {
+    if (isAligned(pos, buffer, length))
+        return writeDirect(pos, buffer, length);
+
+    char *bounce = takeBuffer();
+    if (bounce == NULL)
+        return -ENOMEM;
+
+    int ret = 0;
+    while (length > 0 && ret == 0) {
+        uint64_t start = pos / this->offsetAlign * this->offsetAlign;
+        size_t skip = pos - start;
+        size_t chunk = std::min(length, DIRECT_BUFFER_SIZE - skip);
+        size_t span = (skip + chunk + this->offsetAlign - 1) / this->offsetAlign * this->offsetAlign;
+
+        if (skip > 0 || span > skip + chunk)
+            ret = readDirect(start, bounce, span);
+        if (ret == 0) {
+            memcpy(bounce + skip, buffer, chunk);
+            ret = writeDirect(start, bounce, span);
+        }
+
+        pos += chunk;
+        buffer += chunk;
+        length -= chunk;
+    }
+
+    returnBuffer(bounce);
+    return ret;
+}
+
+int DirectBlockDevice::read(uint32_t blockNo, char *buffer) {
+    return readBlocks(blockNo, 1, buffer);
+}
+
+int DirectBlockDevice::write(uint32_t blockNo, char *buffer) {
+    return writeBlocks(blockNo, 1, buffer);
+}
+
+int DirectBlockDevice::readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer) {
+    if (!this->direct)
+        return BlockDevice::readBlocks(blockNo, numBlocks, buffer);
+
+    return readAt((uint64_t) blockNo * this->blockSize, buffer, (size_t) numBlocks * this->blockSize);
+}
+
+int DirectBlockDevice::writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer) {
+    if (!this->direct)
+        return BlockDevice::writeBlocks(blockNo, numBlocks, buffer);
+
+    std::unique_lock<std::mutex> guard(writeLock, std::defer_lock);
+    if (this->offsetAlign > this->blockSize)
+        guard.lock();
+
+    return writeAt((uint64_t) blockNo * this->blockSize, buffer, (size_t) numBlocks * this->blockSize);
+}
+
+int DirectBlockDevice::readv(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    if (!this->direct)
+        return BlockDevice::readv(blockNo, iov, iovcnt);
+
+    uint64_t pos = (uint64_t) blockNo * this->blockSize;
+
+    // one system call if every buffer can be used directly
+    bool aligned = true;
+    for (int i = 0; i < iovcnt && aligned; i++)
+        aligned = isAligned(pos, iov[i].iov_base, iov[i].iov_len);
+    if (aligned) {
+        int ret = preadvAt((off_t) pos, iov, iovcnt);
+        // a short read in the middle of the vector leaves an unaligned offset at the end of the file
+        if (ret != -EINVAL)
+            return ret;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        int ret = readAt(pos, (char *) iov[i].iov_base, iov[i].iov_len);
+        if (ret < 0)
+            return ret;
+        pos += iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+int DirectBlockDevice::writev(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    if (!this->direct)
+        return BlockDevice::writev(blockNo, iov, iovcnt);
+
+    std::unique_lock<std::mutex> guard(writeLock, std::defer_lock);
+    if (this->offsetAlign > this->blockSize)
+        guard.lock();
+
+    uint64_t pos = (uint64_t) blockNo * this->blockSize;
+
+    bool aligned = true;
+    for (int i = 0; i < iovcnt && aligned; i++)
+        aligned = isAligned(pos, iov[i].iov_base, iov[i].iov_len);
+    if (aligned)
+        return pwritevAt((off_t) pos, iov, iovcnt);
+
+    for (int i = 0; i < iovcnt; i++) {
+        int ret = writeAt(pos, (const char *) iov[i].iov_base, iov[i].iov_len);
+        if (ret < 0)
+            return ret;
+        pos += iov[i].iov_len;
+    }
+
+    return 0;
+}
@@ -0,0 +1,291 @@
+//
+//  mmapblockdevice.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+#include "mmapblockdevice.h"
+
+MmapBlockDevice::MmapBlockDevice(uint32_t blockSize, uint32_t maxBlocks) : BlockDevice(blockSize) {
+    this->mapping = NULL;
+    this->mappingSize = 0;
+    this->maxSize = (uint64_t) maxBlocks * blockSize;
+    this->fileSize = 0;
+    this->nextBlock = 0;
+    this->sequentialBlocks = 0;
+    this->readaheadEnd = 0;
+    this->sequential = false;
+}
+
+MmapBlockDevice::~MmapBlockDevice() {
+    unmap();
+}
+
+int MmapBlockDevice::open(const char *path) {
+    int ret = BlockDevice::open(path);
+    if (ret < 0)
+        return ret;
+
+    ret = map();
+    if (ret < 0)
+        BlockDevice::close();
+
+    return ret;
+}
+
+int MmapBlockDevice::create(const char *path) {
+    int ret = BlockDevice::create(path);
+    if (ret < 0)
+        return ret;
+
+    ret = map();
+    if (ret < 0)
+        BlockDevice::close();
+
+    return ret;
+}
+
+int MmapBlockDevice::close() {
+    unmap();
+
+    return BlockDevice::close();
+}
+
+/// Map the attached container file. The mapping may reach beyond the end of the file, those pages are never touched.
+/// \return 0 on success, -ERRNO on failure.
+int MmapBlockDevice::map() {
+    struct stat st;
+    if (fstat(this->contFile, &st) < 0)
+        return -errno;
+    this->fileSize = (uint64_t) st.st_size;
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t size = std::max(std::max(this->fileSize.load(), this->maxSize), (uint64_t) MMAP_GROW_SIZE);
+    this->mappingSize = (size + pageSize - 1) / pageSize * pageSize;
+
+    void *ptr = mmap(NULL, this->mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->contFile, 0);
+    if (ptr == MAP_FAILED) {
+        this->mappingSize = 0;
+        return -errno;
+    }
+    this->mapping = (char *) ptr;
+
+    this->nextBlock = 0;
+    this->sequentialBlocks = 0;
+    this->readaheadEnd = 0;
+    this->sequential = false;
+
+    return 0;
+}
+
+void MmapBlockDevice::unmap() {
+    if (this->mapping != NULL)
+        munmap(this->mapping, this->mappingSize);
+
+    this->mapping = NULL;
+    this->mappingSize = 0;
+}
+
+/// Make sure the container file and the mapping reach at least up to byte end.
+/// \return 0 on success, -ERRNO on failure.
+int MmapBlockDevice::grow(uint64_t end) {
+    if (end <= this->fileSize)
+        return 0;
+
+    std::lock_guard<std::mutex> guard(growLock);
+    if (end <= this->fileSize)
+        return 0;
+
+    // grow in large steps, so a container that is filled block by block does not need a system call per block
+    uint64_t newSize = (end + MMAP_GROW_SIZE - 1) / MMAP_GROW_SIZE * MMAP_GROW_SIZE;
+    if (this->maxSize >= end)
+        newSize = std::min(newSize, this->maxSize);
+
+    if (newSize > this->mappingSize) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        size_t newMappingSize = (newSize + pageSize - 1) / pageSize * pageSize;
+#ifdef __linux__
+        void *ptr = mremap(this->mapping, this->mappingSize, newMappingSize, MREMAP_MAYMOVE);
+#else
+        munmap(this->mapping, this->mappingSize);
+        this->mapping = NULL;
+        void *ptr = mmap(NULL, newMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->contFile, 0);
+#endif
+        if (ptr == MAP_FAILED)
+            return -errno;
+        this->mapping = (char *) ptr;
+        this->mappingSize = newMappingSize;
+    }
+
+    if (::ftruncate(this->contFile, (off_t) newSize) < 0)
+        return -errno;
+    this->fileSize = newSize;
+
+    return 0;
+}
+
+/// Copy bytes of the container into buffer. Bytes beyond the end of the container file read as zeros.
+void MmapBlockDevice::copyOut(uint64_t pos, char *buffer, size_t length) {
+    uint64_t size = this->fileSize;
+    size_t available = pos < size ? (size_t) std::min((uint64_t) length, size - pos) : 0;
+
+    memcpy(buffer, this->mapping + pos, available);
+    memset(buffer + available, 0, length - available);
+}
+
+/// Watch reads for sequential access and pass hints to the kernel. This runs on every read, so it only issues a system
+/// call when the access pattern changes or the reader gets close to the end of the range requested ahead.
+void MmapBlockDevice::trackRead(uint32_t blockNo, uint32_t numBlocks) {
+    uint32_t end = blockNo + numBlocks;
+
+    if (blockNo != this->nextBlock.exchange(end)) {
+        this->sequentialBlocks = 0;
+        if (this->sequential.exchange(false))
+            advise(0, 0, BD_ADVICE_NORMAL);
+        return;
+    }
+
+    if (this->sequentialBlocks.fetch_add(numBlocks) + numBlocks < MMAP_SEQUENTIAL_BLOCKS)
+        return;
+
+    if (!this->sequential.exchange(true)) {
+        advise(0, 0, BD_ADVICE_SEQUENTIAL);
+        this->readaheadEnd = end;
+    }
+
+    // request the next window when the reader has used up half of the current one
+    uint32_t readahead = this->readaheadEnd;
+    if (end + MMAP_READAHEAD_BLOCKS / 2 >= readahead) {
+        uint32_t start = std::max(readahead, end);
+        this->readaheadEnd = start + MMAP_READAHEAD_BLOCKS;
+        advise(start, MMAP_READAHEAD_BLOCKS, BD_ADVICE_WILLNEED);
+    }
+}
+
+int MmapBlockDevice::read(uint32_t blockNo, char *buffer) {
+    return readBlocks(blockNo, 1, buffer);
+}
+
+int MmapBlockDevice::write(uint32_t blockNo, char *buffer) {
+    return writeBlocks(blockNo, 1, buffer);
+}
+
+int MmapBlockDevice::readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer) {
+    trackRead(blockNo, numBlocks);
+    copyOut((uint64_t) blockNo * this->blockSize, buffer, (size_t) numBlocks * this->blockSize);
+
+    return 0;
+}
+
+int MmapBlockDevice::writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer) {
+    uint64_t pos = (uint64_t) blockNo * this->blockSize;
+    size_t length = (size_t) numBlocks * this->blockSize;
+
+    int ret = grow(pos + length);
+    if (ret < 0)
+        return ret;
+
+    memcpy(this->mapping + pos, buffer, length);
+
+    return 0;
+}
+
+int MmapBlockDevice::readv(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    uint64_t pos = (uint64_t) blockNo * this->blockSize;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    trackRead(blockNo, (uint32_t) (total / this->blockSize));
+
+    for (int i = 0; i < iovcnt; i++) {
+        copyOut(pos, (char *) iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+int MmapBlockDevice::writev(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    uint64_t pos = (uint64_t) blockNo * this->blockSize;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    int ret = grow(pos + total);
+    if (ret < 0)
+        return ret;
+
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(this->mapping + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+// writes only reach the page cache, msync pushes them to the container file
+int MmapBlockDevice::sync() {
+    if (this->mapping == NULL)
+        return 0;
+
+    if (msync(this->mapping, this->fileSize, MS_SYNC) < 0)
+        return -errno;
+
+    return 0;
+}
+
+int MmapBlockDevice::advise(uint32_t blockNo, uint32_t numBlocks, BlockAdvice advice) {
+    if (this->mapping == NULL)
+        return 0;
+
+    int madvice;
+    switch (advice) {
+        case BD_ADVICE_SEQUENTIAL:
+            madvice = MADV_SEQUENTIAL;
+            break;
+        case BD_ADVICE_RANDOM:
+            madvice = MADV_RANDOM;
+            break;
+        case BD_ADVICE_WILLNEED:
+            madvice = MADV_WILLNEED;
+            break;
+        case BD_ADVICE_DONTNEED:
+            madvice = MADV_DONTNEED;
+            break;
+        default:
+            madvice = MADV_NORMAL;
+    }
+
+    // madvise wants page aligned addresses and must not reach beyond the end of the file
+    uint64_t size = this->fileSize;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = (uint64_t) blockNo * this->blockSize / pageSize * pageSize;
+    uint64_t end = numBlocks == 0 ? size : std::min(size, (uint64_t) (blockNo + numBlocks) * this->blockSize);
+    if (start >= end)
+        return 0;
+
+    if (madvise(this->mapping + start, end - start, madvice) < 0)
+        return -errno;
+
+    return 0;
+}
+
+const char *MmapBlockDevice::blockPtr(uint32_t blockNo, uint32_t numBlocks) {
+    uint64_t end = (uint64_t) (blockNo + numBlocks) * this->blockSize;
+    if (this->mapping == NULL || end > this->fileSize)
+        return NULL;
+
+    trackRead(blockNo, numBlocks);
+
+    return this->mapping + (uint64_t) blockNo * this->blockSize;
+}
@@ -23,6 +23,22 @@ struct fuse_operations myfs_oper;
 struct myfs_config {
     char *containerFileName;
     char *logFileName;
+    unsigned int blockSize;
+    unsigned int dataBlocks;
+    unsigned int dirEntries;
+    char *backend;
+    unsigned int queueDepth;
+    int noCache;
+    unsigned int cacheSize;
+    char *cachePolicy;
+    int writeBack;
+    unsigned int dirtyRatio;
+    unsigned int dirtyExpire;
+    int delayedAlloc;
+    unsigned int commitInterval;
+    int shadowPaging;
+    int atimeMode;
+    int lazyTime;
 };
 enum {
     KEY_HELP,
@@ -36,6 +52,24 @@ static struct fuse_opt myfs_opts[] = {
         MYFS_OPT("containerfile=%s",  containerFileName, 0),
         MYFS_OPT("-l %s",             logFileName, 0),
         MYFS_OPT("logfile=%s",        logFileName, 0),
+        MYFS_OPT("blocksize=%u",      blockSize, 0),
+        MYFS_OPT("datablocks=%u",     dataBlocks, 0),
+        MYFS_OPT("direntries=%u",     dirEntries, 0),
+        MYFS_OPT("backend=%s",        backend, 0),
+        MYFS_OPT("queuedepth=%u",     queueDepth, 0),
+        MYFS_OPT("nocache",           noCache, 1),
+        MYFS_OPT("cachesize=%u",      cacheSize, 0),
+        MYFS_OPT("cachepolicy=%s",    cachePolicy, 0),
+        MYFS_OPT("writeback",         writeBack, 1),
+        MYFS_OPT("dirtyratio=%u",     dirtyRatio, 0),
+        MYFS_OPT("dirtyexpire=%u",    dirtyExpire, 0),
+        MYFS_OPT("delalloc",          delayedAlloc, 1),
+        MYFS_OPT("commitinterval=%u", commitInterval, 0),
+        MYFS_OPT("shadow",            shadowPaging, 1),
+        MYFS_OPT("strictatime",       atimeMode, ATIME_STRICT),
+        MYFS_OPT("relatime",          atimeMode, ATIME_RELATIME),
+        MYFS_OPT("noatime",           atimeMode, ATIME_NOATIME),
+        MYFS_OPT("lazytime",          lazyTime, 1),
 
         FUSE_OPT_KEY("-V",             KEY_VERSION),
         FUSE_OPT_KEY("--version",      KEY_VERSION),
@@ -56,7 +90,27 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
                     "    -o containerfile=FILE\n"
                     "    -c FILE            same as '-o containerfile=FILE'\n"
                     "    -o logfile=FILE\n"
-                    "    -l FILE            same as '-o logfile=FILE'\n");
+                    "    -l FILE            same as '-o logfile=FILE'\n"
+                    "    -o blocksize=N     block size of a new container: 512 (default) up to 65536 bytes\n"
+                    "    -o datablocks=N    number of data blocks of a new container (default 65536)\n"
+                    "    -o direntries=N    number of files a new container can hold (default 64)\n"
+                    "    -o backend=NAME    block device backend: pread (default), uring, mmap or direct\n"
+                    "    -o queuedepth=N    submission queue entries of the uring backend\n"
+                    "    -o nocache         do not cache blocks of the container\n"
+                    "    -o cachesize=N     number of cached blocks (default 8192)\n"
+                    "    -o cachepolicy=NAME replacement policy of the cache: clock (default) or arc\n"
+                    "    -o writeback       write blocks back from the cache in the background\n"
+                    "    -o dirtyratio=N    percentage of dirty cached blocks that starts writing back (default 20)\n"
+                    "    -o dirtyexpire=N   milliseconds after that a dirty block is written back (default 5000)\n"
+                    "    -o delalloc        allocate blocks of appended data when the file is flushed\n"
+                    "    -o commitinterval=N milliseconds after that changed metadata is committed (default 5000)\n"
+                    "    -o shadow          a new container writes changed metadata to shadow slots and commits by\n"
+                    "                       switching superblocks, instead of using a journal\n"
+                    "    -o strictatime     every access of a file updates its access time (default)\n"
+                    "    -o relatime        update the access time only after a change of the file or once a day\n"
+                    "    -o noatime         never update the access time\n"
+                    "    -o lazytime        keep changed timestamps in memory until other metadata of the file is\n"
+                    "                       written, the file is synced or twelve hours have passed\n");
             exit(1);
 
         case KEY_VERSION:
@@ -103,6 +157,13 @@ int main(int argc, char *argv[]) {
     myfs_oper.init = wrap_init;
     myfs_oper.ftruncate = wrap_ftruncate;
     myfs_oper.destroy = wrap_destroy;
+#if FUSE_VERSION >= 29
+    myfs_oper.fallocate = wrap_fallocate;
+#endif
+    // SEEK_DATA and SEEK_HOLE reach the file system since libfuse 3.8, before the kernel answers them on its own
+#if FUSE_MAJOR_VERSION > 3 || (FUSE_MAJOR_VERSION == 3 && FUSE_MINOR_VERSION >= 8)
+    myfs_oper.lseek = wrap_lseek;
+#endif
 
     char* containerFileName= NULL;
     char* logFileName= NULL;
@@ -175,6 +236,22 @@ int main(int argc, char *argv[]) {
     // container & log file name will be passed to fuse functions
     FsInfo->contFile= containerFileName;
     FsInfo->logFile= logFileName;
+    FsInfo->blockSize= conf.blockSize;
+    FsInfo->dataBlocks= conf.dataBlocks;
+    FsInfo->dirEntries= conf.dirEntries;
+    FsInfo->backend= conf.backend;
+    FsInfo->queueDepth= conf.queueDepth;
+    FsInfo->noCache= conf.noCache;
+    FsInfo->cacheSize= conf.cacheSize;
+    FsInfo->cachePolicy= conf.cachePolicy;
+    FsInfo->writeBack= conf.writeBack;
+    FsInfo->dirtyRatio= conf.dirtyRatio;
+    FsInfo->dirtyExpire= conf.dirtyExpire;
+    FsInfo->delayedAlloc= conf.delayedAlloc;
+    FsInfo->commitInterval= conf.commitInterval;
+    FsInfo->shadowPaging= conf.shadowPaging;
+    FsInfo->atimeMode= conf.atimeMode;
+    FsInfo->lazyTime= conf.lazyTime;
 
     // add additoinal "-s"
     fuse_opt_add_arg(&args, "-s");
@@ -188,6 +265,8 @@ int main(int argc, char *argv[]) {
     free(FsInfo);
     free(containerFileName);
     free(logFileName);
+    free(conf.backend);
+    free(conf.cachePolicy);
 
     return fuse_stat;
 }
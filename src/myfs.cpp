@@ -194,6 +194,16 @@ int MyFS::fuseCreate(const char *path, mode_t mode, struct fuse_file_info *fileI
     RETURN(0);
 }
 
+int MyFS::fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo) {
+    LOGM();
+    RETURN(-EOPNOTSUPP);
+}
+
+off_t MyFS::fuseLseek(const char *path, off_t offset, int whence, struct fuse_file_info *fileInfo) {
+    LOGM();
+    RETURN(-EOPNOTSUPP);
+}
+
 void MyFS::fuseDestroy() {
     LOGM();
 }
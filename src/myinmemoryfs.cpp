@@ -74,14 +74,8 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     }
 
     //file with same name exists?
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsFileInfo info = myFsFiles[i];
-        if (strcmp(path, info.cPath) == 0) {
-            RETURN(-EEXIST); // already exists
-        }
+    if (myPathIndex.count(path) > 0) {
+        RETURN(-EEXIST); // already exists
     }
 
     //find index to put fileinfo in
@@ -106,6 +100,7 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     myFsFiles[index].uid = getuid();
     myFsFiles[index].mode = mode;
     myFsEmpty[index] = false;
+    myPathIndex[myFsFiles[index].cPath] = index;
 
     //increment file counter
     iCounterFiles++;
@@ -125,20 +120,8 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
 int MyInMemoryFS::fuseUnlink(const char *path) {
     LOGM();
 
-    int index = -1;
     // Get index of file by  path
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++)
-    {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsFileInfo info = myFsFiles[i];
-        if (strcmp(path, info.cPath) == 0)
-        {
-            index = i;
-            break;
-        }
-    }
+    int index = iFindFileIndex(path);
 
     if (index < 0)
     {
@@ -149,6 +132,7 @@ int MyInMemoryFS::fuseUnlink(const char *path) {
 
     free(myFsFiles[index].data);
     myFsFiles[index].size = 0;
+    myPathIndex.erase(myFsFiles[index].cPath);
 
     memset(&myFsFiles[index], 0, sizeof(MyFsFileInfo));
 
@@ -180,21 +164,8 @@ int MyInMemoryFS::fuseRename(const char *path, const char *newpath) {
         RETURN(-EINVAL);
     }
 
-    size_t index = -1;
-    bool bNewNameAlreadyInUse = false;
-
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsFileInfo info = myFsFiles[i];
-        if (strcmp(path, info.cPath) == 0) {
-            index = i;
-        }
-        if (strcmp(path, newpath) == 0) {
-            bNewNameAlreadyInUse = true;
-        }
-    }
+    int index = iFindFileIndex(path);
+    bool bNewNameAlreadyInUse = myPathIndex.count(newpath) > 0;
 
     if (bNewNameAlreadyInUse) {
         RETURN(-EEXIST);
@@ -210,8 +181,10 @@ int MyInMemoryFS::fuseRename(const char *path, const char *newpath) {
 
 
     //overwrite fileinfo values
+    myPathIndex.erase(myFsFiles[index].cPath);
     strcpy(myFsFiles[index].cName, (newpath+1));
     strcpy(myFsFiles[index].cPath, newpath);
+    myPathIndex[myFsFiles[index].cPath] = index;
     myFsFiles[index].atime.tv_sec = myFsFiles[index].ctime.tv_sec = myFsFiles[index].mtime.tv_sec = time(NULL);
 
 
@@ -262,23 +235,17 @@ int MyInMemoryFS::fuseGetattr(const char *path, struct stat *statbuf) {
     else if ( strlen(path) > 0 )
     {
         LOG("path-length > 0");
-        for (size_t i = 0; i < NUM_DIR_ENTRIES; i++)
+        int i = iFindFileIndex(path);
+        if (i >= 0)
         {
-            if (myFsEmpty[i]){
-                continue;
-            }
-            LOGF("Comparing string1: %s, and string2: %s", path, myFsFiles[i].cPath);
-            if (strcmp(path, myFsFiles[i].cPath) == 0)
-            {
-                statbuf->st_mode = myFsFiles[i].mode;
-                statbuf->st_nlink = 1;
-                statbuf->st_size = myFsFiles[i].size;
-                statbuf->st_mtime = myFsFiles[i].mtime.tv_sec; // The last "m"odification of the file/directory is right now
-                LOG("fuseGetAttr()");
-                LOG("filled statbuf with data");
-                LOGF("index: %d, filepath: %s, filesize: %ld, timestamp: %ld", i, myFsFiles[i].cPath, myFsFiles[i].size, myFsFiles[i].atime.tv_sec);
-                RETURN(0);
-            }
+            statbuf->st_mode = myFsFiles[i].mode;
+            statbuf->st_nlink = 1;
+            statbuf->st_size = myFsFiles[i].size;
+            statbuf->st_mtime = myFsFiles[i].mtime.tv_sec; // The last "m"odification of the file/directory is right now
+            LOG("fuseGetAttr()");
+            LOG("filled statbuf with data");
+            LOGF("index: %d, filepath: %s, filesize: %ld, timestamp: %ld", i, myFsFiles[i].cPath, myFsFiles[i].size, myFsFiles[i].atime.tv_sec);
+            RETURN(0);
         }
         LOG("havent found file in myFsFiles-array");
 
@@ -302,21 +269,8 @@ int MyInMemoryFS::fuseGetattr(const char *path, struct stat *statbuf) {
 int MyInMemoryFS::fuseChmod(const char *path, mode_t mode) {
     LOGM();
 
-    size_t index = -1;
-
     // Get index of file by  path
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++)
-    {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsFileInfo info = myFsFiles[i];
-        if (strcmp(path, info.cPath) == 0)
-        {
-            index = i;
-            break;
-        }
-    }
+    int index = iFindFileIndex(path);
 
     // file found?
     if (index < 0)
@@ -343,20 +297,7 @@ int MyInMemoryFS::fuseChmod(const char *path, mode_t mode) {
 int MyInMemoryFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
     LOGM();
 
-    size_t index = -1;
-
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++)
-    {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsFileInfo info = myFsFiles[i];
-        if (strcmp(path, info.cPath) == 0)
-        {
-            index = i;
-            break;
-        }
-    }
+    int index = iFindFileIndex(path);
 
     // file found?
     if (index < 0)
@@ -389,29 +330,22 @@ int MyInMemoryFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
         RETURN(-EMFILE);
     }
 
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++)
+    int i = iFindFileIndex(path);
+    if (i >= 0)
     {
-        if (myFsEmpty[i]) {
-            continue;
+        if (myFsOpenFiles[i])
+        {
+            RETURN(-EPERM); // Already Open
         }
-
-        if (strcmp(path, myFsFiles[i].cPath) == 0)
+        else
         {
-            if (myFsOpenFiles[i])
-            {
-                RETURN(-EPERM); // Already Open
-            }
-            else
-            {
-                // Set Handle etc
-                myFsOpenFiles[i] = true;
-                fileInfo->fh = i; // can be used in fuseRead and fuseRelease
-                iCounterOpen++;
-                myFsFiles[i].atime.tv_sec = time( NULL );
-                LOGF("index: %d, filepath: %s, filesize: %ld, timestamp: %ld", i, myFsFiles[i].cPath, myFsFiles[i].size, myFsFiles[i].atime.tv_sec);
-                LOGF("index: %d, iCounterOpen: %d", i, iCounterOpen);
-                break;
-            }
+            // Set Handle etc
+            myFsOpenFiles[i] = true;
+            fileInfo->fh = i; // can be used in fuseRead and fuseRelease
+            iCounterOpen++;
+            myFsFiles[i].atime.tv_sec = time( NULL );
+            LOGF("index: %d, filepath: %s, filesize: %ld, timestamp: %ld", i, myFsFiles[i].cPath, myFsFiles[i].size, myFsFiles[i].atime.tv_sec);
+            LOGF("index: %d, iCounterOpen: %d", i, iCounterOpen);
         }
     }
 
@@ -650,10 +584,19 @@ int MyInMemoryFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t fille
 /// \param [in] conn Can be ignored.
 /// \return 0.
 void* MyInMemoryFS::fuseInit(struct fuse_conn_info *conn) {
+    return mountMemory((MyFsInfo *) fuse_get_context()->private_data);
+}
+
+/// Open the log file and start with an empty file system.
+///
+/// fuseInit() calls this with the options of the mount command. Tests call it directly, they have no FUSE context.
+/// \param [in] fsInfo Options of the file system.
+/// \return 0.
+void* MyInMemoryFS::mountMemory(MyFsInfo *fsInfo) {
     // Open logfile
-    this->logFile= fopen(((MyFsInfo *) fuse_get_context()->private_data)->logFile, "w+");
+    this->logFile= fopen(fsInfo->logFile, "w+");
     if(this->logFile == NULL) {
-        fprintf(stderr, "ERROR: Cannot open logfile %s\n", ((MyFsInfo *) fuse_get_context()->private_data)->logFile);
+        fprintf(stderr, "ERROR: Cannot open logfile %s\n", fsInfo->logFile);
     } else {
         // turn of logfile buffering
         setvbuf(this->logFile, NULL, _IOLBF, 0);
@@ -667,6 +610,7 @@ void* MyInMemoryFS::fuseInit(struct fuse_conn_info *conn) {
         memset(&myFsFiles, 0, sizeof(myFsFiles));
         memset(&myFsEmpty, 1, sizeof(myFsEmpty));
         memset(&myFsOpenFiles, 0, sizeof(myFsOpenFiles));
+        myPathIndex.clear();
     }
 
     RETURN(0);
@@ -715,16 +659,10 @@ int MyInMemoryFS::iFindEmptySpot()
 int MyInMemoryFS::iFindFileIndex(const char *path)
 {
     LOGM();
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++)
+    std::unordered_map<std::string, int>::iterator it = myPathIndex.find(path);
+    if (it != myPathIndex.end())
     {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsFileInfo info = myFsFiles[i];
-        if (strcmp(path, info.cPath) == 0)
-        {
-            RETURN(i);
-        }
+        RETURN(it->second);
     }
     RETURN(-EEXIST);
 }
@@ -16,67 +16,59 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <algorithm>
 
 #include "macros.h"
 #include "myfs.h"
 #include "myfs-info.h"
 #include "blockdevice.h"
+#include "uringblockdevice.h"
+#include "mmapblockdevice.h"
+#include "directblockdevice.h"
+#include "blockcache.h"
+
+// FUSE passes the flags of fallocate() and lseek() on unchanged, these are the values of Linux
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4
+#endif
 
 /// @brief Constructor of the on-disk file system class.
 ///
 /// You may add your own constructor code here.
 MyOnDiskFS::MyOnDiskFS() : MyFS() {
-    // create a block device object
-    this->blockDevice = new BlockDevice(BLOCK_SIZE);
-
-    this->blocks4DATA = NUM_DATA_BLOCKS; // 65.536
-    this->blocks4SPBlock = 1; // 1 Block = 512
-    this->blocks4DMAP = this->blocks4DATA / BLOCK_SIZE; // 128 Blöcke = 65.536
-    this->blocks4FAT = (this->blocks4DATA / BLOCK_SIZE) * 4; // 512 Blöcke = 262.144
-    this->blocks4ROOT = NUM_DIR_ENTRIES; // 64 Blöcke = 32.768
-
-    this->posSPBlock = 0;
-    this->posDMAP = this->blocks4SPBlock; // 1 Block = 512
-    this->posFAT = this->posDMAP + this->blocks4DMAP; // 129 Blöcke = 66.048
-    this->posROOT = this->posFAT + this->blocks4FAT; // 641 Blöcke = 328.192
-    this->posDATA = this->posROOT + this->blocks4ROOT; // 705 Blöcke = 360.960
-
-    this->posENDofDATA = this->posDATA + this->blocks4DATA; // 66.241 Blöcke = 33.915.392
-
-    //initialise superblock
-    mySuperBlock.infoSize = this->posDATA;
-    mySuperBlock.dataSize = this->blocks4DATA * BLOCK_SIZE;
-    mySuperBlock.blockPos = this->posSPBlock;
-    mySuperBlock.dataPos = this->posDATA;
-    mySuperBlock.dmapPos = this->posDMAP;
-    mySuperBlock.rootPos = this->posROOT;
-    mySuperBlock.fatPos = this->posFAT;
-    mySuperBlock.numFreeBlocks = this->blocks4DATA;
-
-    //initialise heap structures
-    memset(&myDmap, 1, sizeof(myDmap));
-    for (int i = 0; i < this->blocks4DATA; i++) {
-        myFAT[i] = -1;
-    }
-    memset(&myRoot, 0, sizeof(myRoot));
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        myRoot[i].data = POS_NULLPTR;
-        myRoot[i].cPath[0] = '\0';
-    }
-    iCounterFiles = iCounterOpen = 0;
-    memset(&myFsEmpty, 1, sizeof(myFsEmpty));
-    memset(&myFsOpenFiles, 0, sizeof(myFsOpenFiles));
-
-    initializeHelpers();
+    this->blockDevice = NULL;
+    this->blockCache = NULL;
+    this->headBuffer = NULL;
+    this->tailBuffer = NULL;
+    this->delayedAlloc = false;
+    this->commitInterval = JOURNAL_COMMIT_INTERVAL;
+    this->atimeMode = ATIME_STRICT;
+    this->lazyTime = false;
+    this->stopCommitter = false;
+
+    // create a block device object and an empty file system, the geometry of the container is known in fuseInit()
+    setGeometry(FORMAT_VERSION, BLOCK_SIZE, NUM_DATA_BLOCKS, NUM_DIR_ENTRIES, false);
 }
 
 /// @brief Destructor of the on-disk file system class.
 ///
 /// You may add your own destructor code here.
 MyOnDiskFS::~MyOnDiskFS() {
+    stopCommitThread();
     // free block device object
     delete this->blockDevice;
+    free(this->headBuffer);
+    free(this->tailBuffer);
 }
 
 /// @brief Create a new file.
@@ -88,11 +80,11 @@ MyOnDiskFS::~MyOnDiskFS() {
 /// \param [in] dev Can be ignored.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     //filesystem full?
-    if (iCounterFiles >= NUM_DIR_ENTRIES) {
+    if (iCounterFiles >= this->numDirEntries) {
         RETURN(-ENOSPC);
     }
 
@@ -102,14 +94,8 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     }
 
     //file with same name exists?
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-
-        if (strcmp(path, myRoot[i].cPath) == 0) {
-            RETURN(-EEXIST); // already exists
-        }
+    if (iFindFileIndex(path) >= 0) {
+        RETURN(-EEXIST); // already exists
     }
 
     //find index to put fileinfo in
@@ -123,7 +109,14 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
         RETURN(-EINVAL);
     }
 
+    // the entry and its path, or all entries if the name heap has to be compacted for it
+    int ret = reserveJournal(journalRecords(0) + nameRecords(index, path));
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
     //overwrite all fileinfo values
+    storeName(index, path);
     strcpy(myRoot[index].cPath, path);
     myRoot[index].size = 0;
     myRoot[index].data = POS_NULLPTR;
@@ -132,11 +125,14 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     myRoot[index].uid = getuid();
     myRoot[index].mode = mode;
     myFsEmpty[index] = false;
+    myPathIndex[myRoot[index].cPath] = index;
+    markRootDirty(index);
 
     //increment file counter
     iCounterFiles++;
 
     writeRoot();
+    commitMetadata(false);
     RETURN(0);
 }
 
@@ -147,17 +143,11 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
 /// \param [in] path Name of the file, starting with "/".
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseUnlink(const char *path) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     // Get index of file by path
-    size_t index = -1;
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (strcmp(path, myRoot[i].cPath) == 0) {
-            //found file
-            index = i;
-        }
-    }
+    int index = iFindFileIndex(path);
 
     // Check if the file has been found
     if (index < 0) {
@@ -169,16 +159,29 @@ int MyOnDiskFS::fuseUnlink(const char *path) {
         RETURN(-EBUSY);
     }
 
-    // Check if there are blocks to be freed
-    if (myRoot[index].data != POS_NULLPTR) {
-        // Free allocated blocks
-        int retEr = freeBlocks(myRoot[index].data);
-        if (retEr < 0) {
-            RETURN(retEr);
+    // a file with more blocks than one transaction holds is truncated from its end in steps first
+    size_t step = journalStep();
+    int32_t start;
+    while ((start = stepStart(index, 0, allocatedEnd(index), step)) > 0) {
+        int ret = releaseStep(index, start, step);
+        if (ret < 0) {
+            RETURN(ret);
         }
     }
+    int retEr = reserveJournal(journalRecords(allocatedBlocks(index)));
+    if (retEr < 0) {
+        RETURN(retEr);
+    }
+
+    // Free allocated blocks
+    retEr = releaseBlocks(index, 0, INT32_MAX);
+    if (retEr < 0) {
+        RETURN(retEr);
+    }
+    invalidateExtents(index);
 
     //reset myRoot
+    myPathIndex.erase(myRoot[index].cPath);
     memset(&myRoot[index], 0, sizeof(MyFsDiskInfo));
     myRoot[index].data = POS_NULLPTR;
     myRoot[index].cPath[0] = '\0';
@@ -186,8 +189,10 @@ int MyOnDiskFS::fuseUnlink(const char *path) {
     //adjust helpers
     myFsEmpty[index] = true;
     iCounterFiles--;
+    markRootDirty(index);
 
     writeRoot();
+    commitMetadata(false);
     RETURN(0);
 }
 
@@ -201,42 +206,42 @@ int MyOnDiskFS::fuseUnlink(const char *path) {
 /// \param [in] newpath  New name of the file, starting with "/".
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseRename(const char *path, const char *newpath) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     // Check length of new filename
     if (strlen(newpath) - 1 > NAME_LENGTH) {
         RETURN(-EINVAL);
     }
 
-    // Get index of file by path
-    size_t index = -1;
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-
-        // Search for the index of the file
-        if (strcmp(path, myRoot[i].cPath) == 0) {
-            index = i;
-        }
-
-        // File with the new name already exists
-        if (strcmp(myRoot[i].cPath, newpath) == 0) {
-            RETURN(-EEXIST);
-        }
+    // File with the new name already exists
+    if (iFindFileIndex(newpath) >= 0) {
+        RETURN(-EEXIST);
     }
 
+    // Get index of file by path
+    int index = iFindFileIndex(path);
+
     // file found?
     if (index < 0) {
         RETURN(-ENOENT);
     }
 
+    int ret = reserveJournal(journalRecords(0) + nameRecords(index, newpath));
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
     // Overwrite fileinfo values
+    storeName(index, newpath);
+    myPathIndex.erase(myRoot[index].cPath);
     strcpy(myRoot[index].cPath, newpath);
+    myPathIndex[myRoot[index].cPath] = index;
     myRoot[index].atime = myRoot[index].ctime = time(NULL);
+    markRootDirty(index);
 
     writeRoot();
+    commitMetadata(false);
     RETURN(0);
 }
 
@@ -247,8 +252,8 @@ int MyOnDiskFS::fuseRename(const char *path, const char *newpath) {
 /// \param [out] statbuf Structure containing the meta data, for details type "man 2 stat" in a terminal.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     // GNU's definitions of the attributes (http://www.gnu.org/software/libc/manual/html_node/Attribute-Meanings.html):
     // 		st_uid: 	The user ID of the file’s owner.
@@ -279,20 +284,20 @@ int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
     // Check if a filepath is given
     } else if (strlen(path) > 0) {
 
-        // Find the file
-        for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-            if (myFsEmpty[i]) {
-                continue;
-            }
-
-            // Read metadata if the file was found
-            if (strcmp(path, myRoot[i].cPath) == 0) {
-                statbuf->st_mode = myRoot[i].mode;
-                statbuf->st_nlink = 1;
-                statbuf->st_size = myRoot[i].size;
-                statbuf->st_mtime = myRoot[i].mtime; // The last "m"odification of the file/directory is right now
-                RETURN(0);
-            }
+        // Read metadata if the file was found
+        int i = iFindFileIndex(path);
+        if (i >= 0) {
+            statbuf->st_mode = myRoot[i].mode;
+            statbuf->st_nlink = 1;
+            statbuf->st_size = myRoot[i].size;
+            // holes take no space, delayed data has its blocks reserved
+            int32_t numBlocks = allocatedBlocks(i) +
+                    (myDelayed[i].data.size() + this->blockSize - 1) / this->blockSize;
+            statbuf->st_blocks = (blkcnt_t) numBlocks * (this->blockSize / 512);
+            statbuf->st_mtime = myRoot[i].mtime; // The last "m"odification of the file/directory is right now
+            statbuf->st_atime = myRoot[i].atime;
+            statbuf->st_ctime = myRoot[i].ctime;
+            RETURN(0);
         }
 
         // No such file or directory
@@ -314,21 +319,11 @@ int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
 /// \param [in] mode New mode of the file.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     // Get index of file by path
-    size_t index = -1;
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsDiskInfo info = myRoot[i];
-        if (strcmp(path, info.cPath) == 0) {
-            index = i;
-            break;
-        }
-    }
+    int index = iFindFileIndex(path);
 
     // Check if the file has been found
     if (index < 0) {
@@ -336,11 +331,18 @@ int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
         RETURN(-ENOENT);
     }
 
+    int ret = reserveJournal(journalRecords(0));
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
     // Overwrite fileinfo values
     myRoot[index].mode = mode;
     myRoot[index].atime = myRoot[index].ctime = time(NULL);
+    markRootDirty(index);
 
     writeRoot();
+    commitMetadata(false);
     RETURN(0);
 }
 
@@ -353,21 +355,11 @@ int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
 /// \param [in] gid New group id.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     // Get index of file by path
-    size_t index = -1;
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-        MyFsDiskInfo info = myRoot[i];
-        if (strcmp(path, info.cPath) == 0) {
-            index = i;
-            break;
-        }
-    }
+    int index = iFindFileIndex(path);
 
     // Check if the file has been found
     if (index < 0) {
@@ -375,12 +367,19 @@ int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
         RETURN(-ENOENT);
     }
 
+    int ret = reserveJournal(journalRecords(0));
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
     // Overwrite fileinfo values
     myRoot[index].uid = uid;
     myRoot[index].gid = gid;
     myRoot[index].atime = myRoot[index].ctime = time(NULL);
+    markRootDirty(index);
 
     writeRoot();
+    commitMetadata(false);
     RETURN(0);
 }
 
@@ -393,8 +392,8 @@ int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
 /// \param [out] fileInfo Can be ignored in Part 1
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     // Check if too many files are open
     if (iCounterOpen >= NUM_OPEN_FILES) {
@@ -403,27 +402,29 @@ int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
     }
 
     // Find the file and open it
-    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            continue;
-        }
-
-        if (strcmp(path, myRoot[i].cPath) == 0) {
-            // Check if the file is already open
-            if (myFsOpenFiles[i]) {
-                RETURN(-EPERM); // Already Open
-            } else {
-                // Set Handle etc
-                myFsOpenFiles[i] = true;
-                fileInfo->fh = i; // can be used in fuseRead and fuseRelease
-                iCounterOpen++;
-                myRoot[i].atime = myRoot[i].ctime = time(NULL);
-                break;
+    int i = iFindFileIndex(path);
+    if (i >= 0) {
+        // Check if the file is already open
+        if (myFsOpenFiles[i]) {
+            RETURN(-EPERM); // Already Open
+        } else {
+            int ret = reserveJournal(journalRecords(0));
+            if (ret < 0) {
+                RETURN(ret);
             }
+
+            // Set Handle etc
+            myFsOpenFiles[i] = true;
+            fileInfo->fh = i; // can be used in fuseRead and fuseRelease
+            invalidateCursor(i);
+            resetReadahead(i);
+            iCounterOpen++;
+            touchAtime(i);
         }
     }
 
     writeRoot();
+    commitMetadata(false);
     RETURN(0);
 }
 
@@ -445,9 +446,8 @@ int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
 /// \return The Number of bytes read on success. This may be less than size if the file does not contain sufficient bytes.
 /// -ERRNO on failure.
 int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readFat();
-    readRoot();
 
     if (size < 0 || offset < 0) {
         RETURN(-EINVAL);
@@ -463,6 +463,12 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
         RETURN(-EPERM);
     }
 
+    // the access time
+    int ret = reserveJournal(journalRecords(0));
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
     MyFsDiskInfo *info = &myRoot[fileInfo->fh];
 
     // Check if the offset is within the file bounds
@@ -471,8 +477,8 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
         size = 0; // The Number of bytes read
     }
 
-    // Check if the file has blocks to read
-    if (info->data == POS_NULLPTR || info->size == 0) {
+    // Check if the file has bytes to read, a file without blocks may still be one hole
+    if (info->size == 0) {
         LOG("File is empty");
         size = 0; // The Number of bytes read
     }
@@ -488,76 +494,57 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
             size = info->size - offset;
         }
 
-        int32_t byteOffset = offset % BLOCK_SIZE;
-
-        int32_t startBlockOffset = offset / BLOCK_SIZE;
-        int32_t numBlocks2Read = std::ceil(((double) (size + byteOffset) / BLOCK_SIZE));
-
-        int32_t curFATBlock = info->data;
-        int32_t start2ReadFAT;
-
-        // Check if there is a block offset
-        if (startBlockOffset == 0) {
-            start2ReadFAT = curFATBlock;
-        }
-
-        for (size_t i = 0; i < startBlockOffset; i++) {
-            //Travel through blocks of the file to reach the offset
-            int32_t nextFATBlock = myFAT[curFATBlock];
-            if (nextFATBlock == -1) {
-                //LOG("myFAT ended prematurely. THIS SHOULD NOT OCCUR!");
-                RETURN(-2000);
-            }
-            curFATBlock = nextFATBlock;
-            start2ReadFAT = curFATBlock;
+        // Data behind the allocated blocks is still in memory, behind it there can only be a hole
+        size_t diskSize = size;
+        const DelayedWrite &delayed = myDelayed[fileInfo->fh];
+        off_t delayedStart = (off_t) delayed.firstBlock * this->blockSize;
+        if (!delayed.data.empty() && (off_t) (offset + size) > delayedStart) {
+            diskSize = offset < delayedStart ? delayedStart - offset : 0;
+            size_t start = offset + diskSize - delayedStart;
+            size_t copied = start < delayed.data.size() ? std::min(size - diskSize, delayed.data.size() - start) : 0;
+            memcpy(buf + diskSize, delayed.data.data() + start, copied);
+            memset(buf + diskSize + copied, 0, size - diskSize - copied);
         }
 
-        char buffer[BLOCK_SIZE];
-        char* bufIter = buf;
-
-        // Read from the container
-        for (size_t i = 0; i < numBlocks2Read; i++) {
-
-            // Read block
-            int ret = this->blockDevice->read(this->posDATA + start2ReadFAT, buffer);
-            if (ret < 0) {
-                //LOG("Couldn't read from Container");
-                RETURN (-4000);
-            }
-
-            void *retPtr = nullptr;
+        // the file ends inside the addressable blocks, see isAddressable()
+        int32_t byteOffset = offset % this->blockSize;
+        int64_t logicalBlock = offset / this->blockSize;
+        int64_t numBlocks2Read = diskSize > 0 ? (diskSize + byteOffset + this->blockSize - 1) / this->blockSize : 0;
 
-            if (byteOffset > 0) {
-                //read first block (read less than 512 bytes)
-                retPtr = memcpy(bufIter, buffer + byteOffset,
-                                std::min(size, (size_t) BLOCK_SIZE - byteOffset));
-                bufIter += std::min(size, (size_t) BLOCK_SIZE - byteOffset);
-                byteOffset = 0;
-
-            } else if (bufIter + BLOCK_SIZE > buf + size) {
-                //read last block (read less than 512 bytes)
-                memcpy(bufIter, buffer, std::max(0UL, (u_long) (buf + size - bufIter)));
-                break;
+        char *bufIter = buf;
+        size_t remaining = diskSize;
 
-            } else if (bufIter + BLOCK_SIZE <= buf + size) {
-                //read full blocks
-                retPtr = memcpy(bufIter, buffer, BLOCK_SIZE);
-                bufIter += BLOCK_SIZE;
-            }
+        // Read from the container, one call per run of consecutive blocks, holes read as zeros
+        while (numBlocks2Read > 0) {
+            int32_t runLength;
+            int32_t runBlock = mapRun(fileInfo->fh, (int32_t) logicalBlock, (int32_t) numBlocks2Read, &runLength);
 
-            // Chekc if memcpy failed
-            if (retPtr == nullptr) {
-                RETURN (-5000);
+            size_t runBytes = std::min(remaining, (size_t) runLength * this->blockSize - byteOffset);
+            if (runBlock < 0) {
+                memset(bufIter, 0, runBytes);
+            } else {
+                int ret = readRun(runBlock, byteOffset, bufIter, runBytes);
+                if (ret < 0) {
+                    //LOG("Couldn't read from Container");
+                    RETURN (-4000);
+                }
             }
 
-            // Get next block
-            start2ReadFAT = myFAT[start2ReadFAT];
+            bufIter += runBytes;
+            remaining -= runBytes;
+            byteOffset = 0;
+            logicalBlock += runLength;
+            numBlocks2Read -= runLength;
         }
+
+        readahead(fileInfo->fh, offset / this->blockSize,
+                  (size + offset % this->blockSize + this->blockSize - 1) / this->blockSize);
     }
 
-    info->atime = info->ctime = time(NULL);
+    touchAtime(fileInfo->fh);
 
     writeRoot();
+    commitMetadata(false);
 
     RETURN(size);
 }
@@ -579,10 +566,8 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
 /// \return Number of bytes written on success, -ERRNO on failure.
 int
 MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readDmap();
-    readFat();
-    readRoot();
 
     // Check if size and offset is greater than 0
     if (size < 0 || offset < 0) {
@@ -600,106 +585,135 @@ MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offs
         RETURN(-EPERM);
     }
 
-    MyFsDiskInfo *info = &myRoot[fileInfo->fh];
-    size_t totalNeededBlocks = ceil((double) (size + offset) / BLOCK_SIZE);
-    size_t haveBlocks = ceil(((double) info->size) / BLOCK_SIZE);
+    // the blocks behind the data need logical block numbers, nothing is changed otherwise
+    if (!isAddressable((uint64_t) offset + size)) {
+        RETURN(-EFBIG);
+    }
 
-    int64_t tmpBlock = 0;
-    int64_t iterBlock = 0;
+    // a write of more blocks than one transaction holds is split into writes of their own, a quarter of them leaves
+    // room for the delayed data flushed with it
+    size_t maxBytes = std::max(journalStep() / 4, (size_t) 1) * this->blockSize;
+    if (size > maxBytes) {
+        size_t written = 0;
+        while (written < size) {
+            int ret = fuseWrite(path, buf + written, std::min(size - written, maxBytes), offset + written, fileInfo);
+            if (ret < 0) {
+                RETURN(written > 0 ? (int) written : ret);
+            }
+            written += ret;
+        }
+        RETURN(size);
+    }
+    commitForSpace((offset % this->blockSize + size + this->blockSize - 1) / this->blockSize);
 
-    // Check if enough blockss are allocated
-    if (haveBlocks < totalNeededBlocks) {
-        int ret = allocateBlocks(totalNeededBlocks - haveBlocks, fileInfo->fh);
-        readDmap();
-        readFat();
-        readRoot();
+    MyFsDiskInfo *info = &myRoot[fileInfo->fh];
+    size_t diskSize = size;
 
+    // A gap behind the end of the file reads as zeros
+    if ((size_t) offset > info->size) {
+        int ret = zeroBehindEnd(fileInfo->fh, offset);
         if (ret < 0) {
             RETURN(ret);
         }
     }
 
-    // Set starts and offsets
-    int64_t startBlock = offset / BLOCK_SIZE;
-    u_int32_t offsetBlock = 0;
-    u_int32_t offsetByte = offset % BLOCK_SIZE;
-    int32_t numBlocks2Write = std::ceil(((double) (size + offsetByte) / BLOCK_SIZE));
-    const char* bufIter = buf;
-
-    iterBlock = info->data;
-
-    // Set offsetBlock if startBlock == 0
-    if (startBlock == 0) {
-        offsetBlock = iterBlock;
-    }
-
-    for (size_t i = 0; i < startBlock; i++) {
-        //Travel through blocks of the file to reach the offset
-        tmpBlock = myFAT[iterBlock];
-        if (tmpBlock == -1) {
-            //LOG("myFAT ended prematurely. THIS SHOULD NOT OCCUR!");
-            RETURN(-2000);
+    if (this->delayedAlloc) {
+        // Data behind the allocated blocks is kept until the file is flushed. Delayed data behind a hole is flushed
+        // before the hole is written, it has to become part of the chain first.
+        const DelayedWrite &delayed = myDelayed[fileInfo->fh];
+        int32_t chainEnd = allocatedEnd(fileInfo->fh);
+        if (!delayed.data.empty() && delayed.firstBlock > chainEnd &&
+            offset < (off_t) delayed.firstBlock * this->blockSize &&
+            (off_t) (offset + size) > (off_t) chainEnd * this->blockSize) {
+            int ret = flushDelayed(fileInfo->fh);
+            if (ret < 0) {
+                RETURN(ret);
+            }
         }
-        iterBlock = tmpBlock;
-        offsetBlock = iterBlock;
-    }
-
-    char buffer[BLOCK_SIZE];
-
-    for (size_t i = 0; i < numBlocks2Write; i++) {
-        void *retPtr = nullptr;
-        if (offsetByte > 0) {
-            //write first block (writing less than 512 bytes)
-            memset(buffer, 0, BLOCK_SIZE);
-            int ret = this->blockDevice->read(this->posDATA + offsetBlock, buffer);
+        off_t diskEnd = (off_t) allocatedEnd(fileInfo->fh) * this->blockSize;
+        if ((off_t) (offset + size) > diskEnd) {
+            diskSize = offset < diskEnd ? diskEnd - offset : 0;
+            int ret = delayWrite(fileInfo->fh, buf + diskSize, size - diskSize, offset + diskSize);
             if (ret < 0) {
-                //LOG("Couldn't read from Container");
-                RETURN (-4000);
+                RETURN(ret);
             }
-
-            retPtr = memcpy(buffer + offsetByte, bufIter, std::min(size, (size_t) BLOCK_SIZE - offsetByte));
-            bufIter += std::min(size, (size_t) BLOCK_SIZE - offsetByte);
-            offsetByte = 0;
         }
+    }
 
-        else if (bufIter + BLOCK_SIZE > buf + size) {
-            //write last block (writing less than 512 bytes)
-            memset(buffer, 0, BLOCK_SIZE);
-            if (info->size > size + offset) {
-                int ret = this->blockDevice->read(this->posDATA + offsetBlock, buffer);
-                if (ret < 0) {
-                    //LOG("Couldn't read from Container");
-                    RETURN (-4000);
-                }
-            }
+    int32_t byteOffset = offset % this->blockSize;
+    int64_t logicalBlock = offset / this->blockSize;
+    int64_t numBlocks2Write = diskSize > 0 ? (diskSize + byteOffset + this->blockSize - 1) / this->blockSize : 0;
 
-            retPtr = memcpy(buffer, bufIter,
-                            std::max(0UL, (u_long) (buf + size - bufIter)));
-        }
+    // the delayed data flushed above has been an operation of its own, the write itself starts here
+    int ret = reserveJournal(journalRecords(numBlocks2Write));
+    if (ret < 0) {
+        RETURN(ret);
+    }
 
-        else if (bufIter + BLOCK_SIZE <= buf + size) {
-            //write full blocks inbetween first and last
-            retPtr = memcpy(buffer, buf + i * BLOCK_SIZE, BLOCK_SIZE);
-            bufIter += BLOCK_SIZE;
+    if (numBlocks2Write > 0) {
+        // Partly written blocks of holes inside the file are zeroed, they would show what the new block held before
+        int64_t lastBlock = logicalBlock + numBlocks2Write - 1;
+        bool zeroHead = (byteOffset > 0 || byteOffset + diskSize < this->blockSize) &&
+                        (off_t) logicalBlock * this->blockSize < (off_t) info->size &&
+                        lookupExtent(fileInfo->fh, (int32_t) logicalBlock) < 0;
+        bool zeroTail = lastBlock > logicalBlock && (offset + diskSize) % this->blockSize != 0 &&
+                        (off_t) lastBlock * this->blockSize < (off_t) info->size &&
+                        lookupExtent(fileInfo->fh, (int32_t) lastBlock) < 0;
+
+        // fuseFallocate() may have allocated blocks already, only holes get new ones
+        ret = allocateBlocks(fileInfo->fh, (int32_t) logicalBlock, (int32_t) numBlocks2Write);
+        if (ret >= 0 && zeroHead) {
+            ret = zeroRange(fileInfo->fh, (off_t) logicalBlock * this->blockSize, this->blockSize);
+        }
+        if (ret >= 0 && zeroTail) {
+            ret = zeroRange(fileInfo->fh, (off_t) lastBlock * this->blockSize, this->blockSize);
+        }
+        if (ret < 0) {
+            RETURN(ret);
         }
+    }
 
-        if (retPtr == nullptr) {
-            //LOG("memcpy failed");
-            RETURN (-5000);
+    const char *bufIter = buf;
+    size_t remaining = diskSize;
+
+    // Write to the container, one call per run of consecutive blocks
+    while (numBlocks2Write > 0) {
+        int32_t runLength;
+        int32_t runBlock = mapRun(fileInfo->fh, (int32_t) logicalBlock, (int32_t) numBlocks2Write, &runLength);
+        if (runBlock < 0) {
+            //LOG("myFAT ended prematurely. THIS SHOULD NOT OCCUR!");
+            RETURN(-2000);
         }
 
-        this->blockDevice->write(this->posDATA + offsetBlock, buffer);
+        size_t runBytes = std::min(remaining, (size_t) runLength * this->blockSize - byteOffset);
+        ret = writeRun(runBlock, (off_t) logicalBlock * this->blockSize, byteOffset, bufIter, runBytes, info->size);
+        if (ret < 0) {
+            //LOG("Couldn't write to Container");
+            RETURN (-4000);
+        }
 
-        offsetBlock = myFAT[offsetBlock];
+        bufIter += runBytes;
+        remaining -= runBytes;
+        byteOffset = 0;
+        logicalBlock += runLength;
+        numBlocks2Write -= runLength;
     }
 
+    size_t oldSize = info->size;
     info->size = std::max(size + offset, info->size);
 
+    // writing inside the file only changes the timestamps of the entry, which lazytime keeps in memory
     info->atime = info->ctime = info->mtime = time(NULL);
+    if (info->size != oldSize) {
+        markRootDirty(fileInfo->fh);
+    } else {
+        markTimesDirty(fileInfo->fh);
+    }
 
     writeDmap();
     writeFat();
     writeRoot();
+    commitMetadata(false);
 
     RETURN(size);
 }
@@ -710,8 +724,8 @@ MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offs
 /// \param [in] File handel for the file set by fuseOpen.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     int valid = iIsPathValid(path, fileInfo->fh);
     if (valid < 0) {
@@ -723,44 +737,153 @@ int MyOnDiskFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo) {
         RETURN(-EBADF);
     }
 
+    int ret = flushDelayed(valid);
+
     myFsOpenFiles[valid] = false;
+    invalidateCursor(valid);
     iCounterOpen--;
     fileInfo->fh = -EBADF;
 
     writeRoot();
-    RETURN(0);
+    commitMetadata(false);
+
+    // the last close of a file writes back blocks held by the cache
+    int flushed = this->blockDevice->flush();
+    ret = ret < 0 ? ret : flushed;
+    RETURN(ret);
+}
+
+/// @brief Write back the data of a file when a file descriptor is closed.
+///
+/// Delayed data of the file gets its blocks, and blocks held in a write-back cache are written to the container file,
+/// so errors can be reported to close().
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFlush(const char *path, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    //LOGM();
+
+    int valid = iIsPathValid(path, fileInfo->fh);
+    if (valid < 0) {
+        RETURN(valid);
+    }
+
+    int ret = flushDelayed(valid);
+    if (ret < 0) {
+        RETURN(ret);
+    }
+    commitMetadata(false);
+
+    ret = this->blockDevice->flush();
+    RETURN(ret);
+}
+
+/// @brief Synchronize a file.
+///
+/// Make the content and the metadata of a file durable. The delayed data of the file gets its blocks, then the block
+/// device pushes all written blocks to the container file. Metadata that is not committed yet is committed, which makes
+/// the written blocks durable, too. Without journal or shadow paging the metadata has been written to the container
+/// already.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] datasync Can be ignored.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFsync(const char *path, int datasync, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    //LOGM();
+
+    int valid = iIsPathValid(path, fileInfo->fh);
+    if (valid < 0) {
+        RETURN(valid);
+    }
+
+    int ret = flushDelayed(valid);
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
+    // timestamps kept in memory by lazytime are written now, those of other files once they are due
+    flushLazyTimes(false);
+    if (myLazyTimes[valid]) {
+        ret = reserveJournal(journalRecords(0));
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        markRootDirty(valid);
+    }
+    writeRoot();
+
+    ret = this->uncommitted ? commitMetadata(true) : this->blockDevice->sync();
+    RETURN(ret);
+}
+
+/// @brief Read an extended attribute.
+///
+/// The file system provides the counters of the block cache as attribute "user.myfs.cache" of every path, e.g. for
+/// `getfattr -n user.myfs.cache <mountpoint>`.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] name Name of the attribute.
+/// \param [out] value Buffer for the value of the attribute.
+/// \param [in] size Size of the buffer, 0 to query the size of the value.
+/// \return Size of the value on success, -ERRNO on failure.
+#ifdef __APPLE__
+int MyOnDiskFS::fuseGetxattr(const char *path, const char *name, char *value, size_t size, uint x) {
+#else
+int MyOnDiskFS::fuseGetxattr(const char *path, const char *name, char *value, size_t size) {
+#endif
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    if (this->blockCache == NULL || strcmp(name, "user.myfs.cache") != 0) {
+#ifdef ENOATTR
+        RETURN(-ENOATTR);
+#else
+        RETURN(-ENODATA);
+#endif
+    }
+
+    BlockCacheStats stats = this->blockCache->stats();
+    char text[192];
+    int len = snprintf(text, sizeof(text), "hits=%llu misses=%llu evictions=%llu writebacks=%llu prefetched=%llu",
+                       (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+                       (unsigned long long) stats.evictions, (unsigned long long) stats.writebacks,
+                       (unsigned long long) stats.prefetched);
+
+    if (size == 0) {
+        RETURN(len);
+    }
+    if (size < (size_t) len) {
+        RETURN(-ERANGE);
+    }
+    memcpy(value, text, len);
+    RETURN(len);
 }
 
 /// @brief Truncate a file.
 ///
 /// Set the size of a file to the new size. If the new size is smaller than the old size, spare bytes are removed. If
-/// the new size is larger than the old size, the new bytes may be random.
+/// the new size is larger than the old size, the new bytes are a hole that reads as zeros. Containers without sparse
+/// files allocate blocks for them instead, their bytes may be random.
 /// You do not have to check file permissions, but can assume that it is always ok to access the file.
 /// \param [in] path Name of the file, starting with "/".
 /// \param [in] newSize New size of the file.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
 
     if (newSize < 0) {
         RETURN(-EINVAL);
     }
 
     //get file-index and call other fuseTruncate with it
-    fuse_file_info *info = (fuse_file_info *) malloc(sizeof(fuse_file_info));
-    info->fh = -1;
-
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (strcmp(path, myRoot[i].cPath) == 0) {
-            //found file
-            info->fh = i;
-        }
-    }
-    if (info->fh < 0) {
+    int index = iFindFileIndex(path);
+    if (index < 0) {
         //file doesn't exist
         RETURN(-EEXIST);
     }
+    fuse_file_info *info = (fuse_file_info *) malloc(sizeof(fuse_file_info));
+    info->fh = index;
+
     int ret = fuseTruncate(path, newSize, info);
 
     free(info);
@@ -771,19 +894,16 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
 /// @brief Truncate a file.
 ///
 /// Set the size of a file to the new size. If the new size is smaller than the old size, spare bytes are removed. If
-/// the new size is larger than the old size, the new bytes may be random. This function is called for files that are
-/// open.
+/// the new size is larger than the old size, the new bytes are a hole that reads as zeros. Containers without sparse
+/// files allocate blocks for them instead, their bytes may be random. This function is called for files that are open.
 /// You do not have to check file permissions, but can assume that it is always ok to access the file.
 /// \param [in] path Name of the file, starting with "/".
 /// \param [in] newSize New size of the file.
 /// \param [in] fileInfo Can be ignored in Part 1.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readSuperBlock();
-    readDmap();
-    readFat();
-    readRoot();
 
     if (newSize < 0) {
         RETURN(-EINVAL);
@@ -793,43 +913,70 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_i
         RETURN(iIsPathValid(path, fileInfo->fh));
     }
 
+    if (!isAddressable(newSize)) {
+        RETURN(-EFBIG);
+    }
+    if (!this->sparseFiles) {
+        commitForSpace((newSize + this->blockSize - 1) / this->blockSize);
+    }
+
     MyFsDiskInfo *info = &myRoot[fileInfo->fh];
 
-    size_t newBlocks = ceil(newSize / BLOCK_SIZE);
-    size_t oldBlocks = ceil(info->size / BLOCK_SIZE);
+    // Delayed data gets its blocks first, so only the chain has to be cut or extended
+    int ret = flushDelayed(fileInfo->fh);
+    if (ret < 0) {
+        RETURN(ret);
+    }
 
-    if (oldBlocks <= 0 && newBlocks >= 1) {
-        //LOG("file was empty");
-        int32_t num = findFreeBlock();
-        if (num < 0) {
-            //LOG("findFreeBlock() failed");
-            RETURN(num);
+    // Blocks the file has behind its end already must not show old bytes in the new part
+    if ((size_t) newSize > info->size) {
+        ret = zeroBehindEnd(fileInfo->fh, newSize);
+        if (ret < 0) {
+            RETURN(ret);
         }
-        info->data = num;
+    }
+
+    int64_t newBlocks = (newSize + this->blockSize - 1) / this->blockSize;
 
-        newBlocks--;
-        oldBlocks++;
+    // more blocks than one transaction holds are freed or allocated in steps, each of them an operation of its own
+    size_t step = journalStep();
+    int32_t start;
+    while ((start = stepStart(fileInfo->fh, (int32_t) newBlocks, allocatedEnd(fileInfo->fh), step)) > newBlocks) {
+        ret = releaseStep(fileInfo->fh, start, step);
+        if (ret < 0) {
+            RETURN(ret);
+        }
+    }
+    while (!this->sparseFiles && newBlocks - allocatedEnd(fileInfo->fh) > (int64_t) step) {
+        ret = reserveJournal(journalRecords(step));
+        if (ret >= 0) {
+            ret = allocateBlocks(fileInfo->fh, allocatedEnd(fileInfo->fh), (int32_t) step);
+        }
+        if (ret < 0) {
+            RETURN(ret);
+        }
+    }
+    int32_t oldBlocks = allocatedEnd(fileInfo->fh);
+    ret = reserveJournal(journalRecords(newBlocks > oldBlocks ? newBlocks - oldBlocks : oldBlocks - newBlocks));
+    if (ret < 0) {
+        RETURN(ret);
     }
 
-    if (newBlocks > oldBlocks) {
+    if (newBlocks > oldBlocks && !this->sparseFiles) {
         //LOG("file is getting bigger, we need more blocks");
-        allocateBlocks(newBlocks - oldBlocks, fileInfo->fh);
+        ret = allocateBlocks(fileInfo->fh, oldBlocks, (int32_t) (newBlocks - oldBlocks));
+        if (ret < 0) {
+            RETURN(ret);
+        }
 
     } else if (newBlocks < oldBlocks) {
         //LOG("file is getting smaller, we can free blocks");
-        int32_t num = info->data;
-        //iterate through myFat to reach last block of newSize
-        //careful 0th iteration is already done with num = info->data
-        for (int i = 1; i < newBlocks; i++) {
-            num = myFAT[num];
-        }
-        int ret = freeBlocks(num);
+        ret = releaseBlocks(fileInfo->fh, (int32_t) newBlocks, (int32_t) (oldBlocks - newBlocks));
         if (ret < 0) {
-            //LOG("failed inside freeBlocks");
+            //LOG("failed inside releaseBlocks");
             RETURN (ret);
         }
         info->mtime = time(NULL);
-        //LOGF("synced block = %ld", num);
     } else {
         //LOG("don't need new Blocks -> do nothing");
     }
@@ -837,58 +984,276 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_i
     //LOGF("info->size NEW = %ld | info->size OLD = %ld", newSize, info->size);
     info->size = newSize;
 
-    if (newSize <= 0) {
-        info->size = newSize;
-        size_t tmpBlockNum = info->data;
-        info->data = POS_NULLPTR;
-        freeBlocks(tmpBlockNum);
-        info->mtime = time(NULL);
-    }
-
-    info->atime = info->ctime = info->ctime = time(NULL);
+    info->atime = info->ctime = time(NULL);
+    markRootDirty(fileInfo->fh);
 
     writeSuperBlock();
     writeDmap();
     writeFat();
     writeRoot();
+    commitMetadata(false);
     //LOGF("info->size = %ld", info->size);
 
     RETURN(0);
 }
 
-/// @brief Read a directory.
+/// @brief Allocate space for a file.
 ///
-/// Read the content of the (only) directory.
-/// You do not have to check file permissions, but can assume that it is always ok to access the directory.
-/// \param [in] path Path of the directory. Should be "/" in our case.
-/// \param [out] buf A buffer for storing the directory entries.
-/// \param [in] filler A function for putting entries into the buffer.
-/// \param [in] offset Can be ignored.
-/// \param [in] fileInfo Can be ignored.
+/// Allocate the blocks for the given range of an open file, so later writes to the range do not fail for lack of space.
+/// The holes of the range are filled at once and get consecutive blocks where possible. Unless FALLOC_FL_KEEP_SIZE is
+/// given, the file grows to the end of the range. New blocks inside the file are zeroed, so they read as before.
+/// With FALLOC_FL_PUNCH_HOLE the range becomes a hole instead, the blocks it covers completely are freed and the rest
+/// is zeroed. Containers without sparse files zero the whole range and keep its blocks.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] mode 0, FALLOC_FL_KEEP_SIZE or FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE.
+/// \param [in] offset Start of the range.
+/// \param [in] length Length of the range.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
 /// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo) {
+int MyOnDiskFS::fuseFallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
     //LOGM();
-    readRoot();
-
-    filler(buf, ".", NULL, 0); // Current Directory
-    filler(buf, "..", NULL, 0); // Parent Directory
 
-    // If the user is trying to show the files/directories of the root directory show the following
-    if (strcmp(path, "/") == 0) {
+    if (offset < 0 || length <= 0) {
+        RETURN(-EINVAL);
+    }
+    if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) != 0 ||
+        ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))) {
+        RETURN(-EOPNOTSUPP);
+    }
 
-        // Iterate through all the files
-        for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
-            if (!myFsEmpty[i]) {
+    int valid = iIsPathValid(path, fileInfo->fh);
+    if (valid < 0) {
+        RETURN(valid);
+    }
+    if (!myFsOpenFiles[valid]) {
+        RETURN(-EBADF);
+    }
+
+    MyFsDiskInfo *info = &myRoot[valid];
+
+    // a range that does not fit leaves the file as it is
+    int64_t firstBlock = offset / this->blockSize;
+    int64_t endBlock = ((uint64_t) offset + length + this->blockSize - 1) / this->blockSize;
+    if (!(mode & FALLOC_FL_PUNCH_HOLE)) {
+        if (!isAddressable((uint64_t) offset + length)) {
+            RETURN(-EFBIG);
+        }
+        commitForSpace(endBlock - firstBlock);
+    }
+
+    // Delayed data gets its blocks first, the range may overlap it
+    int ret = flushDelayed(valid);
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
+    if (mode & FALLOC_FL_PUNCH_HOLE) {
+        off_t end = std::min((off_t) (offset + length), (off_t) info->size);
+        int32_t firstHole = (offset + this->blockSize - 1) / this->blockSize;
+        int32_t endHole = std::min((offset + length) / this->blockSize, (off_t) INT32_MAX);
+        if (this->sparseFiles && firstHole < endHole) {
+            // more blocks than one transaction holds are freed in steps from the end of the range, each of them an
+            // operation of its own
+            size_t step = journalStep();
+            int32_t stepEnd = endHole;
+            int32_t start;
+            while (ret >= 0 && (start = stepStart(valid, firstHole, stepEnd, step)) > firstHole) {
+                ret = reserveJournal(journalRecords(step));
+                if (ret >= 0) {
+                    ret = releaseBlocks(valid, start, stepEnd - start);
+                }
+                stepEnd = start;
+            }
+            if (ret >= 0) {
+                ret = reserveJournal(journalRecords(step));
+            }
+
+            // only the partly covered blocks at both ends of the range keep their blocks
+            off_t headEnd = std::min((off_t) firstHole * this->blockSize, end);
+            off_t tailStart = (off_t) endHole * this->blockSize;
+            if (ret >= 0 && offset < headEnd) {
+                ret = zeroRange(valid, offset, headEnd - offset);
+            }
+            if (ret >= 0 && tailStart < end) {
+                ret = zeroRange(valid, tailStart, end - tailStart);
+            }
+            if (ret >= 0) {
+                ret = releaseBlocks(valid, firstHole, stepEnd - firstHole);
+            }
+        } else {
+            ret = reserveJournal(journalRecords(0));
+            if (ret >= 0 && offset < end) {
+                ret = zeroRange(valid, offset, end - offset);
+            }
+        }
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        if (offset < end) {
+            info->mtime = time(NULL);
+        }
+    } else {
+        std::vector<std::pair<int32_t, int32_t>> holes;
+        if (containerFull(findHoles(valid, (int32_t) firstBlock, (int32_t) (endBlock - firstBlock), &holes))) {
+            RETURN(-ENOSPC);
+        }
+
+        off_t newSize = info->size;
+        if (!(mode & FALLOC_FL_KEEP_SIZE) && (size_t) (offset + length) > info->size) {
+            newSize = offset + length;
+            ret = zeroBehindEnd(valid, newSize);
+            if (ret < 0) {
+                RETURN(ret);
+            }
+        }
+
+        // more blocks than one transaction holds are allocated in steps, each of them an operation of its own; in
+        // containers without sparse files the range starts at the end of the chain at the latest, see findHoles()
+        size_t step = journalStep();
+        int64_t stepFirst = this->sparseFiles ? firstBlock : std::min(firstBlock, (int64_t) allocatedEnd(valid));
+        while (stepFirst < endBlock) {
+            int64_t stepEnd = std::min(endBlock, stepFirst + (int64_t) step);
+            std::vector<std::pair<int32_t, int32_t>> filled;
+            ret = reserveJournal(journalRecords(stepEnd - stepFirst));
+            if (ret >= 0) {
+                ret = allocateBlocks(valid, (int32_t) stepFirst, (int32_t) (stepEnd - stepFirst), &filled);
+            }
+
+            // the filled holes read as zeros up to the end of the file
+            for (size_t i = 0; ret >= 0 && i < filled.size(); i++) {
+                off_t start = (off_t) filled[i].first * this->blockSize;
+                off_t end = std::min((off_t) (filled[i].first + filled[i].second) * this->blockSize, newSize);
+                if (start < end) {
+                    ret = zeroRange(valid, start, end - start);
+                }
+            }
+            if (ret < 0) {
+                RETURN(ret);
+            }
+            stepFirst = stepEnd;
+        }
+
+        if ((size_t) newSize > info->size) {
+            info->size = newSize;
+            info->mtime = time(NULL);
+        }
+    }
+
+    info->ctime = time(NULL);
+    markRootDirty(valid);
+
+    writeRoot();
+    commitMetadata(false);
+    RETURN(0);
+}
+
+/// @brief Find data or a hole in a file.
+///
+/// SEEK_DATA moves to the first byte at or behind offset that is not inside a hole, SEEK_HOLE to the first byte of the
+/// next hole, the end of the file counting as one. Delayed data counts as data. The other values of whence are handled
+/// by the kernel.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] offset Position to start the search at.
+/// \param [in] whence SEEK_DATA or SEEK_HOLE.
+/// \param [in] fileInfo File handle for the file set by fuseOpen.
+/// \return The new position on success, -ENXIO if there is no data at or behind offset, -ERRNO on other failures.
+off_t MyOnDiskFS::fuseLseek(const char *path, off_t offset, int whence, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    //LOGM();
+
+    int valid = iIsPathValid(path, fileInfo->fh);
+    if (valid < 0) {
+        return valid;
+    }
+    if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+        return -EINVAL;
+    }
+
+    off_t fileSize = myRoot[valid].size;
+    if (offset < 0 || offset >= fileSize) {
+        return -ENXIO;
+    }
+
+    // delayed data lies behind all allocated blocks
+    const DelayedWrite &delayed = myDelayed[valid];
+    int32_t delayedStart = delayed.data.empty() ? INT32_MAX : delayed.firstBlock;
+    int32_t delayedEnd = delayedStart;
+    if (!delayed.data.empty()) {
+        delayedEnd += (delayed.data.size() + this->blockSize - 1) / this->blockSize;
+    }
+    const std::vector<Extent> &extents = myExtents[valid];
+    int32_t block = offset / this->blockSize;
+    int32_t index = findExtent(valid, block);
+
+    bool isDelayed = block >= delayedStart && block < delayedEnd;
+
+    if (whence == SEEK_DATA) {
+        if (index >= 0 || isDelayed) {
+            return offset;
+        }
+        int32_t next = nextExtent(valid, block);
+        int32_t dataBlock = next < (int32_t) extents.size() ? extents[next].logicalStart : INT32_MAX;
+        if (delayedStart > block) {
+            dataBlock = std::min(dataBlock, delayedStart);
+        }
+        off_t pos = (off_t) dataBlock * this->blockSize;
+        return pos < fileSize ? pos : -ENXIO;
+    }
+
+    if (index < 0 && !isDelayed) {
+        return offset;
+    }
+    // extents that continue each other inside the file are one range of data, the delayed data may follow them
+    int32_t end = block;
+    while (index >= 0 && index < (int32_t) extents.size() && extents[index].logicalStart <= end) {
+        end = extents[index].logicalStart + extents[index].length;
+        index++;
+    }
+    if (end >= delayedStart && end < delayedEnd) {
+        end = delayedEnd;
+    }
+    return std::min((off_t) end * this->blockSize, fileSize);
+}
+
+/// @brief Read a directory.
+///
+/// Read the content of the (only) directory.
+/// You do not have to check file permissions, but can assume that it is always ok to access the directory.
+/// \param [in] path Path of the directory. Should be "/" in our case.
+/// \param [out] buf A buffer for storing the directory entries.
+/// \param [in] filler A function for putting entries into the buffer.
+/// \param [in] offset Can be ignored.
+/// \param [in] fileInfo Can be ignored.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    //LOGM();
+
+    filler(buf, ".", NULL, 0); // Current Directory
+    filler(buf, "..", NULL, 0); // Parent Directory
+
+    // If the user is trying to show the files/directories of the root directory show the following
+    if (strcmp(path, "/") == 0) {
+
+        // Iterate through all the files
+        for (size_t i = 0; i < this->numDirEntries; i++) {
+            if (!myFsEmpty[i]) {
                 // Add file to the readdir output
                 filler(buf, myRoot[i].cPath + 1, NULL, 0);
 
-                // Change access and changed time
-                myRoot[i].atime = myRoot[i].ctime = time(NULL);
+                // Change access time, every entry on its own as there may be more than one transaction holds
+                int ret = reserveJournal(journalRecords(0));
+                if (ret < 0) {
+                    RETURN(ret);
+                }
+                touchAtime(i);
             }
         }
     }
 
     writeRoot();
+    commitMetadata(false);
     RETURN(0);
 }
 
@@ -898,10 +1263,19 @@ int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler,
 /// \param [in] conn Can be ignored.
 /// \return 0.
 void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
+    return mountContainer((MyFsInfo *) fuse_get_context()->private_data);
+}
+
+/// Open the log file and the container, a container that does not exist is created.
+///
+/// fuseInit() calls this with the options of the mount command. Tests call it directly, they have no FUSE context.
+/// \param [in] fsInfo Options of the file system.
+/// \return 0.
+void *MyOnDiskFS::mountContainer(MyFsInfo *fsInfo) {
     // Open logfile
-    this->logFile = fopen(((MyFsInfo *) fuse_get_context()->private_data)->logFile, "w+");
+    this->logFile = fopen(fsInfo->logFile, "w+");
     if (this->logFile == NULL) {
-        fprintf(stderr, "ERROR: Cannot open logfile %s\n", ((MyFsInfo *) fuse_get_context()->private_data)->logFile);
+        fprintf(stderr, "ERROR: Cannot open logfile %s\n", fsInfo->logFile);
     } else {
         // turn of logfile buffering
         setvbuf(this->logFile, NULL, _IOLBF, 0);
@@ -910,19 +1284,84 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
 
         LOG("Using on-disk mode");
 
-        this->containerFilePath = ((MyFsInfo *) fuse_get_context()->private_data)->contFile;
+        this->containerFilePath = fsInfo->contFile;
 
         LOGF("Container file name: %s", containerFilePath);
 
-        int ret = this->blockDevice->open(this->containerFilePath);
+        // the geometry of an existing container is stored in its superblock, new ones get the requested one
+        SuperBlock format;
+        int ret = readFormat(this->containerFilePath, &format);
+        if (ret == -ENOENT) {
+            format.version = FORMAT_VERSION;
+            format.blockSize = fsInfo->blockSize > 0 ? fsInfo->blockSize : BLOCK_SIZE;
+            if (!isValidBlockSize(format.blockSize)) {
+                LOGF("WARNING: unsupported block size %u, using %u", format.blockSize, BLOCK_SIZE);
+                format.blockSize = BLOCK_SIZE;
+            }
+            format.numDataBlocks = fsInfo->dataBlocks > 0 ? fsInfo->dataBlocks : NUM_DATA_BLOCKS;
+            if (format.numDataBlocks > MAX_DATA_BLOCKS) {
+                LOGF("WARNING: at most %u data blocks are supported", MAX_DATA_BLOCKS);
+                format.numDataBlocks = MAX_DATA_BLOCKS;
+            }
+            format.numDirEntries = fsInfo->dirEntries > 0 ? fsInfo->dirEntries : NUM_DIR_ENTRIES;
+            if (format.numDirEntries > MAX_DIR_ENTRIES) {
+                LOGF("WARNING: at most %u directory entries are supported", MAX_DIR_ENTRIES);
+                format.numDirEntries = MAX_DIR_ENTRIES;
+            }
+            format.shadowPaging = fsInfo->shadowPaging ? 1 : 0;
+        } else if (ret < 0) {
+            LOGF("ERROR: Cannot read the format of the container, error %d", ret);
+            RETURN(0);
+        } else if (fsInfo->blockSize > 0 || fsInfo->dataBlocks > 0 || fsInfo->dirEntries > 0 || fsInfo->shadowPaging) {
+            LOG("WARNING: container exists, ignoring blocksize, datablocks, direntries and shadow");
+        }
+        LOGF("Format version %u: %u byte blocks, %u data blocks, %u directory entries", format.version,
+             format.blockSize, format.numDataBlocks, format.numDirEntries);
+        setGeometry(format.version, format.blockSize, format.numDataBlocks, format.numDirEntries, format.shadowPaging);
+
+        selectBlockDevice(fsInfo);
+
+        this->delayedAlloc = fsInfo->delayedAlloc;
+        if (this->delayedAlloc) {
+            LOGF("Delayed allocation, up to %d bytes per file", DELALLOC_MAX_SIZE);
+        }
+        this->atimeMode = fsInfo->atimeMode;
+        this->lazyTime = fsInfo->lazyTime;
+        if (this->atimeMode == ATIME_RELATIME) {
+            LOG("Updating access times after changes only (relatime)");
+        } else if (this->atimeMode == ATIME_NOATIME) {
+            LOG("Not updating access times (noatime)");
+        }
+        if (this->lazyTime) {
+            LOGF("Keeping changed timestamps in memory for up to %d s (lazytime)", LAZYTIME_INTERVAL);
+        }
+        this->commitInterval = fsInfo->commitInterval > 0 ? fsInfo->commitInterval : JOURNAL_COMMIT_INTERVAL;
+        if (this->metadataJournal) {
+            LOGF("Metadata journal with %lu blocks, committing after %u ms", this->blocks4JOURNAL,
+                 this->commitInterval);
+        } else if (this->shadowPaging) {
+            LOGF("Shadow paging of %lu metadata blocks, committing after %u ms", this->shadowDistance,
+                 this->commitInterval);
+        }
+
+        ret = this->blockDevice->open(this->containerFilePath);
 
         if (ret >= 0) {
             LOG("Container file does exist, reading");
 
+            // after a crash the journal may hold committed transactions that are not checkpointed yet
+            if (this->metadataJournal) {
+                ret = checkpointJournal();
+                if (ret < 0) {
+                    LOGF("ERROR: Replaying the journal failed with error %d", ret);
+                }
+            }
+
             readSuperBlock();
             readDmap();
             readFat();
             readRoot();
+            readLogical();
 
             initializeHelpers();
 
@@ -936,12 +1375,21 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
                 writeSuperBlock();
                 writeDmap();
                 writeFat();
+                writeLogical();
                 writeRoot();
+                if (this->metadataJournal) {
+                    checkpointJournal();
+                } else if (this->shadowPaging) {
+                    // the first commit writes all blocks to their second slots and the superblock in block 0
+                    commitShadow();
+                }
             }
         }
 
         if (ret < 0) {
             LOGF("ERROR: Access to container file failed with error %d", ret);
+        } else if (this->metadataJournal || this->shadowPaging || this->lazyTime) {
+            this->committer = std::thread(&MyOnDiskFS::runCommitter, this);
         }
     }
 
@@ -953,187 +1401,1502 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
 /// This function is called when the file system is unmounted. You may add some cleanup code here.
 void MyOnDiskFS::fuseDestroy() {
     //LOGM();
+    stopCommitThread();
+    for (int i = 0; i < this->numDirEntries; i++) {
+        flushDelayed(i);
+    }
+    flushLazyTimes(true);
+    writeRoot();
+    if (commitMetadata(true) == 0 && this->metadataJournal) {
+        checkpointJournal();
+    }
+    if (this->blockCache != NULL) {
+        BlockCacheStats stats = this->blockCache->stats();
+        LOGF("Block cache: %llu hits, %llu misses, %llu evictions, %llu writebacks, %llu prefetched",
+             (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions,
+             (unsigned long long) stats.writebacks, (unsigned long long) stats.prefetched);
+    }
     this->blockDevice->close();
 }
 
-/// unlinks all blocks of the file starting with Block "num"
-/// \param num first Block to be unlinked
-/// \return 0 on success, -ERRORNUMBER on failure
-int MyOnDiskFS::freeBlocks(int32_t num) {
-    readSuperBlock();
-    readDmap();
-    readFat();
-
-    if (myFAT[num] == -1 && myDmap[num] == 1) {
-        RETURN(2);
+/// \param blockNo index of the data block to start with, 0 being the start of the data segment
+/// \param free true to look for an empty block, false for an occupied one
+/// \return index of the first block at or after blockNo in this state, myDmap.size() * 64 if there is none
+size_t MyOnDiskFS::scanDmap(size_t blockNo, bool free) {
+    uint64_t invert = free ? 0 : ~0ULL;
+    size_t word = blockNo / 64;
+    uint64_t bits = 0;
+    if (word < myDmap.size()) {
+        bits = (myDmap[word] ^ invert) & (~0ULL << (blockNo % 64));
+    }
+
+    if (bits == 0 && free) {
+        // skip words without empty blocks, 64 of them per summary word
+        word++;
+        size_t group = word / 64;
+        uint64_t summary = 0;
+        if (group < myDmapSummary.size()) {
+            summary = myDmapSummary[group] & (~0ULL << (word % 64));
+        }
+        while (summary == 0 && ++group < myDmapSummary.size()) {
+            summary = myDmapSummary[group];
+        }
+        if (summary == 0) {
+            return myDmap.size() * 64;
+        }
+        word = group * 64 + __builtin_ctzll(summary);
+        bits = myDmap[word];
     }
-
-    if (num > this->blocks4DATA && num < 0) {
-        //LOGF("num = %ld not valid", num);
-        RETURN(-1111);
+    while (bits == 0 && ++word < myDmap.size()) {
+        bits = myDmap[word] ^ invert;
+    }
+    if (bits == 0) {
+        return myDmap.size() * 64;
     }
 
-    u_int64_t tmpBlock = 0;
-    u_int64_t iterBlock = 0;
+    return word * 64 + __builtin_ctzll(bits);
+}
 
-    iterBlock = num;
+/// \param blockNo index of the data block, 0 being the start of the data segment
+/// \return true if the block is empty
+bool MyOnDiskFS::isFreeBlock(size_t blockNo) {
+    return (myDmap[blockNo / 64] >> (blockNo % 64)) & 1;
+}
 
-    while (tmpBlock != -1) {
-        myDmap[iterBlock] = 1;
-        mySuperBlock.numFreeBlocks++;
+/// marks a data block as empty or occupied in myDmap and myDmapSummary, and the DMAP block for the next writeDmap()
+/// \param blockNo index of the data block, 0 being the start of the data segment
+/// \param free true if the block is empty
+void MyOnDiskFS::setFreeBlock(size_t blockNo, bool free) {
+    size_t word = blockNo / 64;
+    if (free) {
+        myDmap[word] |= 1ULL << (blockNo % 64);
+        myDmapSummary[word / 64] |= 1ULL << (word % 64);
+    } else {
+        myDmap[word] &= ~(1ULL << (blockNo % 64));
+        if (myDmap[word] == 0) {
+            myDmapSummary[word / 64] &= ~(1ULL << (word % 64));
+        }
+    }
+    markDmapDirty(blockNo);
+}
 
-        tmpBlock = myFAT[iterBlock];
-        myFAT[iterBlock] = -1;
+/// rebuilds myFreeExtents and myFreeBySize from myDmap
+void MyOnDiskFS::buildFreeExtents() {
+    myFreeExtents.clear();
+    myFreeBySize.clear();
 
-        iterBlock = tmpBlock;
+    size_t blockNo = scanDmap(0, true);
+    while (blockNo < this->blocks4DATA) {
+        size_t end = std::min(scanDmap(blockNo, false), (size_t) this->blocks4DATA);
+        myFreeExtents[blockNo] = end - blockNo;
+        myFreeBySize.insert(std::make_pair((int32_t) (end - blockNo), (int32_t) blockNo));
+        blockNo = scanDmap(end, true);
     }
+}
 
-    writeSuperBlock();
-    writeDmap();
-    writeFat();
+/// adds empty blocks to myFreeExtents and myFreeBySize, merged with the runs in front of and behind them
+/// \param start first block of the run, 0 being the start of the data segment
+/// \param length number of blocks
+void MyOnDiskFS::addFreeExtent(int32_t start, int32_t length) {
+    std::map<int32_t, int32_t>::iterator next = myFreeExtents.lower_bound(start);
+    if (next != myFreeExtents.end() && next->first == start + length) {
+        length += next->second;
+        myFreeBySize.erase(std::make_pair(next->second, next->first));
+        next = myFreeExtents.erase(next);
+    }
+    if (next != myFreeExtents.begin()) {
+        std::map<int32_t, int32_t>::iterator prev = std::prev(next);
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            length += prev->second;
+            myFreeBySize.erase(std::make_pair(prev->second, prev->first));
+            myFreeExtents.erase(prev);
+        }
+    }
 
-    RETURN(0);
+    myFreeExtents[start] = length;
+    myFreeBySize.insert(std::make_pair(length, start));
 }
 
-size_t MyOnDiskFS::findFreeBlock() {
-    //LOGM();
-    readSuperBlock();
-    readDmap();
-    if (containerFull(1)) {
-        RETURN(ERROR_BLOCKNUMBER);
+/// occupies a range of empty blocks: removes it from the free extents and marks it in myDmap and the superblock
+/// \param start first block of the range, 0 being the start of the data segment
+/// \param length number of blocks, all of them inside one free extent
+void MyOnDiskFS::takeFreeRange(int32_t start, int32_t length) {
+    std::map<int32_t, int32_t>::iterator extent = std::prev(myFreeExtents.upper_bound(start));
+    int32_t extentStart = extent->first;
+    int32_t extentLength = extent->second;
+    myFreeBySize.erase(std::make_pair(extentLength, extentStart));
+    myFreeExtents.erase(extent);
+
+    // the parts in front of and behind the range stay free
+    if (start > extentStart) {
+        myFreeExtents[extentStart] = start - extentStart;
+        myFreeBySize.insert(std::make_pair(start - extentStart, extentStart));
     }
+    int32_t rest = extentStart + extentLength - (start + length);
+    if (rest > 0) {
+        myFreeExtents[start + length] = rest;
+        myFreeBySize.insert(std::make_pair(rest, start + length));
+    }
+
+    for (int32_t i = start; i < start + length; i++) {
+        setFreeBlock(i, false);
+    }
+    mySuperBlock.numFreeBlocks -= length;
+    markSuperBlockDirty();
+}
 
-    for (size_t i = 0; i < this->blocks4DATA; i++) {
-        if (myDmap[i]) {
-            memset(&myDmap[i], 0, sizeof(bool));
-            mySuperBlock.numFreeBlocks--;
-            //LOGF("  numFreeBlocks = %ld ", mySuperBlock.numFreeBlocks);
-            writeSuperBlock();
-            writeDmap();
-            RETURN (i);
+/// occupies up to numBlocks consecutive empty blocks
+///
+/// If the goal block is empty, the blocks are taken from there, so a file grows without a gap. Otherwise the first
+/// free extent at or behind the goal that holds all blocks is used, starting at allocCursor if there is no goal. Each
+/// allocation moves allocCursor behind its blocks (next fit), so new files do not crowd the front of the container. If
+/// no extent is large enough, the largest one is used and the caller asks for the rest again.
+/// \param numBlocks number of blocks wanted
+/// \param goal preferred first block, e.g. the block behind the end of the file, -1 for none
+/// \param [out] length number of blocks occupied, at most numBlocks
+/// \return first block of the run, 0 being the start of the data segment, ERROR_BLOCKNUMBER if the container is full
+size_t MyOnDiskFS::allocateExtent(int32_t numBlocks, int32_t goal, int32_t *length) {
+    if (myFreeBySize.empty()) {
+        return ERROR_BLOCKNUMBER;
+    }
+    if (goal >= (int32_t) this->blocks4DATA) {
+        goal = -1;
+    }
+
+    // blocks freed in the running transaction are empty in myDmap, but not in a free extent yet
+    std::map<int32_t, int32_t>::iterator goalExtent = myFreeExtents.upper_bound(goal);
+    bool goalFree = goal >= 0 && goalExtent != myFreeExtents.begin() &&
+                    std::prev(goalExtent)->first + std::prev(goalExtent)->second > goal;
+
+    int32_t start;
+    if (goalFree) {
+        std::map<int32_t, int32_t>::iterator extent = std::prev(goalExtent);
+        start = goal;
+        *length = std::min(numBlocks, extent->first + extent->second - goal);
+    } else if (myFreeBySize.lower_bound(std::make_pair(numBlocks, 0)) != myFreeBySize.end()) {
+        // there is a fitting extent, extents in front of the goal come last
+        std::map<int32_t, int32_t>::iterator extent = myFreeExtents.lower_bound(goal >= 0 ? goal : this->allocCursor);
+        for (;; extent++) {
+            if (extent == myFreeExtents.end()) {
+                extent = myFreeExtents.begin();
+            }
+            if (extent->second >= numBlocks) {
+                break;
+            }
         }
+        start = extent->first;
+        *length = numBlocks;
+    } else {
+        std::set<std::pair<int32_t, int32_t>>::iterator largest = std::prev(myFreeBySize.end());
+        start = largest->second;
+        *length = largest->first;
     }
 
-    RETURN(ERROR_BLOCKNUMBER);
+    takeFreeRange(start, *length);
+    this->allocCursor = start + *length;
+
+    return start;
 }
 
-void MyOnDiskFS::initializeHelpers() {
-    //LOGM();
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        myFsOpenFiles[i] = false;
-        if (myRoot[i].cPath[0] != '/') {
-            myFsEmpty[i] = true;
-        } else {
-            myFsEmpty[i] = false;
-            iCounterFiles++;
+/// rebuilds myDmapSummary from myDmap, bits of blocks beyond the data segment are cleared first
+void MyOnDiskFS::buildDmapSummary() {
+    for (size_t i = this->blocks4DATA; i < myDmap.size() * 64; i++) {
+        myDmap[i / 64] &= ~(1ULL << (i % 64));
+    }
+
+    myDmapSummary.assign((myDmap.size() + 63) / 64, 0);
+    for (size_t word = 0; word < myDmap.size(); word++) {
+        if (myDmap[word] != 0) {
+            myDmapSummary[word / 64] |= 1ULL << (word % 64);
         }
     }
-    iCounterOpen = 0;
+}
 
-    //LOG("initialized myFsEmpty, myFsOpenFiles, iCounterOpen, iCounterFiles");
+/// checks that a block size is a power of two between BLOCK_SIZE and MAX_BLOCK_SIZE
+bool MyOnDiskFS::isValidBlockSize(uint32_t blockSize) {
+    return blockSize >= BLOCK_SIZE && blockSize <= MAX_BLOCK_SIZE && (blockSize & (blockSize - 1)) == 0;
 }
 
-int MyOnDiskFS::containerFull(size_t neededBlocks) {
-    //LOGM();
-    readSuperBlock();
-    //LOGF("numFreeBlocks %ld ; %ld", mySuperBlock.numFreeBlocks, neededBlocks);
-    if (mySuperBlock.numFreeBlocks >= neededBlocks) {
-        RETURN(0);
+/// checks that the blocks of a file up to a position have logical block numbers, see MAX_FILE_BLOCKS
+/// \param end position behind the last byte of the range
+/// \return true if the range fits, false if a write or a new size that reaches it has to fail with EFBIG
+bool MyOnDiskFS::isAddressable(uint64_t end) {
+    return end <= (uint64_t) MAX_FILE_BLOCKS * this->blockSize;
+}
+
+/// reads the geometry of an existing container from its superblock
+///
+/// The superblock fits into the smallest block size, so it can be read before the block size is known. With shadow
+/// paging a crash may have torn the first superblock, then the geometry is taken from the second one, which starts the
+/// second block of the container for one of the block sizes.
+/// \param [in] path Path of the container file
+/// \param [out] superBlock Superblock of the container, with the geometry filled in for old format versions
+/// \return 0 on success, -ENOENT if the container does not exist, -EINVAL if the format is not supported,
+/// -ERRNO on other failures
+int MyOnDiskFS::readFormat(const char *path, SuperBlock *superBlock) {
+    BlockDevice device(BLOCK_SIZE);
+    int ret = device.open(path);
+    if (ret < 0) {
+        return ret;
     }
 
-    RETURN(1);
-}
+    char buffer[BLOCK_SIZE];
+    ret = device.read(0, buffer);
+    if (ret < 0) {
+        device.close();
+        return ret;
+    }
+    memcpy(superBlock, buffer, sizeof(SuperBlock));
 
-int MyOnDiskFS::iIsPathValid(const char *path, uint64_t fh) {
-    //LOGM();
-    readRoot();
-    if (fh < 0 || fh >= NUM_DIR_ENTRIES) {
-        RETURN (-155);
+    // containers without shadow paging have no second superblock, none of the candidates matches its hash there
+    if (!isCommittedSuperBlock(superBlock)) {
+        for (uint32_t blockSize = BLOCK_SIZE; blockSize <= MAX_BLOCK_SIZE; blockSize *= 2) {
+            SuperBlock second;
+            if (device.read(blockSize / BLOCK_SIZE, buffer) < 0) {
+                break;
+            }
+            memcpy(&second, buffer, sizeof(SuperBlock));
+            if (second.blockSize == blockSize && isCommittedSuperBlock(&second)) {
+                *superBlock = second;
+                break;
+            }
+        }
     }
-    if (myFsEmpty[fh]) {
-        RETURN (-156);
+    device.close();
+
+    // containers from before the block size was stored use 512 byte blocks
+    if (superBlock->blockSize == 0) {
+        superBlock->blockSize = BLOCK_SIZE;
     }
-    if (strcmp(path, myRoot[fh].cPath) == 0) {
-        RETURN (fh);
+    if (superBlock->version == 0) {
+        superBlock->numDataBlocks = NUM_DATA_BLOCKS;
+        superBlock->numDirEntries = NUM_DIR_ENTRIES;
     }
-    RETURN (-157);
+    if (superBlock->version < FORMAT_VERSION_SHADOW) {
+        superBlock->shadowPaging = 0;
+    }
+
+    if (superBlock->version > FORMAT_VERSION || !isValidBlockSize(superBlock->blockSize) ||
+        superBlock->numDataBlocks == 0 || superBlock->numDataBlocks > MAX_DATA_BLOCKS ||
+        superBlock->numDirEntries == 0 || superBlock->numDirEntries > MAX_DIR_ENTRIES || superBlock->shadowPaging > 1) {
+        return -EINVAL;
+    }
+    return 0;
 }
 
-int MyOnDiskFS::iFindEmptySpot() {
-    //LOGM();
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFsEmpty[i]) {
-            //LOGF("index %ld is free", i);
-            RETURN(i);
+/// sets up the layout of the container and an empty file system in memory
+///
+/// The container holds the superblock, the DMAP, the FAT, the LMAP, the journal, the root blocks, the name heap and the
+/// data blocks, in this order. DMAP, FAT and LMAP take as many blocks as their entries need, containers from before
+/// FORMAT_VERSION_SPARSE have no LMAP and those from before FORMAT_VERSION_JOURNAL no journal. Containers from before
+/// FORMAT_VERSION_PACKED_ROOT have one root block per directory entry and no name heap, newer ones pack the entries and
+/// have room for the longest path of every entry in the name heap. With shadow paging there are two superblocks and
+/// their two slot maps in front of the DMAP, and no journal; the regions from the DMAP to the name heap are followed by
+/// their second slots. All arrays of the file system are sized for the geometry. The block device is replaced by a
+/// plain one for the new block size, so this must happen before selectBlockDevice().
+/// \param [in] version Format version of the container, decides the layout of the DMAP and the regions it has
+/// \param [in] blockSize Block size in bytes, see isValidBlockSize()
+/// \param [in] numDataBlocks Number of data blocks, at most MAX_DATA_BLOCKS
+/// \param [in] numDirEntries Number of directory entries, at most MAX_DIR_ENTRIES
+/// \param [in] shadowPaging true for shadow slots instead of the journal, since FORMAT_VERSION_SHADOW
+void MyOnDiskFS::setGeometry(uint32_t version, uint32_t blockSize, uint32_t numDataBlocks, uint32_t numDirEntries,
+                             bool shadowPaging) {
+    this->blockSize = blockSize;
+    this->packedDmap = version >= FORMAT_VERSION_BITMAP;
+    this->sparseFiles = version >= FORMAT_VERSION_SPARSE;
+    this->shadowPaging = version >= FORMAT_VERSION_SHADOW && shadowPaging;
+    this->metadataJournal = version >= FORMAT_VERSION_JOURNAL && !this->shadowPaging;
+    this->packedRoot = version >= FORMAT_VERSION_PACKED_ROOT;
+    this->entriesPerRootBlock = this->packedRoot ? blockSize / sizeof(MyFsDirEntry) : 1;
+    this->numDirEntries = numDirEntries;
+
+    delete this->blockDevice;
+    this->blockDevice = new BlockDevice(blockSize);
+    this->blockCache = NULL;
+
+    // with the defaults: DMAP 16 blocks, FAT and LMAP 512 blocks each, journal 1108 blocks, root 8 blocks, name heap 32
+    // blocks, data starts at block 2189, with shadow paging at block 2164
+    this->blocks4DATA = numDataBlocks;
+    this->blocks4SPBlock = this->shadowPaging ? 2 : 1;
+    ulong dmapEntriesPerBlock = this->packedDmap ? blockSize * 8 : blockSize;
+    this->blocks4DMAP = (this->blocks4DATA + dmapEntriesPerBlock - 1) / dmapEntriesPerBlock;
+    this->blocks4FAT = (this->blocks4DATA * sizeof(int32_t) + blockSize - 1) / blockSize;
+    this->blocks4LMAP = this->sparseFiles ? this->blocks4FAT : 0;
+    this->blocks4ROOT = (numDirEntries + this->entriesPerRootBlock - 1) / this->entriesPerRootBlock;
+    this->blocks4NAMES = this->packedRoot ? ((size_t) numDirEntries * (NAME_LENGTH + 1) + blockSize - 1) / blockSize
+                                          : 0;
+    this->shadowDistance = this->shadowPaging ? this->blocks4DMAP + this->blocks4FAT + this->blocks4LMAP +
+                                                this->blocks4ROOT + this->blocks4NAMES : 0;
+    this->blocks4SLOTS = (this->shadowDistance + blockSize * 8 - 1) / (blockSize * 8);
+    this->blocks4JOURNAL = 0;
+    if (this->metadataJournal) {
+        // a transaction changing every metadata block fits into the empty journal, which takes as much room as the
+        // metadata itself; since FORMAT_VERSION_BOUNDED_JOURNAL it is limited, larger operations are split into steps
+        // of journalStep() blocks
+        ulong metadataBlocks = this->blocks4SPBlock + this->blocks4DMAP + this->blocks4FAT + this->blocks4LMAP +
+                               this->blocks4ROOT + this->blocks4NAMES;
+        size_t maxTransaction = sizeof(JournalTransaction) + metadataBlocks * (sizeof(JournalRecord) + blockSize);
+        this->blocks4JOURNAL = 1 + (maxTransaction + blockSize - 1) / blockSize;
+        if (version >= FORMAT_VERSION_BOUNDED_JOURNAL) {
+            this->blocks4JOURNAL = std::min(this->blocks4JOURNAL, (ulong) (JOURNAL_MAX_SIZE / blockSize));
         }
     }
-    //LOG("NOT EMPTY BY FUNC");
-    RETURN(-ENOSPC);
-}
 
-int MyOnDiskFS::allocateBlocks(int32_t numBlocks2Allocate, uint64_t fileHandle) {
-    readFat();
-    readRoot();
+    this->posSPBlock = 0;
+    this->posSLOTS = this->posSPBlock + this->blocks4SPBlock;
+    this->posDMAP = this->posSLOTS + 2 * this->blocks4SLOTS;
+    this->posFAT = this->posDMAP + this->blocks4DMAP;
+    this->posLMAP = this->posFAT + this->blocks4FAT;
+    this->posJOURNAL = this->posLMAP + this->blocks4LMAP;
+    this->posROOT = this->posJOURNAL + this->blocks4JOURNAL;
+    this->posNAMES = this->posROOT + this->blocks4ROOT;
+    this->posDATA = this->posNAMES + this->blocks4NAMES + this->shadowDistance;
+    this->posENDofDATA = this->posDATA + this->blocks4DATA;
 
-    u_int64_t tmpBlock = 0;
-    u_int64_t iterBlock = 0;
-    //LOGF("numBlocks2Allocate = %ld", numBlocks2Allocate);
+    //initialise superblock
+    memset(&mySuperBlock, 0, sizeof(SuperBlock));
+    mySuperBlock.infoSize = this->posDATA;
+    mySuperBlock.dataSize = (size_t) this->blocks4DATA * blockSize;
+    mySuperBlock.blockPos = this->posSPBlock;
+    mySuperBlock.dataPos = this->posDATA;
+    mySuperBlock.dmapPos = this->posDMAP;
+    mySuperBlock.rootPos = this->posROOT;
+    mySuperBlock.fatPos = this->posFAT;
+    mySuperBlock.lmapPos = this->sparseFiles ? this->posLMAP : 0;
+    mySuperBlock.journalPos = this->metadataJournal ? this->posJOURNAL : 0;
+    mySuperBlock.shadowPaging = this->shadowPaging ? 1 : 0;
+    mySuperBlock.slotMapPos = this->shadowPaging ? this->posSLOTS : 0;
+    mySuperBlock.namesPos = this->packedRoot ? this->posNAMES : 0;
+    mySuperBlock.numFreeBlocks = this->blocks4DATA;
+    mySuperBlock.blockSize = blockSize;
+    mySuperBlock.version = version;
+    mySuperBlock.numDataBlocks = numDataBlocks;
+    mySuperBlock.numDirEntries = numDirEntries;
 
-    //enough space in container?
-    if (containerFull(numBlocks2Allocate)) {
-        RETURN(-ENOSPC);
-    }
+    //initialise heap structures
+    myDmap.assign(this->packedDmap ? this->blocks4DMAP * blockSize / sizeof(uint64_t) : (this->blocks4DATA + 63) / 64,
+                  ~0ULL);
+    buildDmapSummary();
+    buildFreeExtents();
+    this->allocCursor = 0;
+    myFAT.assign(this->blocks4FAT * blockSize / sizeof(int32_t), -1);
+    myLogical.assign(this->sparseFiles ? this->blocks4LMAP * blockSize / sizeof(int32_t) : this->blocks4DATA, -1);
+
+    MyFsDiskInfo emptyEntry;
+    memset(&emptyEntry, 0, sizeof(MyFsDiskInfo));
+    emptyEntry.data = POS_NULLPTR;
+    myRoot.assign(numDirEntries, emptyEntry);
+    myPathIndex.clear();
+    myNames.assign((size_t) this->blocks4NAMES * blockSize, 0);
+    myNameOffsets.assign(numDirEntries, 0);
+    myNameLengths.assign(numDirEntries, 0);
+    this->namesEnd = 0;
 
-    //empty file?
-    if (myRoot[fileHandle].data == POS_NULLPTR) {
-        int32_t startFAT = findFreeBlock();
-        if (startFAT >= ERROR_BLOCKNUMBER) {
-            RETURN(-ENOSPC);
+    iCounterFiles = iCounterOpen = 0;
+    myFsEmpty.assign(numDirEntries, true);
+    myFsOpenFiles.assign(numDirEntries, false);
+    myCursors.resize(numDirEntries);
+    myReadahead.resize(numDirEntries);
+    myDelayed.assign(numDirEntries, DelayedWrite());
+    this->reservedBlocks = 0;
+    this->pendingBlocks = 0;
+    myExtents.assign(numDirEntries, std::vector<Extent>());
+    myExtentsValid.assign(numDirEntries, false);
+    for (int i = 0; i < this->numDirEntries; i++) {
+        invalidateCursor(i);
+        resetReadahead(i);
+    }
+
+    //nothing has been written yet, so every metadata block is dirty
+    mySuperBlockDirty = true;
+    myDmapDirty.assign(this->blocks4DMAP, true);
+    myFatDirty.assign(this->blocks4FAT, true);
+    myLogicalDirty.assign(this->blocks4LMAP, true);
+    myRootDirty.assign(this->blocks4ROOT, true);
+    myNamesDirty.assign(this->blocks4NAMES, true);
+    myLazyTimes.assign(numDirEntries, false);
+    this->lazyTimesPending = false;
+    myJournalRanges.clear();
+    this->journalBytes = sizeof(JournalTransaction);
+    this->journalSequence = 1;
+    this->journalHead = 1;
+    mySlots.assign(this->blocks4SLOTS * blockSize / sizeof(uint64_t), 0);
+    this->uncommitted = false;
+
+    // partly read or written blocks of readRun() and writeRun(), aligned for block devices doing direct I/O
+    free(this->headBuffer);
+    free(this->tailBuffer);
+    void *head = NULL;
+    void *tail = NULL;
+    if (posix_memalign(&head, std::max(blockSize, 4096u), blockSize) != 0) {
+        head = malloc(blockSize);
+    }
+    if (posix_memalign(&tail, std::max(blockSize, 4096u), blockSize) != 0) {
+        tail = malloc(blockSize);
+    }
+    this->headBuffer = (char *) head;
+    this->tailBuffer = (char *) tail;
+}
+
+/// replaces the default block device by the backend chosen with the mount options and puts a BlockCache in front of it,
+/// must be called before the container file is opened
+/// \param fsInfo mount options
+void MyOnDiskFS::selectBlockDevice(MyFsInfo *fsInfo) {
+    BlockDevice *device = NULL;
+
+    if (fsInfo->backend == NULL || strcmp(fsInfo->backend, "pread") == 0) {
+        LOG("Using pread block device");
+    } else if (strcmp(fsInfo->backend, "uring") == 0) {
+        unsigned queueDepth = fsInfo->queueDepth > 0 ? fsInfo->queueDepth : URING_QUEUE_DEPTH;
+        UringBlockDevice *uring = new UringBlockDevice(this->blockSize, queueDepth);
+        if (uring->usesRing()) {
+            LOGF("Using io_uring block device with %u entries", queueDepth);
+        } else {
+            LOG("WARNING: io_uring not available, using pread block device");
         }
-        myRoot[fileHandle].data = startFAT;
-        numBlocks2Allocate--;
+        device = uring;
+    } else if (strcmp(fsInfo->backend, "mmap") == 0) {
+        LOG("Using memory mapped block device");
+        device = new MmapBlockDevice(this->blockSize, this->posENDofDATA);
+    } else if (strcmp(fsInfo->backend, "direct") == 0) {
+        LOG("Using direct I/O block device");
+        device = new DirectBlockDevice(this->blockSize);
+    } else {
+        LOGF("WARNING: unknown backend %s, using pread block device", fsInfo->backend);
     }
 
-    iterBlock = myRoot[fileHandle].data;
-    int32_t endFAT = 0;
+    if (device != NULL) {
+        delete this->blockDevice;
+        this->blockDevice = device;
+    }
 
-    while (tmpBlock != -1) {
-        tmpBlock = myFAT[iterBlock];
-        if (tmpBlock == -1) {
-            endFAT = iterBlock;
-            break;
+    if (!fsInfo->noCache) {
+        // the default keeps the memory used by the cache independent of the block size
+        unsigned cacheSize = fsInfo->cacheSize > 0 ? fsInfo->cacheSize
+                                                   : std::max(BLOCK_CACHE_SIZE * BLOCK_SIZE / this->blockSize, 64u);
+        const char *policy = fsInfo->cachePolicy != NULL ? fsInfo->cachePolicy : "clock";
+        LOGF("Caching %u blocks, %s replacement", cacheSize, policy);
+        this->blockCache = new BlockCache(this->blockDevice, cacheSize, policy);
+        this->blockDevice = this->blockCache;
+
+        if (fsInfo->writeBack) {
+            unsigned dirtyRatio = fsInfo->dirtyRatio > 0 ? fsInfo->dirtyRatio : BLOCK_CACHE_DIRTY_RATIO;
+            unsigned dirtyExpire = fsInfo->dirtyExpire > 0 ? fsInfo->dirtyExpire : BLOCK_CACHE_DIRTY_EXPIRE;
+            LOGF("Write-back cache, flushing at %u%% dirty blocks or after %u ms", dirtyRatio, dirtyExpire);
+            this->blockCache->enableWriteBack(dirtyRatio, dirtyExpire);
         }
-        iterBlock = tmpBlock;
+    } else if (fsInfo->writeBack) {
+        LOG("WARNING: writeback needs the block cache, writing through");
     }
+}
 
-    int32_t addFAT = endFAT;
-    //LOG("getting needed blocks");
-    for (int i = 0; i < numBlocks2Allocate; i++) {
-        tmpBlock = findFreeBlock();
-        //LOGF("Reserved tmpBlock = %ld block", tmpBlock);
-        if (tmpBlock >= ERROR_BLOCKNUMBER) {
-            //LOG("can't find free block. THIS SHOULD NOT OCCUR!");
-            RETURN(-ENOSPC);
+void MyOnDiskFS::initializeHelpers() {
+    //LOGM();
+    for (int i = 0; i < this->numDirEntries; i++) {
+        myFsOpenFiles[i] = false;
+        if (myRoot[i].cPath[0] != '/') {
+            myFsEmpty[i] = true;
+        } else {
+            myFsEmpty[i] = false;
+            myPathIndex[myRoot[i].cPath] = i;
+            iCounterFiles++;
         }
-
-        //LOGF("i = %ld, iterBlock = %ld, tmpBlock = %ld", i, addFAT, tmpBlock);
-        myFAT[addFAT] = (int32_t) tmpBlock;
-        //LOGF("iterBlock = %ld, myFAT[iterBlock] = %ld", addFAT, myFAT[addFAT]);
-        // Set next Block
-        addFAT = myFAT[addFAT];
-        //LOGF("iterBlock = %ld, myFAT[iterBlock] = %ld (Should be 0xFF (4.294.967.295) since it should be a free area)", addFAT, myFAT[addFAT]);
     }
+    iCounterOpen = 0;
 
-    writeFat();
-    writeRoot();
+    //LOG("initialized myFsEmpty, myFsOpenFiles, iCounterOpen, iCounterFiles");
+}
 
-    RETURN(1);
+/// marks the superblock for the next writeSuperBlock(), or logs it in containers with a journal
+void MyOnDiskFS::markSuperBlockDirty() {
+    if (this->metadataJournal) {
+        logChange(this->posSPBlock, 0, sizeof(SuperBlock));
+    } else {
+        mySuperBlockDirty = true;
+        noteChange();
+    }
 }
 
-int MyOnDiskFS::readSuperBlock() {
-    // Allocate a buffer for the SuperBlock
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
+/// marks the DMAP block holding the entry of data block "blockNo" for the next writeDmap(), or logs the entry in
+/// containers with a journal
+/// \param blockNo index of the data block, 0 being the start of the data segment
+void MyOnDiskFS::markDmapDirty(size_t blockNo) {
+    if (this->metadataJournal) {
+        // containers with a journal always have a packed DMAP
+        size_t offset = blockNo / 64 * sizeof(uint64_t);
+        logChange(this->posDMAP + offset / this->blockSize, offset % this->blockSize, sizeof(uint64_t));
+    } else {
+        myDmapDirty[blockNo / (this->packedDmap ? this->blockSize * 8 : this->blockSize)] = true;
+        noteChange();
+    }
+}
+
+/// marks the FAT block holding the entry of data block "blockNo" for the next writeFat(), or logs the entry in
+/// containers with a journal
+/// \param blockNo index of the data block, 0 being the start of the data segment
+void MyOnDiskFS::markFatDirty(size_t blockNo) {
+    size_t offset = blockNo * sizeof(int32_t);
+    if (this->metadataJournal) {
+        logChange(this->posFAT + offset / this->blockSize, offset % this->blockSize, sizeof(int32_t));
+    } else {
+        myFatDirty[offset / this->blockSize] = true;
+        noteChange();
+    }
+}
+
+/// marks the LMAP block holding the entry of data block "blockNo" for the next writeLogical(), or logs the entry in
+/// containers with a journal
+/// \param blockNo index of the data block, 0 being the start of the data segment
+void MyOnDiskFS::markLogicalDirty(size_t blockNo) {
+    size_t offset = blockNo * sizeof(int32_t);
+    if (this->metadataJournal) {
+        logChange(this->posLMAP + offset / this->blockSize, offset % this->blockSize, sizeof(int32_t));
+    } else if (this->sparseFiles) {
+        myLogicalDirty[offset / this->blockSize] = true;
+        noteChange();
+    }
+}
+
+/// marks the root block holding directory entry "index" for the next writeRoot(), or logs the entry in containers with
+/// a journal
+/// \param index index of the directory entry
+void MyOnDiskFS::markRootDirty(size_t index) {
+    // the timestamps are written with the entry
+    myLazyTimes[index] = false;
+
+    if (this->metadataJournal) {
+        size_t entrySize = this->packedRoot ? sizeof(MyFsDirEntry) : sizeof(MyFsDiskInfo);
+        logChange(this->posROOT + index / this->entriesPerRootBlock, index % this->entriesPerRootBlock * entrySize,
+                  entrySize);
+    } else {
+        myRootDirty[index / this->entriesPerRootBlock] = true;
+        noteChange();
+    }
+}
+
+/// marks the blocks of the name heap holding the bytes [offset, offset + length) for the next writeRoot(), or logs the
+/// bytes in containers with a journal
+/// \param offset first changed byte inside the name heap
+/// \param length number of changed bytes
+void MyOnDiskFS::markNamesDirty(size_t offset, size_t length) {
+    size_t pos = offset;
+    while (pos < offset + length) {
+        size_t block = pos / this->blockSize;
+        size_t end = std::min(offset + length, (block + 1) * this->blockSize);
+        if (this->metadataJournal) {
+            logChange(this->posNAMES + block, pos % this->blockSize, end - pos);
+        } else {
+            myNamesDirty[block] = true;
+            noteChange();
+        }
+        pos = end;
+    }
+}
+
+/// puts a new path of directory entry "index" into the name heap of a packed root region, at the place of the last
+/// path of the entry if it fits there
+/// \param index index of the directory entry
+/// \param path new path of the entry
+void MyOnDiskFS::storeName(size_t index, const char *path) {
+    if (!this->packedRoot) {
+        return;
+    }
+
+    size_t length = strlen(path);
+    if (length > myNameLengths[index]) {
+        if (this->namesEnd + length > myNames.size()) {
+            compactNames(index);
+        }
+        myNameOffsets[index] = this->namesEnd;
+        this->namesEnd += length;
+    }
+    myNameLengths[index] = length;
+    memcpy(&myNames[myNameOffsets[index]], path, length);
+    markNamesDirty(myNameOffsets[index], length);
+}
+
+/// moves the paths of all directory entries except "index" together at the start of the name heap, the entries of
+/// moved paths are marked dirty
+/// \param index index of the directory entry that gets a new path
+void MyOnDiskFS::compactNames(size_t index) {
+    std::vector<char> names(myNames.size(), 0);
+    uint32_t end = 0;
+    for (size_t i = 0; i < this->numDirEntries; i++) {
+        if (i == index || myFsEmpty[i]) {
+            myNameLengths[i] = 0;
+            continue;
+        }
+        memcpy(&names[end], &myNames[myNameOffsets[i]], myNameLengths[i]);
+        if (myNameOffsets[i] != end) {
+            myNameOffsets[i] = end;
+            markRootDirty(i);
+        }
+        end += myNameLengths[i];
+    }
+    myNames.swap(names);
+    this->namesEnd = end;
+    markNamesDirty(0, end);
+}
+
+/// updates the access time of a file that is accessed, as the atime mount option asks for
+///
+/// Strict updates set the change time, too. Relatime only updates an access time that is not newer than the last
+/// modification or status change of the file, or that is older than RELATIME_INTERVAL.
+/// \param index index of the directory entry
+void MyOnDiskFS::touchAtime(size_t index) {
+    MyFsDiskInfo *info = &myRoot[index];
+    time_t now = time(NULL);
+
+    if (this->atimeMode == ATIME_NOATIME) {
+        return;
+    } else if (this->atimeMode == ATIME_RELATIME) {
+        if (info->atime > info->mtime && info->atime > info->ctime && now - info->atime < RELATIME_INTERVAL) {
+            return;
+        }
+        info->atime = now;
+    } else {
+        info->atime = info->ctime = now;
+    }
+    markTimesDirty(index);
+}
+
+/// marks directory entry "index" after only its timestamps changed, with lazytime the entry is written with the next
+/// other change of it, by fuseFsync() or by flushLazyTimes(), which runCommitter() calls between the operations
+/// \param index index of the directory entry
+void MyOnDiskFS::markTimesDirty(size_t index) {
+    if (!this->lazyTime) {
+        markRootDirty(index);
+        return;
+    }
+
+    myLazyTimes[index] = true;
+    if (!this->lazyTimesPending) {
+        this->lazyTimesPending = true;
+        myLazySince = std::chrono::steady_clock::now();
+    }
+}
+
+/// marks the directory entries whose timestamps lazytime kept in memory for the next writeRoot()
+/// \param force true to mark them before the first change is LAZYTIME_INTERVAL old
+void MyOnDiskFS::flushLazyTimes(bool force) {
+    if (!this->lazyTimesPending) {
+        return;
+    }
+    if (!force && std::chrono::steady_clock::now() - myLazySince < std::chrono::seconds(LAZYTIME_INTERVAL)) {
+        return;
+    }
+
+    // every entry is a change of its own, there may be more of them than one transaction holds
+    for (size_t i = 0; i < this->numDirEntries; i++) {
+        if (myLazyTimes[i]) {
+            if (reserveJournal(journalRecords(0)) < 0) {
+                return;
+            }
+            markRootDirty(i);
+        }
+    }
+    this->lazyTimesPending = false;
+}
+
+/// maps a block of an open file to the run of consecutive data blocks it starts
+///
+/// Sequential access is served from the extent the cursor of the file handle points to (or the one after it),
+/// everything else by a binary search in the extents of the file. The cursor is moved to the last block of the run.
+/// A block without data block starts a hole, which reaches up to the next extent of the file.
+/// \param [in] fh handle of the file, i.e. its index in myRoot
+/// \param [in] logicalBlock number of the block inside the file, 0 being the first block
+/// \param [in] maxBlocks upper limit for the length of the run
+/// \param [out] runLength number of consecutive blocks (or blocks of the hole), starting with the one returned
+/// \return index of the block inside the data segment, -1 if the block is inside a hole or behind the last block
+int32_t MyOnDiskFS::mapRun(uint64_t fh, int32_t logicalBlock, int32_t maxBlocks, int32_t *runLength) {
+    buildExtents(fh);
+
+    const std::vector<Extent> &extents = myExtents[fh];
+    FatCursor *cursor = &myCursors[fh];
+
+    int32_t index = -1;
+    if (cursor->extent >= 0) {
+        for (int32_t i = cursor->extent; i <= cursor->extent + 1 && i < (int32_t) extents.size(); i++) {
+            if (logicalBlock >= extents[i].logicalStart && logicalBlock < extents[i].logicalStart + extents[i].length) {
+                index = i;
+                break;
+            }
+        }
+    }
+    if (index < 0) {
+        index = findExtent(fh, logicalBlock);
+    }
+    if (index < 0) {
+        int32_t next = nextExtent(fh, logicalBlock);
+        *runLength = maxBlocks;
+        if (next < (int32_t) extents.size()) {
+            *runLength = std::min(maxBlocks, extents[next].logicalStart - logicalBlock);
+        }
+        return -1;
+    }
+
+    const Extent &extent = extents[index];
+    int32_t physicalBlock = extent.physicalStart + (logicalBlock - extent.logicalStart);
+    *runLength = std::min(maxBlocks, extent.logicalStart + extent.length - logicalBlock);
+
+    cursor->logicalBlock = logicalBlock + *runLength - 1;
+    cursor->physicalBlock = physicalBlock + *runLength - 1;
+    cursor->extent = index;
+    return physicalBlock;
+}
+
+/// reads a part of a run of consecutive data blocks with a single call to the block device
+///
+/// Blocks that are needed completely are read directly into the destination, only the partly needed first and last
+/// block go through a bounce buffer. If the block device provides direct access to the blocks, all bytes are copied
+/// from there instead.
+/// \param [in] runBlock index of the first block of the run inside the data segment
+/// \param [in] byteOffset position of the first byte to read inside the first block
+/// \param [out] dst buffer for the data, at least "bytes" long
+/// \param [in] bytes number of bytes to read
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::readRun(int32_t runBlock, size_t byteOffset, char *dst, size_t bytes) {
+    // block devices that map the container let us copy straight from the blocks
+    const char *blocks = this->blockDevice->blockPtr(this->posDATA + runBlock,
+                                                     (byteOffset + bytes + this->blockSize - 1) / this->blockSize);
+    if (blocks != NULL) {
+        memcpy(dst, blocks + byteOffset, bytes);
+        return 0;
+    }
+
+    char *head = this->headBuffer;
+    char *tail = this->tailBuffer;
+    struct iovec iov[3];
+    int iovcnt = 0;
+
+    size_t headBytes = 0;
+    if (byteOffset > 0 || bytes < this->blockSize) {
+        headBytes = std::min(bytes, this->blockSize - byteOffset);
+        iov[iovcnt].iov_base = head;
+        iov[iovcnt++].iov_len = this->blockSize;
+    }
+    size_t middleBytes = (bytes - headBytes) / this->blockSize * this->blockSize;
+    if (middleBytes > 0) {
+        iov[iovcnt].iov_base = dst + headBytes;
+        iov[iovcnt++].iov_len = middleBytes;
+    }
+    size_t tailBytes = bytes - headBytes - middleBytes;
+    if (tailBytes > 0) {
+        iov[iovcnt].iov_base = tail;
+        iov[iovcnt++].iov_len = this->blockSize;
+    }
+
+    int ret = this->blockDevice->readv(this->posDATA + runBlock, iov, iovcnt);
+    if (ret < 0) {
+        return ret;
+    }
+
+    memcpy(dst, head + byteOffset, headBytes);
+    memcpy(dst + headBytes + middleBytes, tail, tailBytes);
+    return 0;
+}
+
+/// writes a part of a run of consecutive data blocks with a single call to the block device
+///
+/// Blocks that are written completely are taken directly from the source. The partly written first and last block are
+/// read first if they hold data of the file, bytes behind the old end of the file are zeroed.
+/// \param [in] runBlock index of the first block of the run inside the data segment
+/// \param [in] runStart position of the first block of the run inside the file in bytes
+/// \param [in] byteOffset position of the first byte to write inside the first block
+/// \param [in] src data to write, at least "bytes" long
+/// \param [in] bytes number of bytes to write
+/// \param [in] fileSize size of the file before the write
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::writeRun(int32_t runBlock, off_t runStart, size_t byteOffset, const char *src, size_t bytes,
+                         size_t fileSize) {
+    char *head = this->headBuffer;
+    char *tail = this->tailBuffer;
+    struct iovec iov[3];
+    int iovcnt = 0;
+
+    size_t headBytes = 0;
+    if (byteOffset > 0 || bytes < this->blockSize) {
+        headBytes = std::min(bytes, this->blockSize - byteOffset);
+        int ret = readPartialBlock(runBlock, runStart, fileSize, head);
+        if (ret < 0) {
+            return ret;
+        }
+        memcpy(head + byteOffset, src, headBytes);
+        iov[iovcnt].iov_base = head;
+        iov[iovcnt++].iov_len = this->blockSize;
+    }
+    size_t middleBytes = (bytes - headBytes) / this->blockSize * this->blockSize;
+    if (middleBytes > 0) {
+        iov[iovcnt].iov_base = (void *) (src + headBytes);
+        iov[iovcnt++].iov_len = middleBytes;
+    }
+    size_t tailBytes = bytes - headBytes - middleBytes;
+    if (tailBytes > 0) {
+        int32_t tailIndex = (headBytes > 0 ? 1 : 0) + middleBytes / this->blockSize;
+        int ret = readPartialBlock(runBlock + tailIndex, runStart + (off_t) tailIndex * this->blockSize, fileSize,
+                                   tail);
+        if (ret < 0) {
+            return ret;
+        }
+        memcpy(tail, src + headBytes + middleBytes, tailBytes);
+        iov[iovcnt].iov_base = tail;
+        iov[iovcnt++].iov_len = this->blockSize;
+    }
+
+    return this->blockDevice->writev(this->posDATA + runBlock, iov, iovcnt);
+}
+
+/// reads a data block that is about to be written partly
+/// \param [in] block index of the block inside the data segment
+/// \param [in] blockStart position of the block inside the file in bytes
+/// \param [in] fileSize size of the file
+/// \param [out] buffer buffer for the block, bytes behind the end of the file are zeroed
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::readPartialBlock(int32_t block, off_t blockStart, size_t fileSize, char *buffer) {
+    memset(buffer, 0, this->blockSize);
+    if (blockStart >= (off_t) fileSize) {
+        return 0;
+    }
+
+    int ret = this->blockDevice->read(this->posDATA + block, buffer);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (fileSize - blockStart < this->blockSize) {
+        memset(buffer + (fileSize - blockStart), 0, this->blockSize - (fileSize - blockStart));
+    }
+    return 0;
+}
+
+void MyOnDiskFS::invalidateCursor(uint64_t fh) {
+    myCursors[fh].logicalBlock = -1;
+    myCursors[fh].physicalBlock = -1;
+    myCursors[fh].extent = -1;
+}
+
+void MyOnDiskFS::resetReadahead(uint64_t fh) {
+    // a new handle is expected to read from the start
+    myReadahead[fh].nextBlock = 0;
+    myReadahead[fh].window = std::max(READAHEAD_MIN_SIZE / (int32_t) this->blockSize, 1);
+    myReadahead[fh].end = 0;
+}
+
+/// prefetches the blocks that follow a sequential read of a file
+///
+/// The blocks are announced to the block device, which reads them in the background (into the block cache, or the
+/// page cache of the host). The window doubles every time the reader reaches the blocks read ahead and is halved by a
+/// read that does not continue the previous one. The next window is requested when the reader has used up half of
+/// the current one, so it arrives before it is needed.
+/// \param [in] fh File handle
+/// \param [in] logicalBlock First block inside the file that has been read
+/// \param [in] numBlocks Number of blocks that have been read
+void MyOnDiskFS::readahead(uint64_t fh, int32_t logicalBlock, int32_t numBlocks) {
+    Readahead *ra = &myReadahead[fh];
+    int32_t end = logicalBlock + numBlocks;
+    int32_t minWindow = std::max(READAHEAD_MIN_SIZE / (int32_t) this->blockSize, 1);
+    int32_t maxWindow = std::max(READAHEAD_MAX_SIZE / (int32_t) this->blockSize, 1);
+
+    if (logicalBlock != ra->nextBlock) {
+        ra->nextBlock = end;
+        ra->window = std::max(ra->window / 2, minWindow);
+        ra->end = end;
+        return;
+    }
+    ra->nextBlock = end;
+
+    if (end + ra->window / 2 < ra->end) {
+        return;
+    }
+    if (logicalBlock < ra->end) {
+        ra->window = std::min(ra->window * 2, maxWindow);
+    }
+
+    int32_t start = std::max(ra->end, end);
+    int32_t stop = std::min(start + ra->window, allocatedEnd(fh));
+    ra->end = std::max(stop, start);
+
+    // one hint per run of consecutive blocks, holes are skipped
+    for (int32_t index = std::max(nextExtent(fh, start) - 1, 0); start < stop; index++) {
+        if (index >= (int32_t) myExtents[fh].size()) {
+            break;
+        }
+        const Extent &extent = myExtents[fh][index];
+        start = std::max(start, extent.logicalStart);
+        int32_t runEnd = std::min(stop, extent.logicalStart + extent.length);
+        if (start < runEnd) {
+            this->blockDevice->advise(posDATA + extent.physicalStart + (start - extent.logicalStart), runEnd - start,
+                                      BD_ADVICE_WILLNEED);
+            start = runEnd;
+        }
+    }
+}
+
+/// keeps data written behind the allocated blocks of a file in memory, its blocks are allocated by flushDelayed()
+///
+/// Blocks for the data are reserved, so the allocation cannot fail later. Once the delayed data of the file exceeds
+/// DELALLOC_MAX_SIZE, it is flushed right away. In containers with sparse files, whole blocks in front of the data stay
+/// a hole instead of being kept as zeros.
+/// \param [in] fh File handle
+/// \param [in] src Data to write
+/// \param [in] bytes Number of bytes to write
+/// \param [in] offset Position of the data inside the file, at or behind the end of the allocated blocks
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::delayWrite(uint64_t fh, const char *src, size_t bytes, off_t offset) {
+    DelayedWrite &delayed = myDelayed[fh];
+    int32_t firstBlock = offset / this->blockSize;
+    if (this->sparseFiles && !delayed.data.empty() &&
+        firstBlock > delayed.firstBlock + (int32_t) ((delayed.data.size() + this->blockSize - 1) / this->blockSize)) {
+        int ret = flushDelayed(fh);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    if (delayed.data.empty()) {
+        delayed.firstBlock = this->sparseFiles ? std::max(allocatedEnd(fh), firstBlock) : allocatedEnd(fh);
+    }
+
+    size_t start = offset - (off_t) delayed.firstBlock * this->blockSize;
+    size_t end = start + bytes;
+    if (end > delayed.data.size()) {
+        size_t haveBlocks = (delayed.data.size() + this->blockSize - 1) / this->blockSize;
+        size_t needBlocks = (end + this->blockSize - 1) / this->blockSize;
+        if (containerFull(needBlocks - haveBlocks)) {
+            return -ENOSPC;
+        }
+        this->reservedBlocks += needBlocks - haveBlocks;
+        // a gap behind the end of the file reads as zeros
+        delayed.data.resize(end, 0);
+    }
+    memcpy(&delayed.data[start], src, bytes);
+
+    // a quarter of the blocks of one transaction, like a write that is split by fuseWrite()
+    if (delayed.data.size() >= std::min((size_t) DELALLOC_MAX_SIZE, journalStep() / 4 * this->blockSize)) {
+        return flushDelayed(fh);
+    }
+    return 0;
+}
+
+/// allocates the blocks for the delayed data of a file with a single request and writes the data
+/// \param [in] fh File handle
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::flushDelayed(uint64_t fh) {
+    DelayedWrite &delayed = myDelayed[fh];
+    if (delayed.data.empty()) {
+        return 0;
+    }
+
+    // an operation of its own, delayWrite() keeps the data below journalStep() blocks
+    int32_t numBlocks = (delayed.data.size() + this->blockSize - 1) / this->blockSize;
+    int ret = reserveJournal(journalRecords(numBlocks));
+    if (ret < 0) {
+        return ret;
+    }
+    this->reservedBlocks -= numBlocks;
+    ret = allocateBlocks(fh, delayed.firstBlock, numBlocks);
+    if (ret < 0) {
+        this->reservedBlocks += numBlocks;
+        return ret;
+    }
+
+    // whole blocks, the end of the last one is zeroed
+    delayed.data.resize((size_t) numBlocks * this->blockSize, 0);
+    const char *src = delayed.data.data();
+    int32_t logicalBlock = delayed.firstBlock;
+    while (numBlocks > 0 && ret >= 0) {
+        int32_t runLength;
+        int32_t runBlock = mapRun(fh, logicalBlock, numBlocks, &runLength);
+        if (runBlock < 0) {
+            ret = -EIO;
+            break;
+        }
+        ret = this->blockDevice->writeBlocks(this->posDATA + runBlock, runLength, src);
+        src += (size_t) runLength * this->blockSize;
+        logicalBlock += runLength;
+        numBlocks -= runLength;
+    }
+
+    // the blocks belong to the file now, even if writing them failed
+    std::vector<char>().swap(delayed.data);
+    return ret < 0 ? ret : 0;
+}
+
+/// overwrites a range of a file with zeros, one call per run of consecutive blocks
+/// \param [in] fh File handle
+/// \param [in] offset Start of the range, holes in it are skipped
+/// \param [in] bytes Length of the range
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::zeroRange(uint64_t fh, off_t offset, size_t bytes) {
+    std::vector<char> zeros(std::min(bytes, (size_t) ZERO_FILL_SIZE), 0);
+
+    while (bytes > 0) {
+        int32_t byteOffset = offset % this->blockSize;
+        int32_t logicalBlock = offset / this->blockSize;
+        size_t chunk = std::min(bytes, zeros.size());
+        int32_t runLength;
+        int32_t runBlock = mapRun(fh, logicalBlock, (chunk + byteOffset + this->blockSize - 1) / this->blockSize,
+                                  &runLength);
+
+        chunk = std::min(chunk, (size_t) runLength * this->blockSize - byteOffset);
+        if (runBlock >= 0) {
+            int ret = writeRun(runBlock, (off_t) logicalBlock * this->blockSize, byteOffset, zeros.data(), chunk,
+                               myRoot[fh].size);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        offset += chunk;
+        bytes -= chunk;
+    }
+    return 0;
+}
+
+/// zeroes the blocks a file has behind its end up to a new end, before the file grows
+///
+/// Bytes behind the end of a file may be left over from before, e.g. in its last block after it has been truncated or
+/// in blocks allocated by fuseFallocate(). Blocks that are allocated later read as zeros anyway.
+/// \param [in] fh File handle
+/// \param [in] newSize New size of the file, larger than the current one
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::zeroBehindEnd(uint64_t fh, off_t newSize) {
+    off_t fileSize = myRoot[fh].size;
+    off_t end = std::min(newSize, (off_t) allocatedEnd(fh) * this->blockSize);
+    if (end <= fileSize) {
+        return 0;
+    }
+    return zeroRange(fh, fileSize, end - fileSize);
+}
+
+/// builds the extents of a file from its FAT chain, unless they are already there
+///
+/// Blocks of the chain that are consecutive in the file and in the data segment are merged into one extent, so the
+/// number of extents grows with the fragmentation of the file, not with its size.
+/// \param fh index of the file in myRoot
+void MyOnDiskFS::buildExtents(uint64_t fh) {
+    if (myExtentsValid[fh]) {
+        return;
+    }
+
+    std::vector<Extent> &extents = myExtents[fh];
+    extents.clear();
+    myExtentsValid[fh] = true;
+
+    if (myRoot[fh].data == POS_NULLPTR) {
+        return;
+    }
+
+    for (int32_t block = myRoot[fh].data; block != -1; block = myFAT[block]) {
+        insertExtent(fh, extents.size(), myLogical[block], block, 1);
+    }
+}
+
+/// inserts consecutive blocks into the extents of a file, merged with the extents in front of and behind them where
+/// both continue each other
+/// \param fh index of the file in myRoot
+/// \param index position of the new blocks in myExtents[fh], the extents in front of it end at or before logicalBlock
+/// \param logicalBlock number of the first new block inside the file
+/// \param physicalBlock index of the first new block inside the data segment
+/// \param length number of new blocks
+void MyOnDiskFS::insertExtent(uint64_t fh, int32_t index, int32_t logicalBlock, int32_t physicalBlock,
+                              int32_t length) {
+    std::vector<Extent> &extents = myExtents[fh];
+
+    if (index > 0) {
+        Extent &prev = extents[index - 1];
+        if (prev.logicalStart + prev.length == logicalBlock && prev.physicalStart + prev.length == physicalBlock) {
+            prev.length += length;
+            // the new blocks may close the gap to the next extent
+            if (index < (int32_t) extents.size()) {
+                const Extent &next = extents[index];
+                if (prev.logicalStart + prev.length == next.logicalStart &&
+                    prev.physicalStart + prev.length == next.physicalStart) {
+                    prev.length += next.length;
+                    extents.erase(extents.begin() + index);
+                }
+            }
+            return;
+        }
+    }
+    if (index < (int32_t) extents.size()) {
+        Extent &next = extents[index];
+        if (logicalBlock + length == next.logicalStart && physicalBlock + length == next.physicalStart) {
+            next.logicalStart = logicalBlock;
+            next.physicalStart = physicalBlock;
+            next.length += length;
+            return;
+        }
+    }
+
+    Extent extent;
+    extent.logicalStart = logicalBlock;
+    extent.physicalStart = physicalBlock;
+    extent.length = length;
+    extents.insert(extents.begin() + index, extent);
+}
+
+void MyOnDiskFS::invalidateExtents(uint64_t fh) {
+    myExtents[fh].clear();
+    myExtentsValid[fh] = false;
+}
+
+/// finds the first extent of a file that starts behind a block by a binary search
+/// \param fh index of the file in myRoot
+/// \param logicalBlock number of the block inside the file, 0 being the first block
+/// \return index of the extent in myExtents[fh], the number of extents if there is none
+int32_t MyOnDiskFS::nextExtent(uint64_t fh, int32_t logicalBlock) {
+    buildExtents(fh);
+
+    const std::vector<Extent> &extents = myExtents[fh];
+    return std::upper_bound(extents.begin(), extents.end(), logicalBlock,
+            [](int32_t block, const Extent &extent) { return block < extent.logicalStart; }) - extents.begin();
+}
+
+/// finds the extent holding a block of a file by a binary search
+/// \param fh index of the file in myRoot
+/// \param logicalBlock number of the block inside the file, 0 being the first block
+/// \return index of the extent in myExtents[fh], -1 if the block is inside a hole or behind the last block
+int32_t MyOnDiskFS::findExtent(uint64_t fh, int32_t logicalBlock) {
+    // the extent in front of the first one starting behind the block holds the block (if any)
+    int32_t index = nextExtent(fh, logicalBlock) - 1;
+    if (index < 0 || logicalBlock < 0) {
+        return -1;
+    }
+
+    const Extent &extent = myExtents[fh][index];
+    if (logicalBlock >= extent.logicalStart + extent.length) {
+        return -1;
+    }
+    return index;
+}
+
+/// \param fh index of the file in myRoot
+/// \param logicalBlock number of the block inside the file, 0 being the first block
+/// \return index of the block inside the data segment, -1 if the block is inside a hole or behind the last block
+int32_t MyOnDiskFS::lookupExtent(uint64_t fh, int32_t logicalBlock) {
+    int32_t index = findExtent(fh, logicalBlock);
+    if (index < 0) {
+        return -1;
+    }
+
+    const Extent &extent = myExtents[fh][index];
+    return extent.physicalStart + (logicalBlock - extent.logicalStart);
+}
+
+/// \param fh index of the file in myRoot
+/// \return number of the block behind the last allocated block of the file, 0 if it has none
+int32_t MyOnDiskFS::allocatedEnd(uint64_t fh) {
+    buildExtents(fh);
+
+    const std::vector<Extent> &extents = myExtents[fh];
+    if (extents.empty()) {
+        return 0;
+    }
+    return extents.back().logicalStart + extents.back().length;
+}
+
+/// \param fh index of the file in myRoot
+/// \return number of blocks in the FAT chain of the file
+int32_t MyOnDiskFS::allocatedBlocks(uint64_t fh) {
+    buildExtents(fh);
+
+    int32_t numBlocks = 0;
+    for (size_t i = 0; i < myExtents[fh].size(); i++) {
+        numBlocks += myExtents[fh][i].length;
+    }
+    return numBlocks;
+}
+
+int MyOnDiskFS::containerFull(size_t neededBlocks) {
+    //LOGM();
+    //LOGF("numFreeBlocks %ld ; %ld", mySuperBlock.numFreeBlocks, neededBlocks);
+    // blocks promised to delayed writes and blocks freed in the running transaction are not available
+    if (mySuperBlock.numFreeBlocks >= neededBlocks + this->reservedBlocks + this->pendingBlocks) {
+        RETURN(0);
+    }
+
+    RETURN(1);
+}
+
+int MyOnDiskFS::iIsPathValid(const char *path, uint64_t fh) {
+    //LOGM();
+    if (fh < 0 || fh >= this->numDirEntries) {
+        RETURN (-155);
+    }
+    if (myFsEmpty[fh]) {
+        RETURN (-156);
+    }
+    if (strcmp(path, myRoot[fh].cPath) == 0) {
+        RETURN (fh);
+    }
+    RETURN (-157);
+}
+
+int MyOnDiskFS::iFindEmptySpot() {
+    //LOGM();
+    for (int i = 0; i < this->numDirEntries; i++) {
+        if (myFsEmpty[i]) {
+            //LOGF("index %ld is free", i);
+            RETURN(i);
+        }
+    }
+    //LOG("NOT EMPTY BY FUNC");
+    RETURN(-ENOSPC);
+}
+
+/// \param path Name of the file, starting with "/".
+/// \return index of the file in myRoot, -ENOENT if there is no such file
+int MyOnDiskFS::iFindFileIndex(const char *path) {
+    std::unordered_map<std::string, int>::iterator it = myPathIndex.find(path);
+    if (it == myPathIndex.end()) {
+        return -ENOENT;
+    }
+    return it->second;
+}
+
+/// looks for the holes in a range of a file, they lie in front of, between and behind the extents
+///
+/// Containers without sparse files cannot have holes, there the range starts at the end of the chain at the latest.
+/// \param [in] fileHandle index of the file in myRoot
+/// \param [in] logicalBlock number of the first block of the range inside the file
+/// \param [in] numBlocks number of blocks in the range
+/// \param [out] holes the first block and the length of every hole are appended
+/// \return number of blocks that are needed to fill the holes
+size_t MyOnDiskFS::findHoles(uint64_t fileHandle, int32_t logicalBlock, int32_t numBlocks,
+                             std::vector<std::pair<int32_t, int32_t>> *holes) {
+    std::vector<Extent> &extents = myExtents[fileHandle];
+
+    if (!this->sparseFiles && logicalBlock > allocatedEnd(fileHandle)) {
+        numBlocks += logicalBlock - allocatedEnd(fileHandle);
+        logicalBlock = allocatedEnd(fileHandle);
+    }
+
+    size_t neededBlocks = 0;
+    int32_t block = logicalBlock;
+    while (block < logicalBlock + numBlocks) {
+        int32_t index = findExtent(fileHandle, block);
+        if (index >= 0) {
+            block = extents[index].logicalStart + extents[index].length;
+            continue;
+        }
+        int32_t next = nextExtent(fileHandle, block);
+        int32_t holeEnd = logicalBlock + numBlocks;
+        if (next < (int32_t) extents.size()) {
+            holeEnd = std::min(holeEnd, extents[next].logicalStart);
+        }
+        holes->push_back(std::make_pair(block, holeEnd - block));
+        neededBlocks += holeEnd - block;
+        block = holeEnd;
+    }
+    return neededBlocks;
+}
+
+/// allocates blocks for the holes in a range of a file and links them into its FAT chain
+///
+/// Each hole gets as few runs of consecutive blocks as possible. They are looked for behind the block in front of the
+/// hole, at the same distance as inside the file, so a hole that is filled piece by piece still ends up consecutive.
+/// The holes are the ones findHoles() returns.
+/// \param [in] fileHandle index of the file in myRoot
+/// \param [in] logicalBlock number of the first block of the range inside the file
+/// \param [in] numBlocks number of blocks in the range
+/// \param [out] filled if not NULL, the first block and the length of every hole that has been filled are appended
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::allocateBlocks(uint64_t fileHandle, int32_t logicalBlock, int32_t numBlocks,
+                               std::vector<std::pair<int32_t, int32_t>> *filled) {
+    //LOGF("numBlocks = %ld", numBlocks);
+    std::vector<Extent> &extents = myExtents[fileHandle];
+
+    std::vector<std::pair<int32_t, int32_t>> holes;
+    size_t neededBlocks = findHoles(fileHandle, logicalBlock, numBlocks, &holes);
+    if (holes.empty()) {
+        return 0;
+    }
+
+    //enough space in container?
+    if (containerFull(neededBlocks)) {
+        RETURN(-ENOSPC);
+    }
+
+    for (size_t i = 0; i < holes.size(); i++) {
+        int32_t start = holes[i].first;
+        int32_t remaining = holes[i].second;
+        while (remaining > 0) {
+            // the chain continues from the extent in front of the blocks to the one behind them
+            int32_t index = nextExtent(fileHandle, start);
+            int32_t prevBlock = -1;
+            int64_t goal = -1;
+            if (index > 0) {
+                const Extent &prev = extents[index - 1];
+                prevBlock = prev.physicalStart + prev.length - 1;
+                goal = (int64_t) prevBlock + 1 + (start - (prev.logicalStart + prev.length));
+            }
+            int32_t nextBlock = index < (int32_t) extents.size() ? extents[index].physicalStart : -1;
+
+            int32_t length;
+            size_t runStart = allocateExtent(remaining, goal < (int64_t) this->blocks4DATA ? goal : -1, &length);
+            if (runStart >= ERROR_BLOCKNUMBER) {
+                //LOG("can't find free block. THIS SHOULD NOT OCCUR!");
+                RETURN(-ENOSPC);
+            }
+
+            //link the run into the chain
+            if (prevBlock == -1) {
+                myRoot[fileHandle].data = runStart;
+                markRootDirty(fileHandle);
+            } else {
+                myFAT[prevBlock] = (int32_t) runStart;
+                markFatDirty(prevBlock);
+            }
+            for (int32_t b = 0; b < length; b++) {
+                myFAT[runStart + b] = b < length - 1 ? runStart + b + 1 : nextBlock;
+                markFatDirty(runStart + b);
+                myLogical[runStart + b] = start + b;
+                markLogicalDirty(runStart + b);
+            }
+
+            insertExtent(fileHandle, index, start, runStart, length);
+            start += length;
+            remaining -= length;
+        }
+        if (filled != NULL) {
+            filled->push_back(holes[i]);
+        }
+    }
+
+    // extents may have been merged, the cursor could point to the wrong one
+    invalidateCursor(fileHandle);
+
+    writeSuperBlock();
+    writeDmap();
+    writeFat();
+    writeLogical();
+    writeRoot();
+
+    return 0;
+}
+
+/// frees the blocks in a range of a file and removes them from its FAT chain, the range becomes a hole
+///
+/// With journal or shadow paging the blocks are only empty in the running transaction, until it is committed they
+/// wait in myPendingFrees. A crash before would bring back the committed chain, which still holds them.
+/// \param [in] fileHandle index of the file in myRoot
+/// \param [in] logicalBlock number of the first block of the range inside the file
+/// \param [in] numBlocks number of blocks in the range, INT32_MAX for all blocks up to the end of the file
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::releaseBlocks(uint64_t fileHandle, int32_t logicalBlock, int32_t numBlocks) {
+    buildExtents(fileHandle);
+
+    std::vector<Extent> &extents = myExtents[fileHandle];
+    int64_t rangeEnd = (int64_t) logicalBlock + numBlocks;
+
+    // the parts of the extents in front of and behind the range are kept
+    std::vector<Extent> kept;
+    bool freed = false;
+    for (size_t i = 0; i < extents.size(); i++) {
+        const Extent &extent = extents[i];
+        int64_t extentEnd = (int64_t) extent.logicalStart + extent.length;
+        int32_t cutStart = std::max(extent.logicalStart, logicalBlock);
+        int32_t cutEnd = (int32_t) std::min(extentEnd, rangeEnd);
+        if (cutStart >= cutEnd) {
+            kept.push_back(extent);
+            continue;
+        }
+
+        if (extent.logicalStart < cutStart) {
+            Extent front = extent;
+            front.length = cutStart - extent.logicalStart;
+            kept.push_back(front);
+        }
+
+        int32_t firstFreed = extent.physicalStart + (cutStart - extent.logicalStart);
+        for (int32_t block = firstFreed; block < firstFreed + (cutEnd - cutStart); block++) {
+            setFreeBlock(block, true);
+            myFAT[block] = -1;
+            markFatDirty(block);
+            myLogical[block] = -1;
+            markLogicalDirty(block);
+        }
+        if (this->metadataJournal || this->shadowPaging) {
+            myPendingFrees.push_back(std::make_pair(firstFreed, cutEnd - cutStart));
+            this->pendingBlocks += cutEnd - cutStart;
+        } else {
+            addFreeExtent(firstFreed, cutEnd - cutStart);
+        }
+        mySuperBlock.numFreeBlocks += cutEnd - cutStart;
+        freed = true;
+
+        if (cutEnd < extentEnd) {
+            Extent back;
+            back.logicalStart = cutEnd;
+            back.physicalStart = firstFreed + (cutEnd - cutStart);
+            back.length = extentEnd - cutEnd;
+            kept.push_back(back);
+        }
+    }
+    if (!freed) {
+        return 0;
+    }
+    extents.swap(kept);
+    markSuperBlockDirty();
+
+    // link the blocks in front of the range to the ones behind it
+    int32_t index = nextExtent(fileHandle, logicalBlock);
+    int32_t nextBlock = index < (int32_t) extents.size() ? extents[index].physicalStart : -1;
+    if (index == 0) {
+        myRoot[fileHandle].data = nextBlock >= 0 ? nextBlock : POS_NULLPTR;
+        markRootDirty(fileHandle);
+    } else {
+        int32_t prevBlock = extents[index - 1].physicalStart + extents[index - 1].length - 1;
+        myFAT[prevBlock] = nextBlock;
+        markFatDirty(prevBlock);
+    }
+    invalidateCursor(fileHandle);
+
+    writeSuperBlock();
+    writeDmap();
+    writeFat();
+    writeLogical();
+    writeRoot();
+
+    return 0;
+}
+
+int MyOnDiskFS::readSuperBlock() {
+    // Allocate a buffer for the SuperBlock
+    char *buffer = (char *) malloc(this->blockSize);
+    memset(buffer, 0, this->blockSize);
+
+    if (this->shadowPaging) {
+        // the superblock of the last commit is the one with the higher generation, a torn one does not match its hash
+        SuperBlock copies[2];
+        int current = -1;
+        for (int copy = 0; copy < 2; copy++) {
+            if (this->blockDevice->read(this->posSPBlock + copy, buffer) < 0) {
+                continue;
+            }
+            memcpy(&copies[copy], buffer, sizeof(SuperBlock));
+            if (!isCommittedSuperBlock(&copies[copy])) {
+                continue;
+            }
+            if (current < 0 || copies[copy].generation > copies[current].generation) {
+                current = copy;
+            }
+        }
+        free(buffer);
+        if (current < 0) {
+            RETURN(-EIO);
+        }
+        mySuperBlock = copies[current];
+        mySuperBlockDirty = false;
+
+        // the slot map of a superblock is in the region with the same number
+        int ret = readMetadata(this->posSLOTS + current * this->blocks4SLOTS, this->blocks4SLOTS,
+                               (char *) mySlots.data());
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        return 0;
+    }
 
     int ret = this->blockDevice->read(this->posSPBlock, buffer);
     if (ret >= 0) {
@@ -1144,168 +2907,934 @@ int MyOnDiskFS::readSuperBlock() {
             free(buffer);
             RETURN(-300);
         }
+        mySuperBlockDirty = false;
+    }
+    // Free the buffer
+    free(buffer);
+
+    return 0;
+}
+
+int MyOnDiskFS::writeSuperBlock() {
+    // Nothing changed since the last write, with shadow paging commitShadow() writes it
+    if (!mySuperBlockDirty || this->shadowPaging) {
+        return 0;
+    }
+
+    char *buffer = (char *) malloc(this->blockSize);
+    memset(buffer, 0, this->blockSize);
+
+    memcpy(buffer, &mySuperBlock, sizeof(SuperBlock));
+
+    int ret = this->blockDevice->write(this->posSPBlock, buffer);
+    if (ret < 0) {
+        // Free the buffer
+        free(buffer);
+        RETURN(ret);
+    }
+    mySuperBlockDirty = false;
+
+    // Free the buffer
+    free(buffer);
+
+    return 0;
+}
+
+/// reads consecutive metadata blocks, with few calls to the block device even for large containers
+/// \param pos first block of the region
+/// \param numBlocks number of blocks of the region
+/// \param data buffer for the content of the blocks, at least numBlocks blocks long
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::readMetadata(ulong pos, ulong numBlocks, char *data) {
+    ulong i = 0;
+    while (i < numBlocks) {
+        // with shadow paging only blocks in the same slot are consecutive in the container
+        ulong address = metadataAddress(pos + i);
+        ulong count = 1;
+        while (i + count < numBlocks && count < METADATA_BATCH_BLOCKS &&
+               metadataAddress(pos + i + count) == address + count) {
+            count++;
+        }
+        int ret = this->blockDevice->readBlocks(address, count, data + i * this->blockSize);
+        if (ret < 0) {
+            return ret;
+        }
+        i += count;
+    }
+    return 0;
+}
+
+/// writes the dirty blocks of a metadata region, consecutive ones with a single call, and clears their flags
+/// \param pos first block of the region
+/// \param dirty dirty flag per block of the region
+/// \param data content of the region
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::writeMetadata(ulong pos, std::vector<bool> &dirty, const char *data) {
+    ulong i = 0;
+    while (i < dirty.size()) {
+        if (!dirty[i]) {
+            i++;
+            continue;
+        }
+
+        ulong end = i + 1;
+        while (end < dirty.size() && dirty[end] && end - i < METADATA_BATCH_BLOCKS) {
+            end++;
+        }
+        int ret = this->blockDevice->writeBlocks(pos + i, end - i, data + i * this->blockSize);
+        if (ret < 0) {
+            return ret;
+        }
+        for (ulong b = i; b < end; b++) {
+            dirty[b] = false;
+        }
+        i = end;
+    }
+    return 0;
+}
+
+int MyOnDiskFS::readDmap() {
+    // Read the blocks of the DMAP to the file system
+    if (this->packedDmap) {
+        int ret = readMetadata(this->posDMAP, this->blocks4DMAP, (char *) myDmap.data());
+        if (ret < 0) {
+            RETURN(ret);
+        }
+    } else {
+        // older containers have one byte per block, they are converted to the bitmap
+        std::vector<char> buffer((size_t) METADATA_BATCH_BLOCKS * this->blockSize);
+        std::fill(myDmap.begin(), myDmap.end(), 0);
+
+        for (ulong i = 0; i < this->blocks4DMAP; i += METADATA_BATCH_BLOCKS) {
+            ulong count = std::min(this->blocks4DMAP - i, (ulong) METADATA_BATCH_BLOCKS);
+            int ret = readMetadata(this->posDMAP + i, count, buffer.data());
+            if (ret < 0) {
+                RETURN(ret);
+            }
+            size_t first = (size_t) i * this->blockSize;
+            size_t last = std::min(first + (size_t) count * this->blockSize, (size_t) this->blocks4DATA);
+            for (size_t blockNo = first; blockNo < last; blockNo++) {
+                if (buffer[blockNo - first]) {
+                    myDmap[blockNo / 64] |= 1ULL << (blockNo % 64);
+                }
+            }
+        }
+    }
+    buildDmapSummary();
+    buildFreeExtents();
+    myDmapDirty.assign(this->blocks4DMAP, false);
+
+    return 0;
+}
+
+int MyOnDiskFS::writeDmap() {
+    // with shadow paging commitShadow() writes the changed blocks
+    if (this->shadowPaging) {
+        return 0;
+    }
+
+    // Only write blocks that changed
+    if (this->packedDmap) {
+        int ret = writeMetadata(this->posDMAP, myDmapDirty, (const char *) myDmap.data());
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        return 0;
+    }
+
+    // older containers have one byte per block
+    std::vector<char> buffer(this->blockSize);
+    for (ulong i = 0; i < this->blocks4DMAP; i++) {
+        if (!myDmapDirty[i]) {
+            continue;
+        }
+        for (size_t b = 0; b < this->blockSize; b++) {
+            size_t blockNo = (size_t) i * this->blockSize + b;
+            buffer[b] = blockNo < this->blocks4DATA && isFreeBlock(blockNo);
+        }
+        int ret = this->blockDevice->write(this->posDMAP + i, buffer.data());
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        myDmapDirty[i] = false;
     }
-    // Free the buffer
-    free(buffer);
 
     return 0;
 }
 
-int MyOnDiskFS::writeSuperBlock() {
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
+int MyOnDiskFS::readFat() {
+    int ret = readMetadata(this->posFAT, this->blocks4FAT, (char *) myFAT.data());
+    if (ret < 0) {
+        RETURN(ret);
+    }
+    myFatDirty.assign(this->blocks4FAT, false);
 
-    memcpy(buffer, &mySuperBlock, sizeof(SuperBlock));
+    return 0;
+}
 
-    int ret = this->blockDevice->write(this->posSPBlock, buffer);
+int MyOnDiskFS::writeFat() {
+    // with shadow paging commitShadow() writes the changed blocks
+    if (this->shadowPaging) {
+        return 0;
+    }
+
+    // Only write blocks that changed
+    int ret = writeMetadata(this->posFAT, myFatDirty, (const char *) myFAT.data());
     if (ret < 0) {
-        // Free the buffer
-        free(buffer);
         RETURN(ret);
     }
 
-    // Free the buffer
-    free(buffer);
+    return 0;
+}
+
+int MyOnDiskFS::readLogical() {
+    if (this->sparseFiles) {
+        int ret = readMetadata(this->posLMAP, this->blocks4LMAP, (char *) myLogical.data());
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        myLogicalDirty.assign(this->blocks4LMAP, false);
+        return 0;
+    }
+
+    // older containers have no holes, the blocks of a chain are numbered in order
+    std::fill(myLogical.begin(), myLogical.end(), -1);
+    for (size_t i = 0; i < this->numDirEntries; i++) {
+        if (myRoot[i].cPath[0] != '/' || myRoot[i].data == POS_NULLPTR) {
+            continue;
+        }
+        int32_t logicalBlock = 0;
+        for (int32_t block = myRoot[i].data; block != -1; block = myFAT[block]) {
+            myLogical[block] = logicalBlock++;
+        }
+    }
 
     return 0;
 }
 
-int MyOnDiskFS::readDmap() {
-    // Read the blocks of the DMAP to the file system
+int MyOnDiskFS::writeLogical() {
+    // older containers keep the numbers in memory only, with shadow paging commitShadow() writes the changed blocks
+    if (!this->sparseFiles || this->shadowPaging) {
+        return 0;
+    }
+
+    // Only write blocks that changed
+    int ret = writeMetadata(this->posLMAP, myLogicalDirty, (const char *) myLogical.data());
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
+    return 0;
+}
 
-    // Allocate a buffer for the DMAP
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
+int MyOnDiskFS::readRoot() {
+    if (this->packedRoot) {
+        return readPackedRoot();
+    }
 
-    for (int i = 0; i < this->blocks4DMAP; i++) {
-        int ret = this->blockDevice->read(this->posDMAP + i, buffer);
+    // every entry has a block of its own, read them in batches
+    std::vector<char> buffer((size_t) METADATA_BATCH_BLOCKS * this->blockSize);
+
+    for (ulong i = 0; i < this->blocks4ROOT; i += METADATA_BATCH_BLOCKS) {
+        ulong count = std::min(this->blocks4ROOT - i, (ulong) METADATA_BATCH_BLOCKS);
+        int ret = readMetadata(this->posROOT + i, count, buffer.data());
         if (ret < 0) {
-            // Free the buffer
-            free(buffer);
+            //LOGF("ERROR: blockDevice couldn't read Root %d", ret);
             RETURN(ret);
         }
+        for (ulong b = 0; b < count; b++) {
+            memcpy(&myRoot[i + b], buffer.data() + b * this->blockSize, sizeof(MyFsDiskInfo));
+            myRootDirty[i + b] = false;
+        }
+    }
 
-        void *retPtr = memcpy(myDmap + i * BLOCK_SIZE, buffer, BLOCK_SIZE);
-        if (retPtr == nullptr) {
-            // Free the buffer
-            free(buffer);
-            RETURN(-300);
+    return 0;
+}
+
+/// reads the packed directory entries and the part of the name heap their paths are in
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::readPackedRoot() {
+    std::vector<char> buffer((size_t) METADATA_BATCH_BLOCKS * this->blockSize);
+    this->namesEnd = 0;
+
+    for (ulong i = 0; i < this->blocks4ROOT; i += METADATA_BATCH_BLOCKS) {
+        ulong count = std::min(this->blocks4ROOT - i, (ulong) METADATA_BATCH_BLOCKS);
+        int ret = readMetadata(this->posROOT + i, count, buffer.data());
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        size_t first = (size_t) i * this->entriesPerRootBlock;
+        size_t last = std::min(first + count * this->entriesPerRootBlock, (size_t) this->numDirEntries);
+        for (size_t n = first; n < last; n++) {
+            MyFsDirEntry entry;
+            size_t pos = (n - first) / this->entriesPerRootBlock * this->blockSize +
+                         (n - first) % this->entriesPerRootBlock * sizeof(MyFsDirEntry);
+            memcpy(&entry, buffer.data() + pos, sizeof(MyFsDirEntry));
+
+            memset(&myRoot[n], 0, sizeof(MyFsDiskInfo));
+            myRoot[n].size = entry.size;
+            myRoot[n].data = entry.data;
+            myRoot[n].uid = entry.uid;
+            myRoot[n].gid = entry.gid;
+            myRoot[n].mode = entry.mode;
+            myRoot[n].atime = entry.atime;
+            myRoot[n].mtime = entry.mtime;
+            myRoot[n].ctime = entry.ctime;
+
+            // a path outside the name heap leaves the entry empty
+            bool valid = entry.nameLength <= NAME_LENGTH + 1 &&
+                         (size_t) entry.nameOffset + entry.nameLength <= myNames.size();
+            myNameOffsets[n] = entry.nameOffset;
+            myNameLengths[n] = valid ? entry.nameLength : 0;
+            this->namesEnd = std::max(this->namesEnd, myNameOffsets[n] + myNameLengths[n]);
         }
     }
+    myRootDirty.assign(this->blocks4ROOT, false);
 
-    // Free the buffer
-    free(buffer);
+    // the name heap is only read up to the last path
+    int ret = readMetadata(this->posNAMES, (this->namesEnd + this->blockSize - 1) / this->blockSize, myNames.data());
+    if (ret < 0) {
+        RETURN(ret);
+    }
+    for (size_t n = 0; n < this->numDirEntries; n++) {
+        memcpy(myRoot[n].cPath, &myNames[myNameOffsets[n]], myNameLengths[n]);
+    }
+    myNamesDirty.assign(this->blocks4NAMES, false);
 
     return 0;
 }
 
-int MyOnDiskFS::writeDmap() {
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
+int MyOnDiskFS::writeRoot() {
+    // with shadow paging commitShadow() writes the changed blocks
+    if (this->shadowPaging) {
+        return 0;
+    }
 
-    for (int i = 0; i < this->blocks4DMAP; i++) {
-        memcpy(buffer, myDmap + i * BLOCK_SIZE, BLOCK_SIZE);
-        int ret = this->blockDevice->write(this->posDMAP + i, buffer);
+    char *buffer = (char *) malloc(this->blockSize);
+
+    for (int i = 0; i < this->blocks4ROOT; i++) {
+        // Only write blocks that changed
+        if (!myRootDirty[i]) {
+            continue;
+        }
+        int ret = this->blockDevice->writeBlocks(this->posROOT + i, 1, metadataBlock(this->posROOT + i, buffer));
         if (ret < 0) {
             // Free the buffer
             free(buffer);
             RETURN(ret);
         }
+        myRootDirty[i] = false;
     }
 
     // Free the buffer
     free(buffer);
 
+    // the paths of packed entries are in the name heap
+    int ret = writeMetadata(this->posNAMES, myNamesDirty, myNames.data());
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
     return 0;
 }
 
-int MyOnDiskFS::readFat() {
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
+/// starts the commit interval with the first change of the metadata after a commit, containers without journal and
+/// shadow paging have nothing to commit
+void MyOnDiskFS::noteChange() {
+    if ((this->metadataJournal || this->shadowPaging) && !this->uncommitted) {
+        this->uncommitted = true;
+        myChangesSince = std::chrono::steady_clock::now();
+    }
+}
 
-    for (int i = 0; i < this->blocks4FAT; i++) {
-        int ret = this->blockDevice->read(this->posFAT + i, buffer);
-        if (ret < 0) {
-            // Free the buffer
-            free(buffer);
-            RETURN(ret);
+/// adds changed bytes of a metadata block to the running transaction
+///
+/// The operation has made room for its changes with reserveJournal() before, so the transaction fits into the empty
+/// journal.
+/// \param blockNo block of the container, inside one of the metadata regions
+/// \param offset first changed byte inside the block
+/// \param length number of changed bytes
+void MyOnDiskFS::logChange(ulong blockNo, size_t offset, size_t length) {
+    noteChange();
+
+    // one range per block, covering all changes inside it
+    std::pair<std::map<uint32_t, std::pair<uint32_t, uint32_t>>::iterator, bool> inserted =
+            myJournalRanges.insert(std::make_pair((uint32_t) blockNo,
+                                                  std::make_pair((uint32_t) offset, (uint32_t) (offset + length))));
+    if (inserted.second) {
+        this->journalBytes += sizeof(JournalRecord) + length;
+    } else {
+        std::pair<uint32_t, uint32_t> &range = inserted.first->second;
+        this->journalBytes -= range.second - range.first;
+        range.first = std::min(range.first, (uint32_t) offset);
+        range.second = std::max(range.second, (uint32_t) (offset + length));
+        this->journalBytes += range.second - range.first;
+    }
+}
+
+/// \param bytes size of a transaction with its header and records
+/// \return number of journal blocks the transaction takes
+ulong MyOnDiskFS::journalBlocks(size_t bytes) {
+    return (bytes + this->blockSize - 1) / this->blockSize;
+}
+
+/// \param numBlocks number of data blocks an operation allocates or frees
+/// \return number of metadata blocks the operation changes at most, with the superblock and one directory entry
+size_t MyOnDiskFS::journalRecords(size_t numBlocks) {
+    // every data block may be in a DMAP, FAT and LMAP block of its own, the blocks in front of and behind a run are
+    // linked to it in two more FAT blocks
+    return std::min(numBlocks, (size_t) this->blocks4DMAP) + std::min(numBlocks + 2, (size_t) this->blocks4FAT) +
+           std::min(numBlocks, (size_t) this->blocks4LMAP) + this->blocks4SPBlock + 1;
+}
+
+/// \param index index of the directory entry
+/// \param path new path of the entry
+/// \return number of metadata blocks storeName() changes at most for the path
+size_t MyOnDiskFS::nameRecords(size_t index, const char *path) {
+    if (!this->packedRoot) {
+        return 0;
+    }
+    size_t length = strlen(path);
+    if (length > myNameLengths[index] && this->namesEnd + length > myNames.size()) {
+        // compactNames() moves the other paths and changes their entries
+        return this->blocks4NAMES + this->blocks4ROOT;
+    }
+    // a path is shorter than a block, so it crosses at most one block boundary
+    return 2;
+}
+
+/// \return number of data blocks an operation may allocate or free at most, so its changes fit into the empty journal,
+/// MAX_FILE_BLOCKS if changing all metadata fits
+size_t MyOnDiskFS::journalStep() {
+    if (!this->metadataJournal) {
+        return MAX_FILE_BLOCKS;
+    }
+    size_t records = ((size_t) (this->blocks4JOURNAL - 1) * this->blockSize - sizeof(JournalTransaction)) /
+                     (sizeof(JournalRecord) + this->blockSize);
+    if (journalRecords(this->blocks4DATA) <= records) {
+        return MAX_FILE_BLOCKS;
+    }
+    return (records - journalRecords(0)) / 3;
+}
+
+/// makes room in the running transaction for the changes of an operation, before the operation changes anything
+///
+/// A transaction that could outgrow the journal with them is committed first, so commits only happen between
+/// operations. Operations on more than journalStep() blocks are split into several operations by their callers.
+/// \param records number of metadata blocks the operation changes at most, see journalRecords()
+/// \return 0 on success, -ENOSPC if the changes do not fit into the empty journal, -ERRNO if the commit failed
+int MyOnDiskFS::reserveJournal(size_t records) {
+    if (!this->metadataJournal) {
+        return 0;
+    }
+    size_t bytes = records * (sizeof(JournalRecord) + this->blockSize);
+    if (journalBlocks(this->journalBytes + bytes) <= this->blocks4JOURNAL - 1) {
+        return 0;
+    }
+    if (journalBlocks(sizeof(JournalTransaction) + bytes) > this->blocks4JOURNAL - 1) {
+        RETURN(-ENOSPC);
+    }
+    return commitMetadata(true);
+}
+
+/// looks for the start of a range of a file that ends at a block and holds at most maxBlocks of its data blocks, so
+/// large ranges can be freed in steps of journalStep() blocks from their end
+/// \param fh index of the file in myRoot
+/// \param first first block of the whole range
+/// \param end block behind the range
+/// \param maxBlocks number of data blocks the range may hold
+/// \return first block of the longest such range, "first" if the whole range holds at most maxBlocks data blocks
+int32_t MyOnDiskFS::stepStart(uint64_t fh, int32_t first, int32_t end, size_t maxBlocks) {
+    buildExtents(fh);
+
+    const std::vector<Extent> &extents = myExtents[fh];
+    size_t numBlocks = 0;
+    for (int32_t i = nextExtent(fh, end - 1) - 1; i >= 0; i--) {
+        int32_t extentEnd = std::min(extents[i].logicalStart + extents[i].length, end);
+        if (extentEnd <= first) {
+            break;
         }
-        void *retPtr = memcpy(((char *) myFAT) + i * BLOCK_SIZE, buffer, BLOCK_SIZE);
-        if (retPtr == nullptr) {
-            // Free the buffer
-            free(buffer);
-            RETURN(-300);
+        int32_t extentStart = std::max(extents[i].logicalStart, first);
+        if (numBlocks + (extentEnd - extentStart) > maxBlocks) {
+            return extentEnd - (int32_t) (maxBlocks - numBlocks);
         }
+        numBlocks += extentEnd - extentStart;
+    }
+    return first;
+}
+
+/// frees the data blocks of a file from a block on as an operation of its own, the file is cut there if it is longer
+///
+/// Truncating and deleting a file with more blocks than one transaction holds free them in steps from the end, each
+/// of them committed on its own if the journal fills up. After a crash in between, the file is shorter than before.
+/// \param fh index of the file in myRoot
+/// \param start first block to free, as returned by stepStart()
+/// \param maxBlocks number of data blocks behind start at most
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::releaseStep(uint64_t fh, int32_t start, size_t maxBlocks) {
+    int ret = reserveJournal(journalRecords(maxBlocks));
+    if (ret < 0) {
+        return ret;
+    }
+    ret = releaseBlocks(fh, start, INT32_MAX);
+    if (ret < 0) {
+        return ret;
     }
 
+    MyFsDiskInfo *info = &myRoot[fh];
+    if (info->size > (size_t) start * this->blockSize) {
+        info->size = (size_t) start * this->blockSize;
+        info->mtime = info->ctime = time(NULL);
+        markRootDirty(fh);
+    }
+    writeRoot();
+    commitMetadata(false);
     return 0;
 }
 
-int MyOnDiskFS::writeFat() {
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
+/// \param blockNo block of the container, inside one of the metadata regions except the journal
+/// \return block holding the committed content of blockNo, with shadow paging the second slot if the slot map says so
+ulong MyOnDiskFS::metadataAddress(ulong blockNo) {
+    if (!this->shadowPaging || blockNo < this->posDMAP || blockNo >= this->posDMAP + this->shadowDistance) {
+        return blockNo;
+    }
+    ulong index = blockNo - this->posDMAP;
+    if (mySlots[index / 64] & (1ULL << (index % 64))) {
+        return blockNo + this->shadowDistance;
+    }
+    return blockNo;
+}
+
+/// \param blockNo block of the container, inside one of the metadata regions except the journal, in its first slot
+/// \param buffer one block, used for blocks that have no image in memory
+/// \return content of the block as it is in memory
+const char *MyOnDiskFS::metadataBlock(ulong blockNo, char *buffer) {
+    if (blockNo >= this->posNAMES) {
+        return myNames.data() + (size_t) (blockNo - this->posNAMES) * this->blockSize;
+    }
+    if (blockNo >= this->posROOT && !this->packedRoot) {
+        memset(buffer, 0, this->blockSize);
+        memcpy(buffer, &myRoot[blockNo - this->posROOT], sizeof(MyFsDiskInfo));
+        return buffer;
+    }
+    if (blockNo >= this->posROOT) {
+        memset(buffer, 0, this->blockSize);
+        size_t first = (size_t) (blockNo - this->posROOT) * this->entriesPerRootBlock;
+        size_t last = std::min(first + this->entriesPerRootBlock, (size_t) this->numDirEntries);
+        for (size_t i = first; i < last; i++) {
+            MyFsDirEntry entry;
+            memset(&entry, 0, sizeof(MyFsDirEntry));
+            entry.size = myRoot[i].size;
+            entry.data = myRoot[i].data;
+            entry.uid = myRoot[i].uid;
+            entry.gid = myRoot[i].gid;
+            entry.mode = myRoot[i].mode;
+            entry.atime = myRoot[i].atime;
+            entry.mtime = myRoot[i].mtime;
+            entry.ctime = myRoot[i].ctime;
+            if (myRoot[i].cPath[0] == '/') {
+                entry.nameOffset = myNameOffsets[i];
+                entry.nameLength = myNameLengths[i];
+            }
+            memcpy(buffer + (i - first) * sizeof(MyFsDirEntry), &entry, sizeof(MyFsDirEntry));
+        }
+        return buffer;
+    }
+    if (blockNo >= this->posLMAP) {
+        return (const char *) myLogical.data() + (size_t) (blockNo - this->posLMAP) * this->blockSize;
+    }
+    if (blockNo >= this->posFAT) {
+        return (const char *) myFAT.data() + (size_t) (blockNo - this->posFAT) * this->blockSize;
+    }
+    if (blockNo >= this->posDMAP) {
+        return (const char *) myDmap.data() + (size_t) (blockNo - this->posDMAP) * this->blockSize;
+    }
+    memset(buffer, 0, this->blockSize);
+    memcpy(buffer, &mySuperBlock, sizeof(SuperBlock));
+    return buffer;
+}
+
+/// commits the changes of the metadata since the last commit
+///
+/// Changes are committed in groups: operations only commit once the first change is older than the commit interval or
+/// the transaction fills JOURNAL_COMMIT_SHARE percent of the journal, fsync() and unmounting always commit. Operations
+/// check the interval when they finish, runCommitter() while the file system is idle. Containers without journal and
+/// shadow paging have written their metadata in place already.
+/// \param force true to commit before the commit interval has passed
+/// \return 0 on success, -ERRNO on failure; the changes stay uncommitted then
+int MyOnDiskFS::commitMetadata(bool force) {
+    if (!this->uncommitted) {
+        return 0;
+    }
+    // a transaction filling a good part of the journal does not wait for the interval
+    bool large = this->metadataJournal &&
+                 journalBlocks(this->journalBytes) * 100 >= (this->blocks4JOURNAL - 1) * JOURNAL_COMMIT_SHARE;
+    if (!force && !large &&
+        std::chrono::steady_clock::now() - myChangesSince < std::chrono::milliseconds(this->commitInterval)) {
+        return 0;
+    }
+
+    int ret = this->metadataJournal ? commitJournal() : commitShadow();
+    if (ret < 0) {
+        return ret;
+    }
+    this->uncommitted = false;
+    releasePendingFrees();
+
+    return 0;
+}
+
+/// commits the running transaction if the blocks an operation needs are only free once it is committed
+///
+/// Called when an operation starts, before it changes anything, so the commit does not split it.
+/// \param neededBlocks number of blocks the operation allocates at most
+void MyOnDiskFS::commitForSpace(size_t neededBlocks) {
+    if (this->pendingBlocks > 0 && containerFull(neededBlocks)) {
+        commitMetadata(true);
+    }
+}
+
+/// hands the blocks freed before the last commit to the allocator, no committed metadata points to them anymore
+void MyOnDiskFS::releasePendingFrees() {
+    for (size_t i = 0; i < myPendingFrees.size(); i++) {
+        addFreeExtent(myPendingFrees[i].first, myPendingFrees[i].second);
+    }
+    myPendingFrees.clear();
+    this->pendingBlocks = 0;
+}
+
+/// commits the changes older than the commit interval and writes due lazytime timestamps until stopCommitThread() is
+/// called
+///
+/// Runs in a thread of its own that mountContainer() starts. Without it the last changes before an idle period
+/// would stay uncommitted until the next operation; the flusher of the block cache only runs in write-back mode and
+/// knows nothing about the metadata.
+void MyOnDiskFS::runCommitter() {
+    // check a few times per interval, so changes are committed at most a quarter of it late
+    std::chrono::milliseconds tick(std::max<uint32_t>(this->commitInterval / 4, 10));
+    std::unique_lock<std::mutex> lock(this->committerLock);
+    while (!this->stopCommitter) {
+        this->committerWake.wait_for(lock, tick);
+        if (this->stopCommitter) {
+            break;
+        }
+        std::lock_guard<std::recursive_mutex> guard(this->fsLock);
+        if (this->lazyTimesPending) {
+            flushLazyTimes(false);
+            writeRoot();
+        }
+        commitMetadata(false);
+    }
+}
+
+/// stops the thread running runCommitter() and waits for it to finish, if there is one
+void MyOnDiskFS::stopCommitThread() {
+    if (!this->committer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->committerLock);
+        this->stopCommitter = true;
+    }
+    this->committerWake.notify_all();
+    this->committer.join();
+}
 
-    for (int i = 0; i < this->blocks4FAT; i++) {
-        memcpy(buffer, ((char *) myFAT) + i * BLOCK_SIZE, BLOCK_SIZE);
-        int ret = this->blockDevice->write(this->posFAT + i, buffer);
+/// writes the changes since the last commit as one transaction to the journal
+///
+/// Data written before is made durable first, so committed metadata never points to blocks with old content. A journal
+/// without room for the transaction is checkpointed first.
+/// \return 0 on success, -ERRNO on failure; the changes stay in the running transaction then
+int MyOnDiskFS::commitJournal() {
+    // the records follow the transaction header, each with the current content of its range
+    std::vector<char> transaction(sizeof(JournalTransaction));
+    std::vector<char> buffer(this->blockSize);
+    for (std::map<uint32_t, std::pair<uint32_t, uint32_t>>::iterator it = myJournalRanges.begin();
+         it != myJournalRanges.end(); ++it) {
+        JournalRecord record;
+        record.blockNo = it->first;
+        record.offset = it->second.first;
+        record.length = it->second.second - it->second.first;
+        const char *content = metadataBlock(record.blockNo, buffer.data()) + record.offset;
+        transaction.insert(transaction.end(), (const char *) &record, (const char *) &record + sizeof(JournalRecord));
+        transaction.insert(transaction.end(), content, content + record.length);
+    }
+
+    JournalTransaction header;
+    header.magic = JOURNAL_MAGIC;
+    header.numBlocks = (transaction.size() + this->blockSize - 1) / this->blockSize;
+    header.length = transaction.size() - sizeof(JournalTransaction);
+    transaction.resize((size_t) header.numBlocks * this->blockSize, 0);
+
+    int ret = 0;
+    if (this->journalHead + header.numBlocks > this->blocks4JOURNAL) {
+        ret = checkpointJournal();
         if (ret < 0) {
-            // Free the buffer
-            free(buffer);
             RETURN(ret);
         }
     }
-    // Free the buffer
-    free(buffer);
+    header.sequence = this->journalSequence;
+    header.checksum = metadataChecksum(header.sequence, transaction.data() + sizeof(JournalTransaction), header.length);
+    memcpy(transaction.data(), &header, sizeof(JournalTransaction));
+
+    ret = this->blockDevice->sync();
+    if (ret < 0) {
+        RETURN(ret);
+    }
+    for (ulong i = 0; i < header.numBlocks; i += METADATA_BATCH_BLOCKS) {
+        ulong count = std::min(header.numBlocks - i, (ulong) METADATA_BATCH_BLOCKS);
+        ret = this->blockDevice->writeBlocks(this->posJOURNAL + this->journalHead + i, count,
+                                             transaction.data() + i * this->blockSize);
+        if (ret < 0) {
+            RETURN(ret);
+        }
+    }
+    ret = this->blockDevice->sync();
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
+    this->journalHead += header.numBlocks;
+    this->journalSequence++;
+    myJournalRanges.clear();
+    this->journalBytes = sizeof(JournalTransaction);
 
     return 0;
 }
 
-int MyOnDiskFS::readRoot() {
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
+/// writes the committed transactions of the journal to the metadata blocks and empties the journal
+///
+/// The transactions are replayed in the order of their sequence numbers, starting with the one the journal header
+/// names. A transaction with another sequence number or a checksum that does not match, i.e. an old or a torn one, ends
+/// the replay. Every changed block is written once, then the header is advanced behind the replayed transactions.
+/// A journal without header, as in a new container, is empty. fuseInit() calls this before the metadata is read, to
+/// finish the transactions committed before a crash.
+/// \return 0 on success, -ERRNO on failure
+int MyOnDiskFS::checkpointJournal() {
+    std::vector<char> transaction(this->blockSize);
+    int ret = this->blockDevice->read(this->posJOURNAL, transaction.data());
+    if (ret < 0) {
+        RETURN(ret);
+    }
+    JournalHeader header;
+    memcpy(&header, transaction.data(), sizeof(JournalHeader));
+    bool hasHeader = header.magic == JOURNAL_MAGIC;
+    if (!hasHeader) {
+        header.magic = JOURNAL_MAGIC;
+        header.reserved = 0;
+        header.sequence = this->journalSequence;
+    }
+
+    // apply the records to images of the blocks they change
+    std::map<uint32_t, std::vector<char>> images;
+    uint64_t sequence = header.sequence;
+    ulong pos = 1;
+    while (pos < this->blocks4JOURNAL) {
+        transaction.resize(this->blockSize);
+        ret = this->blockDevice->read(this->posJOURNAL + pos, transaction.data());
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        JournalTransaction head;
+        memcpy(&head, transaction.data(), sizeof(JournalTransaction));
+        if (head.magic != JOURNAL_MAGIC || head.sequence != sequence || head.numBlocks == 0 ||
+            head.numBlocks > this->blocks4JOURNAL - pos ||
+            sizeof(JournalTransaction) + head.length > (size_t) head.numBlocks * this->blockSize) {
+            break;
+        }
+        transaction.resize((size_t) head.numBlocks * this->blockSize);
+        ret = readMetadata(this->posJOURNAL + pos + 1, head.numBlocks - 1, transaction.data() + this->blockSize);
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        const char *records = transaction.data() + sizeof(JournalTransaction);
+        if (metadataChecksum(head.sequence, records, head.length) != head.checksum) {
+            break;
+        }
 
-    for (int i = 0; i < this->blocks4ROOT; i++) {
-        int ret = this->blockDevice->read(this->posROOT + i, buffer);
+        size_t i = 0;
+        while (i < head.length) {
+            JournalRecord record;
+            memcpy(&record, records + i, sizeof(JournalRecord));
+            i += sizeof(JournalRecord);
+            if (record.blockNo >= this->posDATA || record.offset + record.length > this->blockSize ||
+                i + record.length > head.length) {
+                RETURN(-EIO);
+            }
+            std::map<uint32_t, std::vector<char>>::iterator image = images.find(record.blockNo);
+            if (image == images.end()) {
+                image = images.insert(std::make_pair(record.blockNo, std::vector<char>(this->blockSize))).first;
+                ret = this->blockDevice->read(record.blockNo, image->second.data());
+                if (ret < 0) {
+                    RETURN(ret);
+                }
+            }
+            memcpy(image->second.data() + record.offset, records + i, record.length);
+            i += record.length;
+        }
+
+        pos += head.numBlocks;
+        sequence++;
+    }
+
+    // consecutive blocks with one call, durable before the transactions are dropped from the journal
+    std::vector<char> run;
+    std::map<uint32_t, std::vector<char>>::iterator it = images.begin();
+    while (it != images.end()) {
+        uint32_t first = it->first;
+        uint32_t count = 0;
+        run.clear();
+        for (; it != images.end() && it->first == first + count && count < METADATA_BATCH_BLOCKS; ++it, count++) {
+            run.insert(run.end(), it->second.begin(), it->second.end());
+        }
+        ret = this->blockDevice->writeBlocks(first, count, run.data());
         if (ret < 0) {
-            //LOGF("ERROR: blockDevice couldn't read Root %d", ret);
-            // Free the buffer
-            free(buffer);
             RETURN(ret);
         }
-        void *retPtr = memcpy(&myRoot[i], buffer, sizeof(MyFsDiskInfo));
-        if (retPtr == nullptr) {
-            //LOG("memcpy of Root failed");
-            // Free the buffer
-            free(buffer);
-            RETURN(-300);
+    }
+    if (!images.empty()) {
+        ret = this->blockDevice->sync();
+        if (ret < 0) {
+            RETURN(ret);
         }
     }
-    // Free the buffer
-    free(buffer);
+
+    this->journalSequence = sequence;
+    this->journalHead = 1;
+    if (hasHeader && pos == 1) {
+        return 0;
+    }
+
+    header.sequence = sequence;
+    transaction.assign(this->blockSize, 0);
+    memcpy(transaction.data(), &header, sizeof(JournalHeader));
+    ret = this->blockDevice->write(this->posJOURNAL, transaction.data());
+    if (ret >= 0) {
+        ret = this->blockDevice->sync();
+    }
+    if (ret < 0) {
+        RETURN(ret);
+    }
 
     return 0;
 }
 
-int MyOnDiskFS::writeRoot() {
-    char *buffer = (char *) malloc(BLOCK_SIZE);
-
-    for (int i = 0; i < this->blocks4ROOT; i++) {
-        memset(buffer, 0, BLOCK_SIZE);
-        memcpy(buffer, &myRoot[i], sizeof(MyFsDiskInfo));
-        int ret = this->blockDevice->write(this->posROOT + i, buffer);
+/// commits the changes since the last commit by writing the changed metadata blocks to their other slots
+///
+/// No block the last commit refers to is overwritten: changed blocks go to their unused slots and the new slot map to
+/// the region of the other superblock. Writing that superblock with the next generation is the commit, a crash before
+/// leaves the last commit current and mounting needs no replay. Data written before is made durable together with the
+/// slots, so committed metadata never points to blocks with old content.
+/// \return 0 on success, -ERRNO on failure; the last commit stays current and the changes stay dirty then
+int MyOnDiskFS::commitShadow() {
+    std::vector<uint64_t> slots(mySlots);
+    std::vector<char> batch((size_t) METADATA_BATCH_BLOCKS * this->blockSize);
+    std::vector<char> buffer(this->blockSize);
+    ulong batchStart = 0;
+    ulong batchCount = 0;
+    int ret;
+
+    // the regions follow each other from the DMAP on, so the dirty flags count through the slot map in order
+    std::vector<bool> *dirtyFlags[] = {&myDmapDirty, &myFatDirty, &myLogicalDirty, &myRootDirty, &myNamesDirty};
+    ulong index = 0;
+    for (int region = 0; region < 5; region++) {
+        std::vector<bool> &dirty = *dirtyFlags[region];
+        for (ulong i = 0; i < dirty.size(); i++, index++) {
+            if (!dirty[i]) {
+                continue;
+            }
+            ulong blockNo = this->posDMAP + index;
+            uint64_t bit = 1ULL << (index % 64);
+            ulong target = (slots[index / 64] & bit) ? blockNo : blockNo + this->shadowDistance;
+            slots[index / 64] ^= bit;
+
+            // blocks with consecutive targets are written with one call
+            if (batchCount > 0 && (target != batchStart + batchCount || batchCount == METADATA_BATCH_BLOCKS)) {
+                ret = this->blockDevice->writeBlocks(batchStart, batchCount, batch.data());
+                if (ret < 0) {
+                    RETURN(ret);
+                }
+                batchCount = 0;
+            }
+            if (batchCount == 0) {
+                batchStart = target;
+            }
+            memcpy(batch.data() + batchCount * this->blockSize, metadataBlock(blockNo, buffer.data()), this->blockSize);
+            batchCount++;
+        }
+    }
+    if (batchCount > 0) {
+        ret = this->blockDevice->writeBlocks(batchStart, batchCount, batch.data());
         if (ret < 0) {
-            // Free the buffer
-            free(buffer);
             RETURN(ret);
         }
     }
 
-    // Free the buffer
-    free(buffer);
+    SuperBlock superBlock = mySuperBlock;
+    superBlock.generation = mySuperBlock.generation + 1;
+    superBlock.checksum = 0;
+    superBlock.checksum = metadataChecksum(superBlock.generation, (const char *) &superBlock, sizeof(SuperBlock));
+    ulong copy = (superBlock.generation + 1) % 2;
+
+    std::vector<bool> slotMapBlocks(this->blocks4SLOTS, true);
+    ret = writeMetadata(this->posSLOTS + copy * this->blocks4SLOTS, slotMapBlocks, (const char *) slots.data());
+    if (ret < 0) {
+        RETURN(ret);
+    }
+    ret = this->blockDevice->sync();
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
+    memset(buffer.data(), 0, this->blockSize);
+    memcpy(buffer.data(), &superBlock, sizeof(SuperBlock));
+    ret = this->blockDevice->write(this->posSPBlock + copy, buffer.data());
+    if (ret < 0) {
+        RETURN(ret);
+    }
+    ret = this->blockDevice->sync();
+    if (ret < 0) {
+        RETURN(ret);
+    }
+
+    mySlots.swap(slots);
+    mySuperBlock.generation = superBlock.generation;
+    mySuperBlock.checksum = superBlock.checksum;
+    mySuperBlockDirty = false;
+    for (int region = 0; region < 5; region++) {
+        dirtyFlags[region]->assign(dirtyFlags[region]->size(), false);
+    }
 
     return 0;
 }
 
+/// FNV-1a hash of a journal transaction or a superblock, the seed goes first so the records of an old transaction do
+/// not match
+/// \param seed sequence number of the transaction or generation of the superblock
+/// \param data records of the transaction or the superblock
+/// \param length number of bytes of the data
+/// \return hash value
+uint32_t MyOnDiskFS::metadataChecksum(uint64_t seed, const char *data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ (uint8_t) (seed >> (8 * i))) * 16777619u;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t) data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/// checks that a superblock of a container with shadow paging was written completely, i.e. matches its hash
+/// \param superBlock the superblock as read from the container
+/// \return true if it is the superblock of a commit, false if it is torn or belongs to no commit
+bool MyOnDiskFS::isCommittedSuperBlock(const SuperBlock *superBlock) {
+    SuperBlock copy = *superBlock;
+    copy.checksum = 0;
+    return copy.shadowPaging == 1 &&
+           metadataChecksum(copy.generation, (const char *) &copy, sizeof(SuperBlock)) == superBlock->checksum;
+}
+
 // DO NOT EDIT ANYTHING BELOW THIS LINE!!!
 
 /// @brief Set the static instance of the file system.
@@ -1313,4 +3842,4 @@ int MyOnDiskFS::writeRoot() {
 /// Do not edit this method!
 void MyOnDiskFS::SetInstance() {
     MyFS::_instance = new MyOnDiskFS();
-}
\ No newline at end of file
+}
@@ -0,0 +1,598 @@
+//
+//  uringblockdevice.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#define __NR_io_uring_enter 426
+#define __NR_io_uring_register 427
+#endif
+#endif
+
+#include "uringblockdevice.h"
+
+// completions of synchronous transfers carry a pointer to a SyncWaiter with the lowest bit set, all other completions
+// carry a pointer to a BlockRequest
+struct SyncWaiter {
+    int result;
+    bool done;
+};
+
+#define SYNC_TAG ((uint64_t) 1)
+
+UringBlockDevice::UringBlockDevice(uint32_t blockSize, unsigned queueDepth, bool fixedFiles) : BlockDevice(blockSize) {
+    this->ringFd = -1;
+    this->useFixedFile = fixedFiles;
+    this->fileRegistered = false;
+    this->inFlight = 0;
+    this->sqEntries = 0;
+    this->cqEntries = 0;
+    this->sqRing = NULL;
+    this->sqRingSize = 0;
+    this->cqRing = NULL;
+    this->cqRingSize = 0;
+    this->sqes = NULL;
+    this->sqesSize = 0;
+
+    if (!setupRing(queueDepth))
+        teardownRing();
+}
+
+UringBlockDevice::~UringBlockDevice() {
+    std::lock_guard<std::mutex> guard(ringLock);
+
+    // requests still in flight write into buffers of the caller, wait for them before the ring goes away
+    while (this->inFlight > 0 && waitForCompletion() >= 0);
+
+    teardownRing();
+}
+
+bool UringBlockDevice::usesRing() const {
+    return this->ringFd >= 0;
+}
+
+int UringBlockDevice::open(const char *path) {
+    int ret = BlockDevice::open(path);
+    if (ret >= 0)
+        registerFile();
+
+    return ret;
+}
+
+int UringBlockDevice::create(const char *path) {
+    int ret = BlockDevice::create(path);
+    if (ret >= 0)
+        registerFile();
+
+    return ret;
+}
+
+int UringBlockDevice::close() {
+    {
+        std::lock_guard<std::mutex> guard(ringLock);
+        while (this->inFlight > 0 && waitForCompletion() >= 0);
+    }
+    unregisterFile();
+
+    return BlockDevice::close();
+}
+
+int UringBlockDevice::read(uint32_t blockNo, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = this->blockSize;
+
+    return transfer(false, blockNo, &iov, 1);
+}
+
+int UringBlockDevice::write(uint32_t blockNo, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = this->blockSize;
+
+    return transfer(true, blockNo, &iov, 1);
+}
+
+int UringBlockDevice::readBlocks(uint32_t blockNo, uint32_t numBlocks, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) numBlocks * this->blockSize;
+
+    return transfer(false, blockNo, &iov, 1);
+}
+
+int UringBlockDevice::writeBlocks(uint32_t blockNo, uint32_t numBlocks, const char *buffer) {
+    struct iovec iov;
+    iov.iov_base = (void *) buffer;
+    iov.iov_len = (size_t) numBlocks * this->blockSize;
+
+    return transfer(true, blockNo, &iov, 1);
+}
+
+int UringBlockDevice::readv(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    return transfer(false, blockNo, iov, iovcnt);
+}
+
+int UringBlockDevice::writev(uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    return transfer(true, blockNo, iov, iovcnt);
+}
+
+/// Submit one transfer and wait until it has completed. Completions of other requests that arrive in the meantime are
+/// queued for reap().
+/// \return 0 on success, -ERRNO on failure.
+int UringBlockDevice::transfer(bool write, uint32_t blockNo, const struct iovec *iov, int iovcnt) {
+    if (this->ringFd < 0) {
+        return write ? BlockDevice::writev(blockNo, iov, iovcnt) : BlockDevice::readv(blockNo, iov, iovcnt);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    SyncWaiter waiter;
+    waiter.result = 0;
+    waiter.done = false;
+
+    {
+        std::lock_guard<std::mutex> guard(ringLock);
+
+        struct io_uring_sqe *sqe = nextSqe();
+        if (sqe != NULL) {
+            prepareTransfer(sqe, write, blockNo, iov, iovcnt);
+            setUserData(sqe, (uint64_t) (uintptr_t) &waiter | SYNC_TAG);
+
+            if (submitQueued(1) == 0) {
+                // the kernel owns a pointer to waiter now, so we must not leave before it has completed
+                while (!waiter.done)
+                    waitForCompletion();
+            }
+        }
+    }
+
+    if (waiter.done && waiter.result >= 0 && (size_t) waiter.result == total)
+        return 0;
+
+    // rejected or partial transfer (e.g. beyond the end of the container file), repeat it the usual way
+    return write ? BlockDevice::writev(blockNo, iov, iovcnt) : BlockDevice::readv(blockNo, iov, iovcnt);
+}
+
+int UringBlockDevice::submit(BlockRequest **requests, int count) {
+    if (this->ringFd < 0)
+        return BlockDevice::submit(requests, count);
+
+    std::lock_guard<std::mutex> guard(ringLock);
+
+    int i = 0;
+    while (i < count) {
+        // fill the submission queue as far as possible and hand it over with one system call
+        int queued = 0;
+        struct io_uring_sqe *sqe;
+        while (i + queued < count && (sqe = nextSqe()) != NULL) {
+            prepareRequest(sqe, requests[i + queued]);
+            setUserData(sqe, (uint64_t) (uintptr_t) requests[i + queued]);
+            queued++;
+        }
+
+        int notSubmitted = submitQueued(queued);
+        if (notSubmitted > 0) {
+            // the ring refused the last requests, perform them right away
+            for (int j = i + queued - notSubmitted; j < i + queued; j++)
+                finishRequest(requests[j], -1);
+        } else if (queued == 0) {
+            finishRequest(requests[i], -1);
+            queued = 1;
+        }
+
+        i += queued;
+    }
+
+    return 0;
+}
+
+int UringBlockDevice::reap(BlockRequest **done, int minRequests, int maxRequests) {
+    if (this->ringFd < 0)
+        return BlockDevice::reap(done, minRequests, maxRequests);
+
+    std::lock_guard<std::mutex> guard(ringLock);
+
+    processCompletions();
+
+    int n = 0;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> completedGuard(completedLock);
+            while (n < maxRequests && !completed.empty()) {
+                done[n++] = completed.front();
+                completed.pop_front();
+            }
+        }
+
+        if (n >= minRequests || n >= maxRequests || this->inFlight == 0)
+            break;
+
+        int ret = waitForCompletion();
+        if (ret < 0)
+            return n > 0 ? n : ret;
+    }
+
+    return n;
+}
+
+/// Finish a request of a batch. res is the result of the completion, a transfer that did not move all bytes is
+/// repeated with BlockDevice.
+void UringBlockDevice::finishRequest(BlockRequest *req, int res) {
+    if (res >= 0 && (size_t) res == (size_t) req->numBlocks * this->blockSize)
+        req->result = 0;
+    else if (req->write)
+        req->result = BlockDevice::writeBlocks(req->blockNo, req->numBlocks, req->buffer);
+    else
+        req->result = BlockDevice::readBlocks(req->blockNo, req->numBlocks, req->buffer);
+
+    std::lock_guard<std::mutex> guard(completedLock);
+    completed.push_back(req);
+}
+
+/// Wait for at least one completion and process all available ones. ringLock must be held.
+/// \return 0 on success, -ERRNO on failure.
+int UringBlockDevice::waitForCompletion() {
+    int ret = enter(0, 1);
+    if (ret < 0)
+        return ret;
+
+    processCompletions();
+
+    return 0;
+}
+
+/// Hand over the last queued entries of the submission queue to the kernel. ringLock must be held.
+/// \return Number of entries the kernel did not accept, they have been taken back from the queue.
+int UringBlockDevice::submitQueued(unsigned queued) {
+    while (queued > 0) {
+        int ret = enter(queued, 0);
+        if (ret == -EAGAIN || ret == -EBUSY) {
+            // out of resources or completions, make room and try again
+            if (this->inFlight - queued > 0 && waitForCompletion() == 0)
+                continue;
+        }
+        if (ret <= 0) {
+            takeBackQueued(queued);
+            return queued;
+        }
+        queued -= ret;
+    }
+
+    return 0;
+}
+
+int UringBlockDevice::findRegisteredBuffer(const char *buffer, size_t length) {
+    for (size_t i = 0; i < registeredBuffers.size(); i++) {
+        const char *base = (const char *) registeredBuffers[i].iov_base;
+        if (buffer >= base && buffer + length <= base + registeredBuffers[i].iov_len)
+            return (int) i;
+    }
+
+    return -1;
+}
+
+#ifdef HAVE_IO_URING
+
+static int ioUringRegister(int fd, unsigned opcode, const void *arg, unsigned nrArgs) {
+    int ret = (int) syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+    return ret < 0 ? -errno : ret;
+}
+
+bool UringBlockDevice::setupRing(unsigned queueDepth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int) syscall(__NR_io_uring_setup, queueDepth, &params);
+    if (fd < 0)
+        return false;
+    this->ringFd = fd;
+    this->sqEntries = params.sq_entries;
+    this->cqEntries = params.cq_entries;
+
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap)
+        this->sqRingSize = this->cqRingSize = std::max(this->sqRingSize, this->cqRingSize);
+
+    this->sqRing = mmap(NULL, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+    if (this->sqRing == MAP_FAILED) {
+        this->sqRing = NULL;
+        return false;
+    }
+
+    if (singleMmap) {
+        this->cqRing = this->sqRing;
+    } else {
+        this->cqRing = mmap(NULL, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                            IORING_OFF_CQ_RING);
+        if (this->cqRing == MAP_FAILED) {
+            this->cqRing = NULL;
+            return false;
+        }
+    }
+
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqesPtr = mmap(NULL, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                         IORING_OFF_SQES);
+    if (sqesPtr == MAP_FAILED)
+        return false;
+    this->sqes = (struct io_uring_sqe *) sqesPtr;
+
+    char *sq = (char *) this->sqRing;
+    this->sqHead = (unsigned *) (sq + params.sq_off.head);
+    this->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    this->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    this->sqArray = (unsigned *) (sq + params.sq_off.array);
+
+    char *cq = (char *) this->cqRing;
+    this->cqHead = (unsigned *) (cq + params.cq_off.head);
+    this->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    this->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    this->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return true;
+}
+
+void UringBlockDevice::teardownRing() {
+    if (this->sqes != NULL)
+        munmap(this->sqes, this->sqesSize);
+    if (this->cqRing != NULL && this->cqRing != this->sqRing)
+        munmap(this->cqRing, this->cqRingSize);
+    if (this->sqRing != NULL)
+        munmap(this->sqRing, this->sqRingSize);
+    if (this->ringFd >= 0)
+        ::close(this->ringFd);
+
+    this->sqes = NULL;
+    this->cqRing = NULL;
+    this->sqRing = NULL;
+    this->ringFd = -1;
+    this->fileRegistered = false;
+}
+
+void UringBlockDevice::registerFile() {
+    if (this->ringFd < 0 || !this->useFixedFile)
+        return;
+
+    // without a registered file every transfer passes the descriptor, so a failure here is not an error
+    this->fileRegistered = ioUringRegister(this->ringFd, IORING_REGISTER_FILES, &this->contFile, 1) >= 0;
+}
+
+void UringBlockDevice::unregisterFile() {
+    if (this->ringFd < 0 || !this->fileRegistered)
+        return;
+
+    ioUringRegister(this->ringFd, IORING_UNREGISTER_FILES, NULL, 0);
+    this->fileRegistered = false;
+}
+
+int UringBlockDevice::registerBuffers(const struct iovec *iov, int iovcnt) {
+    if (this->ringFd < 0)
+        return -ENOSYS;
+
+    std::lock_guard<std::mutex> guard(ringLock);
+
+    if (!this->registeredBuffers.empty()) {
+        ioUringRegister(this->ringFd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        this->registeredBuffers.clear();
+    }
+
+    int ret = ioUringRegister(this->ringFd, IORING_REGISTER_BUFFERS, iov, iovcnt);
+    if (ret < 0)
+        return ret;
+    this->registeredBuffers.assign(iov, iov + iovcnt);
+
+    return 0;
+}
+
+int UringBlockDevice::unregisterBuffers() {
+    if (this->ringFd < 0)
+        return -ENOSYS;
+
+    std::lock_guard<std::mutex> guard(ringLock);
+
+    if (this->registeredBuffers.empty())
+        return 0;
+    this->registeredBuffers.clear();
+
+    int ret = ioUringRegister(this->ringFd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    return ret < 0 ? ret : 0;
+}
+
+/// Number of free entries in the submission queue. ringLock must be held.
+unsigned UringBlockDevice::sqRoom() {
+    unsigned head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+    return this->sqEntries - (*this->sqTail - head);
+}
+
+/// Append an entry to the submission queue. The kernel sees it after the next enter(). ringLock must be held.
+/// \return The entry, NULL if no completion can be waited for to make room.
+struct io_uring_sqe *UringBlockDevice::nextSqe() {
+    // the completion queue must never overflow, so the number of requests in flight is limited by its size
+    while (this->inFlight >= this->cqEntries) {
+        if (waitForCompletion() < 0)
+            return NULL;
+    }
+    if (sqRoom() == 0)
+        return NULL;
+
+    unsigned tail = *this->sqTail;
+    unsigned index = tail & *this->sqMask;
+    struct io_uring_sqe *sqe = &this->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    this->sqArray[index] = index;
+    __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+    this->inFlight++;
+
+    return sqe;
+}
+
+void UringBlockDevice::takeBackQueued(unsigned queued) {
+    __atomic_store_n(this->sqTail, *this->sqTail - queued, __ATOMIC_RELEASE);
+    this->inFlight -= queued;
+}
+
+void UringBlockDevice::setUserData(struct io_uring_sqe *sqe, uint64_t userData) {
+    sqe->user_data = userData;
+}
+
+void UringBlockDevice::prepareFile(struct io_uring_sqe *sqe) {
+    if (this->fileRegistered) {
+        sqe->fd = 0;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = this->contFile;
+    }
+}
+
+void UringBlockDevice::prepareTransfer(struct io_uring_sqe *sqe, bool write, uint32_t blockNo,
+                                       const struct iovec *iov, int iovcnt) {
+    prepareFile(sqe);
+    sqe->off = (uint64_t) blockNo * this->blockSize;
+
+    int bufIndex = iovcnt == 1 ? findRegisteredBuffer((const char *) iov[0].iov_base, iov[0].iov_len) : -1;
+    if (bufIndex >= 0) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t) (uintptr_t) iov[0].iov_base;
+        sqe->len = (uint32_t) iov[0].iov_len;
+        sqe->buf_index = (uint16_t) bufIndex;
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (uint64_t) (uintptr_t) iov;
+        sqe->len = (uint32_t) iovcnt;
+    }
+}
+
+void UringBlockDevice::prepareRequest(struct io_uring_sqe *sqe, BlockRequest *req) {
+    prepareFile(sqe);
+    sqe->off = (uint64_t) req->blockNo * this->blockSize;
+    sqe->addr = (uint64_t) (uintptr_t) req->buffer;
+    sqe->len = req->numBlocks * this->blockSize;
+
+    int bufIndex = findRegisteredBuffer(req->buffer, sqe->len);
+    if (bufIndex >= 0) {
+        sqe->opcode = req->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (uint16_t) bufIndex;
+    } else {
+        sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+}
+
+/// Call io_uring_enter(). ringLock must be held.
+/// \return Number of submitted entries, -ERRNO on failure.
+int UringBlockDevice::enter(unsigned toSubmit, unsigned minComplete) {
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (true) {
+        int ret = (int) syscall(__NR_io_uring_enter, this->ringFd, toSubmit, minComplete, flags, NULL, 0);
+        if (ret >= 0)
+            return ret;
+        if (errno != EINTR)
+            return -errno;
+    }
+}
+
+/// Consume all entries of the completion queue. ringLock must be held.
+void UringBlockDevice::processCompletions() {
+    unsigned head = *this->cqHead;
+    unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &this->cqes[head & *this->cqMask];
+        uint64_t userData = cqe->user_data;
+        int res = cqe->res;
+        head++;
+        // hand the entry back to the kernel before a fallback transfer takes its time
+        __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+        this->inFlight--;
+
+        if (userData & SYNC_TAG) {
+            SyncWaiter *waiter = (SyncWaiter *) (uintptr_t) (userData & ~SYNC_TAG);
+            waiter->result = res;
+            waiter->done = true;
+        } else {
+            finishRequest((BlockRequest *) (uintptr_t) userData, res);
+        }
+
+        tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+    }
+}
+
+#else
+
+// io_uring is not available on this platform, setupRing() fails and all methods use the BlockDevice implementation
+
+bool UringBlockDevice::setupRing(unsigned queueDepth) {
+    return false;
+}
+
+void UringBlockDevice::teardownRing() {
+    this->ringFd = -1;
+}
+
+void UringBlockDevice::registerFile() {
+}
+
+void UringBlockDevice::unregisterFile() {
+}
+
+int UringBlockDevice::registerBuffers(const struct iovec *iov, int iovcnt) {
+    return -ENOSYS;
+}
+
+int UringBlockDevice::unregisterBuffers() {
+    return -ENOSYS;
+}
+
+unsigned UringBlockDevice::sqRoom() {
+    return 0;
+}
+
+struct io_uring_sqe *UringBlockDevice::nextSqe() {
+    return NULL;
+}
+
+void UringBlockDevice::takeBackQueued(unsigned queued) {
+}
+
+void UringBlockDevice::setUserData(struct io_uring_sqe *sqe, uint64_t userData) {
+}
+
+void UringBlockDevice::prepareFile(struct io_uring_sqe *sqe) {
+}
+
+void UringBlockDevice::prepareTransfer(struct io_uring_sqe *sqe, bool write, uint32_t blockNo,
+                                       const struct iovec *iov, int iovcnt) {
+}
+
+void UringBlockDevice::prepareRequest(struct io_uring_sqe *sqe, BlockRequest *req) {
+}
+
+int UringBlockDevice::enter(unsigned toSubmit, unsigned minComplete) {
+    return -ENOSYS;
+}
+
+void UringBlockDevice::processCompletions() {
+}
+
+#endif
@@ -127,6 +127,12 @@ int wrap_ftruncate(const char *path, off_t offset, struct fuse_file_info *fileIn
 int wrap_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     return MyFS::Instance()->fuseCreate(path, mode, fi);
 }
+int wrap_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fileInfo) {
+    return MyFS::Instance()->fuseFallocate(path, mode, offset, length, fileInfo);
+}
+off_t wrap_lseek(const char *path, off_t offset, int whence, struct fuse_file_info *fileInfo) {
+    return MyFS::Instance()->fuseLseek(path, offset, whence, fileInfo);
+}
 void wrap_destroy(void *userdata) {
     MyFS::Instance()->fuseDestroy();
 }
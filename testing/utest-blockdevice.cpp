@@ -10,10 +10,17 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #include "tools.hpp"
 
 #include "blockdevice.h"
+#include "uringblockdevice.h"
+#include "mmapblockdevice.h"
+#include "directblockdevice.h"
+#include "blockcache.h"
 
 #define BD_PATH "/tmp/bd.bin"
 #define NUM_TESTBLOCKS 1024
@@ -21,6 +28,7 @@
 
 // Declarations of helper functions
 void bdWriteRead(BlockDevice *bd, int noBlocks= 1);
+void bdBatchWriteRead(BlockDevice *bd, char *w, char *r, int blocksPerRequest);
 
 TEST_CASE( "BD_CREATE_WRITE_READ_NEW_FILE", "[blockdevice]" ) {
     
@@ -82,10 +90,612 @@ TEST_CASE( "BD_OPEN_NON-EXISTING_FILE", "[blockdevice]" ) {
     REQUIRE(bd.open(BD_PATH) < 0);
 }
 
+TEST_CASE( "BD_WRITE_READ_MULTIPLE_BLOCKS_AT_ONCE", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    SECTION("consecutive blocks") {
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+        // single blocks see the same content
+        for(int b= 0; b < NUM_TESTBLOCKS; b++) {
+            REQUIRE(bd.read(b, r + b*BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+    }
+
+    SECTION("scatter & gather") {
+        // three buffers of different size spanning 1 + 4 + 2 blocks
+        struct iovec wv[3]= { { w, BD_BLOCK_SIZE }, { w + 3*BD_BLOCK_SIZE, 4*BD_BLOCK_SIZE },
+                              { w + 10*BD_BLOCK_SIZE, 2*BD_BLOCK_SIZE } };
+        struct iovec rv[3]= { { r, BD_BLOCK_SIZE }, { r + 3*BD_BLOCK_SIZE, 4*BD_BLOCK_SIZE },
+                              { r + 10*BD_BLOCK_SIZE, 2*BD_BLOCK_SIZE } };
+        REQUIRE(bd.writev(5, wv, 3) == 0);
+        REQUIRE(bd.readv(5, rv, 3) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 3*BD_BLOCK_SIZE, r + 3*BD_BLOCK_SIZE, 4*BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 10*BD_BLOCK_SIZE, r + 10*BD_BLOCK_SIZE, 2*BD_BLOCK_SIZE) == 0);
+
+        // the blocks are stored consecutively
+        REQUIRE(bd.readBlocks(5, 7, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 3*BD_BLOCK_SIZE, r + BD_BLOCK_SIZE, 4*BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 10*BD_BLOCK_SIZE, r + 5*BD_BLOCK_SIZE, 2*BD_BLOCK_SIZE) == 0);
+    }
+
+    SECTION("read beyond end of container") {
+        REQUIRE(bd.writeBlocks(0, 2, w) == 0);
+        memset(r, 1, 4*BD_BLOCK_SIZE);
+        REQUIRE(bd.readBlocks(0, 4, r) == 0);
+        REQUIRE(memcmp(w, r, 2*BD_BLOCK_SIZE) == 0);
+        for(int i= 2*BD_BLOCK_SIZE; i < 4*BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_CONCURRENT_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    const int noThreads= 8;
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    // every thread writes and reads back its own interleaved share of the blocks
+    std::vector<int> errors(noThreads, 0);
+    std::vector<std::thread> threads;
+    for(int t= 0; t < noThreads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for(int b= t; b < NUM_TESTBLOCKS; b+= noThreads) {
+                if(bd.write(b, w + b*BD_BLOCK_SIZE) != 0)
+                    errors[t]++;
+            }
+            for(int b= t; b < NUM_TESTBLOCKS; b+= noThreads) {
+                if(bd.read(b, r + b*BD_BLOCK_SIZE) != 0)
+                    errors[t]++;
+            }
+        }));
+    }
+    for(size_t t= 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+
+    for(int t= 0; t < noThreads; t++) {
+        REQUIRE(errors[t] == 0);
+    }
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_BATCH_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    bdBatchWriteRead(&bd, w, r, 4);
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_URING_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    // a small queue, so batches do not fit into the ring at once
+    UringBlockDevice bd(BLOCK_SIZE, 16);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    SECTION("single blocks") {
+        bdWriteRead(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("batches") {
+        bdBatchWriteRead(&bd, w, r, 1);
+        bdBatchWriteRead(&bd, w, r, 8);
+    }
+
+    SECTION("registered buffers") {
+        struct iovec buffers[2]= { { w, BD_BLOCK_SIZE * NUM_TESTBLOCKS }, { r, BD_BLOCK_SIZE * NUM_TESTBLOCKS } };
+        if(bd.usesRing()) {
+            REQUIRE(bd.registerBuffers(buffers, 2) == 0);
+        }
+        bdBatchWriteRead(&bd, w, r, 2);
+        if(bd.usesRing()) {
+            REQUIRE(bd.unregisterBuffers() == 0);
+        }
+    }
+
+    SECTION("read beyond end of container") {
+        REQUIRE(bd.writeBlocks(0, 2, w) == 0);
+        memset(r, 1, 4*BD_BLOCK_SIZE);
+        REQUIRE(bd.readBlocks(0, 4, r) == 0);
+        REQUIRE(memcmp(w, r, 2*BD_BLOCK_SIZE) == 0);
+        for(int i= 2*BD_BLOCK_SIZE; i < 4*BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_MMAP_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    // the container will outgrow the mapping
+    MmapBlockDevice bd(BLOCK_SIZE, 16);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    SECTION("single blocks") {
+        bdWriteRead(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("direct access") {
+        REQUIRE(bd.blockPtr(0, 1) == NULL);
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        const char* p= bd.blockPtr(0, NUM_TESTBLOCKS);
+        REQUIRE(p != NULL);
+        REQUIRE(memcmp(w, p, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(bd.sync() == 0);
+    }
+
+    SECTION("direct access through the cache") {
+        BlockCache cache(new MmapBlockDevice(BLOCK_SIZE, NUM_TESTBLOCKS), 64);
+        REQUIRE(cache.create("/tmp/bd2.bin") == 0);
+        REQUIRE(cache.writeBlocks(0, 16, w) == 0);
+        const char* p= cache.blockPtr(0, 16);
+        REQUIRE(p != NULL);
+        REQUIRE(memcmp(w, p, 16*BD_BLOCK_SIZE) == 0);
+
+        // dirty blocks are newer than the mapping
+        cache.enableWriteBack(100, 60000);
+        REQUIRE(cache.write(5, w + 20*BD_BLOCK_SIZE) == 0);
+        REQUIRE(cache.blockPtr(0, 16) == NULL);
+        REQUIRE(cache.blockPtr(6, 10) != NULL);
+        REQUIRE(cache.flush() == 0);
+        p= cache.blockPtr(0, 16);
+        REQUIRE(p != NULL);
+        REQUIRE(memcmp(w + 20*BD_BLOCK_SIZE, p + 5*BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+
+        REQUIRE(cache.close() == 0);
+        remove("/tmp/bd2.bin");
+    }
+
+    SECTION("content survives reopening") {
+        REQUIRE(bd.writeBlocks(3, 5, w) == 0);
+        REQUIRE(bd.close() == 0);
+
+        BlockDevice other(BLOCK_SIZE);
+        REQUIRE(other.open(BD_PATH) == 0);
+        REQUIRE(other.readBlocks(3, 5, r) == 0);
+        REQUIRE(memcmp(w, r, 5*BD_BLOCK_SIZE) == 0);
+        REQUIRE(other.close() == 0);
+
+        REQUIRE(bd.open(BD_PATH) == 0);
+    }
+
+    SECTION("read beyond end of container") {
+        REQUIRE(bd.writeBlocks(0, 2, w) == 0);
+        memset(r, 1, 4*BD_BLOCK_SIZE);
+        REQUIRE(bd.readBlocks(1 << 20, 4, r) == 0);
+        for(int i= 0; i < 4*BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_DIRECT_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    DirectBlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    // one byte more than needed, so unaligned buffers can be tested as well
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1);
+
+    SECTION("single blocks") {
+        bdWriteRead(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("unaligned buffers") {
+        REQUIRE(bd.writeBlocks(1, NUM_TESTBLOCKS - 1, w + 1) == 0);
+        REQUIRE(bd.write(0, w) == 0);
+        REQUIRE(bd.readBlocks(1, NUM_TESTBLOCKS - 1, r + 1) == 0);
+        REQUIRE(bd.read(0, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 1, r + 1, BD_BLOCK_SIZE * (NUM_TESTBLOCKS - 1)) == 0);
+    }
+
+    SECTION("scatter & gather") {
+        struct iovec wv[3]= { { w + 1, BD_BLOCK_SIZE }, { w + 3*BD_BLOCK_SIZE, 4*BD_BLOCK_SIZE },
+                              { w + 10*BD_BLOCK_SIZE, 2*BD_BLOCK_SIZE } };
+        REQUIRE(bd.writev(5, wv, 3) == 0);
+        REQUIRE(bd.readBlocks(5, 7, r) == 0);
+        REQUIRE(memcmp(w + 1, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 3*BD_BLOCK_SIZE, r + BD_BLOCK_SIZE, 4*BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 10*BD_BLOCK_SIZE, r + 5*BD_BLOCK_SIZE, 2*BD_BLOCK_SIZE) == 0);
+    }
+
+    SECTION("read beyond end of container") {
+        REQUIRE(bd.writeBlocks(0, 3, w) == 0);
+        memset(r, 1, 8*BD_BLOCK_SIZE);
+        REQUIRE(bd.readBlocks(0, 8, r) == 0);
+        REQUIRE(memcmp(w, r, 3*BD_BLOCK_SIZE) == 0);
+        for(int i= 3*BD_BLOCK_SIZE; i < 8*BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_CACHE_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    const char* policy= GENERATE(as<const char*>(), "clock", "arc");
+    BlockCache bd(new BlockDevice(BLOCK_SIZE), 64, policy);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    SECTION("more blocks than slots") {
+        bdWriteRead(&bd, NUM_TESTBLOCKS);
+        bdBatchWriteRead(&bd, w, r, 4);
+    }
+
+    SECTION("cached blocks are read from memory") {
+        REQUIRE(bd.writeBlocks(0, 16, w) == 0);
+        for(int i= 0; i < 100; i++) {
+            REQUIRE(bd.readBlocks(0, 16, r) == 0);
+        }
+        REQUIRE(memcmp(w, r, 16*BD_BLOCK_SIZE) == 0);
+
+        BlockCacheStats stats= bd.stats();
+        REQUIRE(stats.hits == 1600);
+        REQUIRE(stats.misses == 0);
+    }
+
+    SECTION("cache and container agree") {
+        struct iovec wv[2]= { { w, BD_BLOCK_SIZE }, { w + BD_BLOCK_SIZE, 2*BD_BLOCK_SIZE } };
+        REQUIRE(bd.writev(10, wv, 2) == 0);
+        REQUIRE(bd.close() == 0);
+
+        BlockDevice other(BLOCK_SIZE);
+        REQUIRE(other.open(BD_PATH) == 0);
+        REQUIRE(other.readBlocks(10, 3, r) == 0);
+        REQUIRE(memcmp(w, r, 3*BD_BLOCK_SIZE) == 0);
+        REQUIRE(other.close() == 0);
+
+        REQUIRE(bd.open(BD_PATH) == 0);
+        memset(r, 0, 3*BD_BLOCK_SIZE);
+        REQUIRE(bd.readBlocks(10, 3, r) == 0);
+        REQUIRE(memcmp(w, r, 3*BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.stats().misses == 3);
+    }
+
+    SECTION("hot blocks survive a scan") {
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(bd.close() == 0);
+        REQUIRE(bd.open(BD_PATH) == 0);
+
+        // 16 hot blocks accessed repeatedly, then a scan of the remaining blocks
+        for(int i= 0; i < 3; i++) {
+            REQUIRE(bd.readBlocks(0, 16, r) == 0);
+        }
+        for(int b= 16; b < NUM_TESTBLOCKS; b++) {
+            REQUIRE(bd.read(b, r) == 0);
+        }
+        BlockCacheStats before= bd.stats();
+        REQUIRE(bd.readBlocks(0, 16, r) == 0);
+        BlockCacheStats after= bd.stats();
+        if(strcmp(policy, "arc") == 0) {
+            REQUIRE(after.hits - before.hits == 16);
+        }
+        REQUIRE(memcmp(w, r, 16*BD_BLOCK_SIZE) == 0);
+        REQUIRE(after.evictions > 0);
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_CACHE_PREFETCH", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockCache bd(new BlockDevice(BLOCK_SIZE), 256);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+    REQUIRE(bd.close() == 0);
+    REQUIRE(bd.open(BD_PATH) == 0);
+
+    SECTION("prefetched blocks are read from memory") {
+        REQUIRE(bd.read(7, r + 7*BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.advise(8, 32, BD_ADVICE_WILLNEED) == 0);
+        for(int i= 0; i < 100 && bd.stats().prefetched < 32; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(bd.stats().prefetched == 32);
+
+        REQUIRE(bd.readBlocks(8, 32, r + 8*BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w + 7*BD_BLOCK_SIZE, r + 7*BD_BLOCK_SIZE, 33*BD_BLOCK_SIZE) == 0);
+        BlockCacheStats stats= bd.stats();
+        REQUIRE(stats.hits == 32);
+        REQUIRE(stats.misses == 1);
+    }
+
+    SECTION("prefetching does not hide writes") {
+        for(int b= 0; b < NUM_TESTBLOCKS; b+= 64) {
+            REQUIRE(bd.advise(b, 64, BD_ADVICE_WILLNEED) == 0);
+            REQUIRE(bd.write(b + 5, w) == 0);
+            memcpy(w + (b + 5)*BD_BLOCK_SIZE, w, BD_BLOCK_SIZE);
+        }
+        REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_WRITEBACK_WRITE_READ", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockCache bd(new BlockDevice(BLOCK_SIZE), 64);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* zero= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(zero, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    BlockDevice other(BLOCK_SIZE);
+
+    SECTION("dirty blocks reach the container with flush") {
+        bd.enableWriteBack(100, 60000);
+        REQUIRE(bd.writeBlocks(10, 16, w) == 0);
+        REQUIRE(bd.readBlocks(10, 16, r) == 0);
+        REQUIRE(memcmp(w, r, 16*BD_BLOCK_SIZE) == 0);
+
+        REQUIRE(other.open(BD_PATH) == 0);
+        REQUIRE(other.readBlocks(10, 16, r) == 0);
+        REQUIRE(memcmp(zero, r, 16*BD_BLOCK_SIZE) == 0);
+
+        REQUIRE(bd.flush() == 0);
+        REQUIRE(bd.stats().writebacks == 16);
+        REQUIRE(other.readBlocks(10, 16, r) == 0);
+        REQUIRE(memcmp(w, r, 16*BD_BLOCK_SIZE) == 0);
+        REQUIRE(other.close() == 0);
+    }
+
+    SECTION("expired blocks are written back in the background") {
+        bd.enableWriteBack(100, 20);
+        REQUIRE(bd.writeBlocks(0, 8, w) == 0);
+        for(int i= 0; i < 100 && bd.stats().writebacks < 8; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(bd.stats().writebacks == 8);
+
+        REQUIRE(other.open(BD_PATH) == 0);
+        REQUIRE(other.readBlocks(0, 8, r) == 0);
+        REQUIRE(memcmp(w, r, 8*BD_BLOCK_SIZE) == 0);
+        REQUIRE(other.close() == 0);
+    }
+
+    SECTION("evicted and remaining dirty blocks are written back") {
+        bd.enableWriteBack(100, 60000);
+        bdWriteRead(&bd, NUM_TESTBLOCKS);
+        bdBatchWriteRead(&bd, w, r, 4);
+        REQUIRE(bd.stats().evictions > 0);
+        REQUIRE(bd.close() == 0);
+
+        REQUIRE(other.open(BD_PATH) == 0);
+        REQUIRE(other.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(other.close() == 0);
+        REQUIRE(bd.open(BD_PATH) == 0);
+    }
+
+    delete [] r;
+    delete [] w;
+    delete [] zero;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_CACHE_SUBMIT_REAP", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    // a small queue, so batches of the cache do not fit into the ring at once
+    BlockCache bd(new UringBlockDevice(BLOCK_SIZE, 16), 1024);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    BlockDevice other(BLOCK_SIZE);
+
+    SECTION("requests are passed on to the block device") {
+        REQUIRE(bd.writeBlocks(0, 8, w) == 0);
+        bdBatchWriteRead(&bd, w, r, 4);
+        BlockCacheStats stats= bd.stats();
+        REQUIRE(stats.hits == 0);
+        REQUIRE(stats.misses == 0);
+
+        // blocks that are all cached are read from memory
+        REQUIRE(bd.readBlocks(0, 8, r) == 0);
+        BlockRequest req= { false, 0, 8, r, 1, NULL };
+        BlockRequest *submitted= &req;
+        REQUIRE(bd.submit(&submitted, 1) == 0);
+        REQUIRE(bd.reap(&submitted, 1, 1) == 1);
+        REQUIRE(req.result == 0);
+        REQUIRE(memcmp(w, r, 8*BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.stats().hits == 8);
+    }
+
+    SECTION("dirty blocks are written back in batches") {
+        bd.enableWriteBack(100, 60000);
+        bdBatchWriteRead(&bd, w, r, 1);
+        REQUIRE(bd.stats().hits == NUM_TESTBLOCKS);
+        REQUIRE(bd.flush() == 0);
+        REQUIRE(bd.stats().writebacks == NUM_TESTBLOCKS);
+
+        REQUIRE(other.open(BD_PATH) == 0);
+        REQUIRE(other.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(other.close() == 0);
+    }
+
+    SECTION("long prefetches are read in parallel runs") {
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(bd.close() == 0);
+        REQUIRE(bd.open(BD_PATH) == 0);
+
+        REQUIRE(bd.advise(0, 256, BD_ADVICE_WILLNEED) == 0);
+        for(int i= 0; i < 100 && bd.stats().prefetched < 256; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(bd.stats().prefetched == 256);
+        REQUIRE(bd.readBlocks(0, 256, r) == 0);
+        REQUIRE(memcmp(w, r, 256*BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.stats().hits == 256);
+    }
+
+    delete [] r;
+    delete [] w;
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
 // ***
 // *** Helper functions
 // ***
 
+void bdBatchWriteRead(BlockDevice *bd, char *w, char *r, int blocksPerRequest) {
+    const int noRequests= NUM_TESTBLOCKS / blocksPerRequest;
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    std::vector<BlockRequest> requests(noRequests);
+    std::vector<BlockRequest*> submitted(noRequests);
+    std::vector<BlockRequest*> done(noRequests);
+
+    for(int write= 1; write >= 0; write--) {
+        for(int i= 0; i < noRequests; i++) {
+            requests[i].write= write == 1;
+            requests[i].blockNo= i * blocksPerRequest;
+            requests[i].numBlocks= blocksPerRequest;
+            requests[i].buffer= (write == 1 ? w : r) + i * blocksPerRequest * BD_BLOCK_SIZE;
+            requests[i].result= 1;
+            submitted[i]= &requests[i];
+        }
+        REQUIRE(bd->submit(submitted.data(), noRequests) == 0);
+
+        // every request comes back exactly once
+        int noDone= 0;
+        while(noDone < noRequests) {
+            int n= bd->reap(done.data() + noDone, 1, noRequests - noDone);
+            REQUIRE(n > 0);
+            noDone+= n;
+        }
+        REQUIRE(bd->reap(done.data(), 0, noRequests) == 0);
+        for(int i= 0; i < noRequests; i++) {
+            REQUIRE(requests[i].result == 0);
+        }
+    }
+
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+}
+
 void bdWriteRead(BlockDevice *bd, int noBlocks) {
     char* r= new char[BD_BLOCK_SIZE * noBlocks];
     memset(r, 0, BD_BLOCK_SIZE * noBlocks);
@@ -8,7 +8,1444 @@
 
 #include "../catch/catch.hpp"
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "tools.hpp"
 #include "myfs.h"
+#include "myfs-info.h"
+#include "myondiskfs.h"
+#include "myinmemoryfs.h"
+
+#define FS_PATH "/tmp/myfs.bin"
+#define FS_COPY_PATH "/tmp/myfs-copy.bin"
+#define FS_CHECKPOINT_PATH "/tmp/myfs-checkpoint.bin"
+
+// the values of Linux, as FUSE passes them on
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4
+#endif
+
+/// MyOnDiskFS with access to the internals the tests look at
+class TestOnDiskFS : public MyOnDiskFS {
+public:
+    using MyOnDiskFS::blockCache;
+    using MyOnDiskFS::blockSize;
+    using MyOnDiskFS::isValidBlockSize;
+    using MyOnDiskFS::numDirEntries;
+    using MyOnDiskFS::blocks4JOURNAL;
+    using MyOnDiskFS::posJOURNAL;
+    using MyOnDiskFS::posDATA;
+    using MyOnDiskFS::posENDofDATA;
+    using MyOnDiskFS::reservedBlocks;
+    using MyOnDiskFS::packedRoot;
+    using MyOnDiskFS::blocks4ROOT;
+};
+
+// Declarations of helper functions
+void fsDefaults(MyFsInfo *info);
+TestOnDiskFS *fsMount(MyFsInfo *info);
+void fsUnmount(TestOnDiskFS *fs);
+void fsWrite(MyFS *fs, const char *path, const char *buf, size_t size, off_t offset);
+void fsRead(MyFS *fs, const char *path, char *buf, size_t size, off_t offset);
+void fsCopy(const char *from, const char *to);
+void fsCheckDmap(TestOnDiskFS *fs, size_t numBlocks);
+void fsCheckFreeExtents(TestOnDiskFS *fs, size_t numBlocks);
+std::vector<Extent> fsExtents(TestOnDiskFS *fs, const char *path);
+time_t fsCopyAtime(const char *path);
+void fsCorrupt(const char *path, off_t offset, size_t length);
+bool fsReadTouches(TestOnDiskFS *fs, time_t atime, time_t changed, time_t *newAtime);
+std::string fsLongPath(int id, size_t length);
+void fsCheckPathIndex(TestOnDiskFS *fs);
+void fsCheckPathIndex(MyInMemoryFS *fs);
+
+TEST_CASE("T-3.01", "[Part_3]") {
+    printf("Testcase 3.1: Mapped blocks are read without the block cache\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.backend = (char *) "mmap";
+
+    char *r = new char[64 * 1024];
+    char *w = new char[64 * 1024];
+    gen_random(w, 64 * 1024);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->blockCache != NULL);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    fsWrite(fs, "/file", w, 64 * 1024, 0);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    BlockCacheStats before = fs->blockCache->stats();
+    fsRead(fs, "/file", r, 64 * 1024, 0);
+    REQUIRE(memcmp(r, w, 64 * 1024) == 0);
+
+    // the data blocks come from the mapping, neither read nor prefetched into the cache
+    BlockCacheStats after = fs->blockCache->stats();
+    REQUIRE(after.hits == before.hits);
+    REQUIRE(after.misses == before.misses);
+    REQUIRE(after.prefetched == 0);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.02", "[Part_3]") {
+    printf("Testcase 3.2: Changes are committed while the file system is idle\n");
+
+    remove(FS_PATH);
+    remove(FS_COPY_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.commitInterval = 20;
+
+    char *r = new char[16 * 1024];
+    char *w = new char[16 * 1024];
+    gen_random(w, 16 * 1024);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    fsWrite(fs, "/file", w, 16 * 1024, 0);
+
+    // no further operation follows, only the committer thread can commit the changes before the "crash"
+    usleep(200 * 1000);
+    fsCopy(FS_PATH, FS_COPY_PATH);
+
+    MyFsInfo copyInfo;
+    fsDefaults(&copyInfo);
+    copyInfo.contFile = (char *) FS_COPY_PATH;
+    TestOnDiskFS *copy = fsMount(&copyInfo);
+
+    struct stat s;
+    REQUIRE(copy->fuseGetattr("/file", &s) == 0);
+    REQUIRE(s.st_size == 16 * 1024);
+    fsRead(copy, "/file", r, 16 * 1024, 0);
+    REQUIRE(memcmp(r, w, 16 * 1024) == 0);
+
+    fsUnmount(copy);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+    remove(FS_COPY_PATH);
+}
+
+TEST_CASE("T-3.03", "[Part_3]") {
+    printf("Testcase 3.3: Lazy timestamps are written once they are due\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.commitInterval = 20;
+    info.lazyTime = 1;
+
+    char buf[1024];
+    gen_random(buf, 1024);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    fsWrite(fs, "/a", buf, 1024, 0);
+
+    // a later second, so the access time of the read differs from the one written with the file
+    sleep(1);
+    fsRead(fs, "/a", buf, 1024, 0);
+    REQUIRE(fs->lazyTimesPending);
+    struct stat s;
+    REQUIRE(fs->fuseGetattr("/a", &s) == 0);
+    time_t atime = s.st_atime;
+
+    SECTION("by the committer thread") {
+        usleep(100 * 1000);
+        REQUIRE(fs->lazyTimesPending);
+        REQUIRE(fsCopyAtime("/a") != atime);
+
+        fs->myLazySince -= std::chrono::seconds(LAZYTIME_INTERVAL + 1);
+        usleep(100 * 1000);
+        REQUIRE_FALSE(fs->lazyTimesPending);
+        REQUIRE(fsCopyAtime("/a") == atime);
+    }
+
+    SECTION("by fsync() of another file") {
+        // keep the committer thread out
+        std::lock_guard<std::recursive_mutex> guard(fs->fsLock);
+        fs->myLazySince -= std::chrono::seconds(LAZYTIME_INTERVAL + 1);
+
+        struct fuse_file_info fileInfo;
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        REQUIRE(fs->fuseOpen("/b", &fileInfo) == 0);
+        REQUIRE(fs->fuseFsync("/b", 0, &fileInfo) == 0);
+        REQUIRE(fs->fuseRelease("/b", &fileInfo) == 0);
+        REQUIRE_FALSE(fs->lazyTimesPending);
+        REQUIRE(fsCopyAtime("/a") == atime);
+    }
+
+    fsUnmount(fs);
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.04", "[Part_3]") {
+    printf("Testcase 3.4: The block size is chosen when the container is created\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+
+    char *r = new char[200 * 1024];
+    char *w = new char[200 * 1024];
+    gen_random(w, 200 * 1024);
+
+    REQUIRE(TestOnDiskFS::isValidBlockSize(512));
+    REQUIRE(TestOnDiskFS::isValidBlockSize(65536));
+    REQUIRE_FALSE(TestOnDiskFS::isValidBlockSize(256));
+    REQUIRE_FALSE(TestOnDiskFS::isValidBlockSize(3000));
+    REQUIRE_FALSE(TestOnDiskFS::isValidBlockSize(131072));
+
+    uint32_t blockSizes[] = {4096, 65536};
+    for (int i = 0; i < 2; i++) {
+        info.blockSize = blockSizes[i];
+        info.dataBlocks = 1024;
+
+        TestOnDiskFS *fs = fsMount(&info);
+        REQUIRE(fs->blockSize == blockSizes[i]);
+        REQUIRE(fs->mySuperBlock.blockSize == blockSizes[i]);
+        REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+        // unaligned writes with partial first and last blocks
+        fsWrite(fs, "/file", w, 200 * 1024 - 100, 0);
+        fsWrite(fs, "/file", w + 5000, 10000, 5000);
+        fsUnmount(fs);
+
+        // the superblock decides, the options are ignored for an existing container
+        info.blockSize = 512;
+        info.dataBlocks = 0;
+        fs = fsMount(&info);
+        REQUIRE(fs->blockSize == blockSizes[i]);
+
+        struct stat s;
+        REQUIRE(fs->fuseGetattr("/file", &s) == 0);
+        REQUIRE(s.st_size == 200 * 1024 - 100);
+        REQUIRE(s.st_blocks == (blkcnt_t) ((200 * 1024 + blockSizes[i] - 1) / blockSizes[i]) * (blockSizes[i] / 512));
+        fsRead(fs, "/file", r, 200 * 1024 - 100, 0);
+        REQUIRE(memcmp(r, w, 200 * 1024 - 100) == 0);
+        fsUnmount(fs);
+
+        remove(FS_PATH);
+    }
+
+    // unsupported block sizes fall back to the default
+    info.blockSize = 3000;
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->blockSize == BLOCK_SIZE);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.05", "[Part_3]") {
+    printf("Testcase 3.5: The geometry is chosen when the container is created\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.dataBlocks = 100000;
+    info.dirEntries = 300;
+
+    // more than 65536 blocks, the last block lies behind the 16 bit limit of the old format
+    size_t size = 70000 * BLOCK_SIZE;
+    size_t chunk = 1024 * 1024;
+    char *r = new char[chunk];
+    char *w = new char[chunk];
+    gen_random(w, chunk);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/big", S_IFREG | 0644, 0) == 0);
+    struct fuse_file_info fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    REQUIRE(fs->fuseOpen("/big", &fileInfo) == 0);
+    for (size_t offset = 0; offset < size; offset += chunk) {
+        size_t n = std::min(chunk, size - offset);
+        REQUIRE(fs->fuseWrite("/big", w, n, offset, &fileInfo) == (int) n);
+    }
+    REQUIRE(fs->fuseRelease("/big", &fileInfo) == 0);
+
+    char path[16];
+    for (int i = 1; i < 300; i++) {
+        sprintf(path, "/f%d", i);
+        REQUIRE(fs->fuseMknod(path, S_IFREG | 0644, 0) == 0);
+    }
+    REQUIRE(fs->fuseMknod("/full", S_IFREG | 0644, 0) == -ENOSPC);
+    fsUnmount(fs);
+
+    // the superblock decides, the options are ignored for an existing container
+    info.dataBlocks = 0;
+    info.dirEntries = 0;
+    fs = fsMount(&info);
+    REQUIRE(fs->mySuperBlock.numDataBlocks == 100000);
+    REQUIRE(fs->mySuperBlock.numDirEntries == 300);
+    REQUIRE(fs->posENDofDATA - fs->posDATA == 100000);
+    REQUIRE(fs->numDirEntries == 300);
+
+    struct stat s;
+    REQUIRE(fs->fuseGetattr("/big", &s) == 0);
+    REQUIRE(s.st_size == (off_t) size);
+    REQUIRE(fs->fuseGetattr("/f299", &s) == 0);
+
+    // the end of the file, stored in the blocks behind block 65536
+    size_t tail = size % chunk;
+    fsRead(fs, "/big", r, tail, size - tail);
+    REQUIRE(memcmp(r, w, tail) == 0);
+
+    REQUIRE(fs->fuseUnlink("/f1") == 0);
+    REQUIRE(fs->fuseMknod("/full", S_IFREG | 0644, 0) == 0);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.06", "[Part_3]") {
+    printf("Testcase 3.6: The DMAP bitmap and its summary agree with the allocated blocks\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    // not a multiple of 64, the last word of the bitmap is only partly used
+    info.dataBlocks = 5000;
+
+    // more than 4096 blocks, i.e. more than one word of the summary
+    size_t size = 4200 * BLOCK_SIZE;
+    char *w = new char[size];
+    gen_random(w, size);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 5000);
+    // the padding behind the data segment counts as occupied
+    REQUIRE(fs->scanDmap(0, false) == 5000);
+    fsCheckDmap(fs, 5000);
+
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    fsWrite(fs, "/file", w, size, 0);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 800);
+    fsCheckDmap(fs, 5000);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 800);
+    fsCheckDmap(fs, 5000);
+
+    REQUIRE(fs->fuseUnlink("/file") == 0);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 5000);
+    REQUIRE(fs->scanDmap(0, false) == 5000);
+    fsCheckDmap(fs, 5000);
+    fsUnmount(fs);
+
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.07", "[Part_3]") {
+    printf("Testcase 3.7: Runs of consecutive blocks are allocated from the free extents\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.dataBlocks = 1000;
+
+    char *w = new char[1000 * BLOCK_SIZE];
+    gen_random(w, 1000 * BLOCK_SIZE);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    fsCheckFreeExtents(fs, 1000);
+    REQUIRE(fs->myFreeExtents.size() == 1);
+
+    const char *paths[] = {"/a", "/b", "/c"};
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(fs->fuseMknod(paths[i], S_IFREG | 0644, 0) == 0);
+        fsWrite(fs, paths[i], w, 100 * BLOCK_SIZE, 0);
+        REQUIRE(fsExtents(fs, paths[i]).size() == 1);
+    }
+    fsCheckFreeExtents(fs, 1000);
+
+    {
+        // keep the committer thread out, the blocks of /b are only handed out once their release is committed
+        std::lock_guard<std::recursive_mutex> guard(fs->fsLock);
+        REQUIRE(fs->fuseUnlink("/b") == 0);
+        REQUIRE(fs->myPendingFrees.size() == 1);
+        REQUIRE(fs->mySuperBlock.numFreeBlocks == 800);
+        REQUIRE(fs->containerFull(701));
+        fsCheckFreeExtents(fs, 1000);
+        REQUIRE(fs->myFreeExtents.size() == 1);
+        REQUIRE(fs->commitMetadata(true) == 0);
+        REQUIRE(fs->myPendingFrees.empty());
+        fsCheckFreeExtents(fs, 1000);
+        REQUIRE(fs->myFreeExtents.size() == 2);
+    }
+
+    // the 100 blocks of /b are too few for /d, it gets a run of its own behind /c
+    REQUIRE(fs->fuseMknod("/d", S_IFREG | 0644, 0) == 0);
+    fsWrite(fs, "/d", w, 150 * BLOCK_SIZE, 0);
+    std::vector<Extent> extents = fsExtents(fs, "/d");
+    REQUIRE(extents.size() == 1);
+    REQUIRE(extents[0].length == 150);
+    fsCheckFreeExtents(fs, 1000);
+
+    // without a run large enough the largest ones are used, the 100 blocks of /b last
+    size_t numFree = fs->mySuperBlock.numFreeBlocks;
+    REQUIRE(numFree == 650);
+    REQUIRE(fs->fuseMknod("/e", S_IFREG | 0644, 0) == 0);
+    fsWrite(fs, "/e", w, numFree * BLOCK_SIZE, 0);
+    extents = fsExtents(fs, "/e");
+    REQUIRE(extents.size() == 2);
+    REQUIRE(extents[0].length == 550);
+    REQUIRE(extents[1].length == 100);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 0);
+    REQUIRE(fs->myFreeExtents.empty());
+    fsCheckFreeExtents(fs, 1000);
+
+    struct fuse_file_info fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    REQUIRE(fs->fuseMknod("/f", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseOpen("/f", &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/f", w, BLOCK_SIZE, 0, &fileInfo) == -ENOSPC);
+    REQUIRE(fs->fuseRelease("/f", &fileInfo) == 0);
+    fsUnmount(fs);
+
+    // the index is built from the DMAP when the container is read
+    fs = fsMount(&info);
+    REQUIRE(fs->myFreeExtents.empty());
+    REQUIRE(fs->fuseUnlink("/e") == 0);
+    REQUIRE(fs->fuseMknod("/g", S_IFREG | 0644, 0) == 0);
+    // the write commits the release of the blocks of /e first, it would not find any empty block otherwise
+    fsWrite(fs, "/g", w, BLOCK_SIZE, 0);
+    fsCheckFreeExtents(fs, 1000);
+    REQUIRE(fs->myFreeExtents.size() == 2);
+    fsUnmount(fs);
+
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.08", "[Part_3]") {
+    printf("Testcase 3.8: Blocks are allocated behind the goal block and the next-fit cursor\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.dataBlocks = 1000;
+
+    char *w = new char[8 * BLOCK_SIZE];
+    gen_random(w, 8 * BLOCK_SIZE);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/c", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/d", S_IFREG | 0644, 0) == 0);
+    fsWrite(fs, "/a", w, 8 * BLOCK_SIZE, 0);
+    fsWrite(fs, "/b", w, 8 * BLOCK_SIZE, 0);
+    REQUIRE(fsExtents(fs, "/a")[0].physicalStart == 0);
+    REQUIRE(fsExtents(fs, "/b")[0].physicalStart == 8);
+
+    // new files start at the cursor, not in the blocks /a left at the front
+    REQUIRE(fs->fuseUnlink("/a") == 0);
+    fsWrite(fs, "/c", w, 4 * BLOCK_SIZE, 0);
+    REQUIRE(fsExtents(fs, "/c")[0].physicalStart == 16);
+
+    // appending continues behind the end of the file while the blocks there are empty
+    fsWrite(fs, "/c", w, 4 * BLOCK_SIZE, 4 * BLOCK_SIZE);
+    std::vector<Extent> extents = fsExtents(fs, "/c");
+    REQUIRE(extents.size() == 1);
+    REQUIRE(extents[0].length == 8);
+
+    // otherwise in the first run behind the goal, still not in front of it
+    fsWrite(fs, "/b", w, 4 * BLOCK_SIZE, 8 * BLOCK_SIZE);
+    extents = fsExtents(fs, "/b");
+    REQUIRE(extents.size() == 2);
+    REQUIRE(extents[1].physicalStart == 24);
+
+    // blocks written into a hole keep their distance to the block in front of it
+    fsWrite(fs, "/d", w, BLOCK_SIZE, 0);
+    fsWrite(fs, "/d", w, BLOCK_SIZE, 10 * BLOCK_SIZE);
+    extents = fsExtents(fs, "/d");
+    REQUIRE(extents.size() == 2);
+    REQUIRE(extents[0].physicalStart == 28);
+    REQUIRE(extents[1].physicalStart == 38);
+    fsWrite(fs, "/d", w, BLOCK_SIZE, 5 * BLOCK_SIZE);
+    REQUIRE(fsExtents(fs, "/d")[1].physicalStart == 33);
+    fsWrite(fs, "/d", w, 4 * BLOCK_SIZE, BLOCK_SIZE);
+    fsWrite(fs, "/d", w, 4 * BLOCK_SIZE, 6 * BLOCK_SIZE);
+    extents = fsExtents(fs, "/d");
+    REQUIRE(extents.size() == 1);
+    REQUIRE(extents[0].physicalStart == 28);
+    REQUIRE(extents[0].length == 11);
+    fsUnmount(fs);
+
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.09", "[Part_3]") {
+    printf("Testcase 3.9: Appended data gets its blocks when the file is flushed\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.dataBlocks = 3000;
+    info.delayedAlloc = 1;
+
+    size_t size = 3000 * BLOCK_SIZE;
+    char *r = new char[size];
+    char *w = new char[size];
+    gen_random(w, size);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    struct fuse_file_info fileA;
+    struct fuse_file_info fileB;
+    memset(&fileA, 0, sizeof(fileA));
+    memset(&fileB, 0, sizeof(fileB));
+    REQUIRE(fs->fuseOpen("/a", &fileA) == 0);
+    REQUIRE(fs->fuseOpen("/b", &fileB) == 0);
+
+    // small appends only reserve blocks
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(fs->fuseWrite("/a", w + i * 1000, 1000, i * 1000, &fileA) == 1000);
+    }
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 3000);
+    REQUIRE(fs->reservedBlocks == 6);
+    REQUIRE(fsExtents(fs, "/a").empty());
+    struct stat s;
+    REQUIRE(fs->fuseGetattr("/a", &s) == 0);
+    REQUIRE(s.st_size == 3000);
+    REQUIRE(s.st_blocks == 6);
+    REQUIRE(fs->fuseRead("/a", r, 3000, 0, &fileA) == 3000);
+    REQUIRE(memcmp(r, w, 3000) == 0);
+
+    // reserved blocks are not available to other files
+    REQUIRE(fs->fuseWrite("/b", w, 2995 * BLOCK_SIZE, 0, &fileB) == -ENOSPC);
+    REQUIRE(fs->reservedBlocks == 6);
+
+    // more than DELALLOC_MAX_SIZE is allocated right away, with a single run
+    REQUIRE(fs->fuseWrite("/b", w, 2994 * BLOCK_SIZE, 0, &fileB) == 2994 * BLOCK_SIZE);
+    REQUIRE(fs->reservedBlocks == 6);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 6);
+    REQUIRE(fsExtents(fs, "/b").size() == 1);
+
+    REQUIRE(fs->fuseFlush("/a", &fileA) == 0);
+    REQUIRE(fs->reservedBlocks == 0);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 0);
+    std::vector<Extent> extents = fsExtents(fs, "/a");
+    REQUIRE(extents.size() == 1);
+    REQUIRE(extents[0].length == 6);
+
+    REQUIRE(fs->fuseRelease("/a", &fileA) == 0);
+    REQUIRE(fs->fuseRelease("/b", &fileB) == 0);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    fsRead(fs, "/a", r, 3000, 0);
+    REQUIRE(memcmp(r, w, 3000) == 0);
+    fsRead(fs, "/b", r, 2994 * BLOCK_SIZE, 0);
+    REQUIRE(memcmp(r, w, 2994 * BLOCK_SIZE) == 0);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.10", "[Part_3]") {
+    printf("Testcase 3.10: fallocate() preallocates consecutive blocks\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.dataBlocks = 1000;
+
+    char *r = new char[100 * BLOCK_SIZE];
+    char *zeros = new char[100 * BLOCK_SIZE];
+    memset(zeros, 0, 100 * BLOCK_SIZE);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    struct fuse_file_info fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    REQUIRE(fs->fuseOpen("/a", &fileInfo) == 0);
+
+    // the file grows to the end of the range, which reads as zeros
+    REQUIRE(fs->fuseFallocate("/a", 0, 0, 100 * BLOCK_SIZE, &fileInfo) == 0);
+    struct stat s;
+    REQUIRE(fs->fuseGetattr("/a", &s) == 0);
+    REQUIRE(s.st_size == 100 * BLOCK_SIZE);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 900);
+    REQUIRE(fsExtents(fs, "/a").size() == 1);
+    REQUIRE(fs->fuseRead("/a", r, 100 * BLOCK_SIZE, 0, &fileInfo) == 100 * BLOCK_SIZE);
+    REQUIRE(memcmp(r, zeros, 100 * BLOCK_SIZE) == 0);
+
+    // blocks behind the end of the file, the size stays
+    REQUIRE(fs->fuseFallocate("/a", FALLOC_FL_KEEP_SIZE, 100 * BLOCK_SIZE, 50 * BLOCK_SIZE, &fileInfo) == 0);
+    REQUIRE(fs->fuseGetattr("/a", &s) == 0);
+    REQUIRE(s.st_size == 100 * BLOCK_SIZE);
+    REQUIRE(s.st_blocks == 150);
+    std::vector<Extent> extents = fsExtents(fs, "/a");
+    REQUIRE(extents.size() == 1);
+    REQUIRE(extents[0].length == 150);
+
+    // writing there takes no further blocks
+    REQUIRE(fs->fuseWrite("/a", "data", 4, 120 * BLOCK_SIZE, &fileInfo) == 4);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 850);
+    REQUIRE(fsExtents(fs, "/a").size() == 1);
+    REQUIRE(fs->fuseRead("/a", r, 20 * BLOCK_SIZE, 100 * BLOCK_SIZE, &fileInfo) == 20 * BLOCK_SIZE);
+    REQUIRE(memcmp(r, zeros, 20 * BLOCK_SIZE) == 0);
+
+    REQUIRE(fs->fuseFallocate("/a", 0x08, 0, BLOCK_SIZE, &fileInfo) == -EOPNOTSUPP);
+    REQUIRE(fs->fuseFallocate("/a", FALLOC_FL_PUNCH_HOLE, 0, BLOCK_SIZE, &fileInfo) == -EOPNOTSUPP);
+    REQUIRE(fs->fuseFallocate("/a", 0, 0, 0, &fileInfo) == -EINVAL);
+
+    // ranges behind the last logical block or larger than the empty blocks leave the file as it is
+    REQUIRE(fs->fuseFallocate("/a", 0, 0, (off_t) 1 << 41, &fileInfo) == -EFBIG);
+    REQUIRE(fs->fuseFallocate("/a", FALLOC_FL_KEEP_SIZE, (off_t) 1 << 40, BLOCK_SIZE, &fileInfo) == -EFBIG);
+    REQUIRE(fs->fuseFallocate("/a", 0, 0, 1001 * BLOCK_SIZE, &fileInfo) == -ENOSPC);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 850);
+    REQUIRE(fs->fuseGetattr("/a", &s) == 0);
+    REQUIRE(s.st_size == 120 * BLOCK_SIZE + 4);
+    REQUIRE(s.st_blocks == 150);
+    REQUIRE(fs->fuseRelease("/a", &fileInfo) == 0);
+
+    // a range larger than the empty blocks fails without taking any of them
+    REQUIRE(fs->fuseOpen("/b", &fileInfo) == 0);
+    REQUIRE(fs->fuseFallocate("/b", 0, 0, 851 * BLOCK_SIZE, &fileInfo) == -ENOSPC);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 850);
+    REQUIRE(fs->fuseGetattr("/b", &s) == 0);
+    REQUIRE(s.st_size == 0);
+    REQUIRE(fs->fuseRelease("/b", &fileInfo) == 0);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    REQUIRE(fs->fuseGetattr("/a", &s) == 0);
+    REQUIRE(s.st_size == 120 * BLOCK_SIZE + 4);
+    REQUIRE(s.st_blocks == 150);
+    REQUIRE(fsExtents(fs, "/a").size() == 1);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] zeros;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.11", "[Part_3]") {
+    printf("Testcase 3.11: Holes take no blocks and read as zeros\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.dataBlocks = 1000;
+
+    char *r = new char[11 * BLOCK_SIZE];
+    char *w = new char[11 * BLOCK_SIZE];
+    char *zeros = new char[11 * BLOCK_SIZE];
+    gen_random(w, 11 * BLOCK_SIZE);
+    memset(zeros, 0, 11 * BLOCK_SIZE);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/sparse", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/punched", S_IFREG | 0644, 0) == 0);
+    struct fuse_file_info fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+
+    // writing behind the end leaves a hole of nine blocks
+    REQUIRE(fs->fuseOpen("/sparse", &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/sparse", w, BLOCK_SIZE, 0, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(fs->fuseWrite("/sparse", w, BLOCK_SIZE, 10 * BLOCK_SIZE, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 998);
+    struct stat s;
+    REQUIRE(fs->fuseGetattr("/sparse", &s) == 0);
+    REQUIRE(s.st_size == 11 * BLOCK_SIZE);
+    REQUIRE(s.st_blocks == 2);
+    REQUIRE(fs->fuseRead("/sparse", r, 9 * BLOCK_SIZE, BLOCK_SIZE, &fileInfo) == 9 * BLOCK_SIZE);
+    REQUIRE(memcmp(r, zeros, 9 * BLOCK_SIZE) == 0);
+
+    // the kernel only asks for SEEK_DATA and SEEK_HOLE with FUSE 3.8 and newer, so they are called directly here
+    REQUIRE(fs->fuseLseek("/sparse", 0, SEEK_DATA, &fileInfo) == 0);
+    REQUIRE(fs->fuseLseek("/sparse", 0, SEEK_HOLE, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(fs->fuseLseek("/sparse", 100, SEEK_HOLE, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(fs->fuseLseek("/sparse", BLOCK_SIZE, SEEK_HOLE, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(fs->fuseLseek("/sparse", BLOCK_SIZE, SEEK_DATA, &fileInfo) == 10 * BLOCK_SIZE);
+    // the end of the file counts as a hole
+    REQUIRE(fs->fuseLseek("/sparse", 10 * BLOCK_SIZE, SEEK_HOLE, &fileInfo) == 11 * BLOCK_SIZE);
+    REQUIRE(fs->fuseLseek("/sparse", 11 * BLOCK_SIZE, SEEK_DATA, &fileInfo) == -ENXIO);
+    REQUIRE(fs->fuseLseek("/sparse", 0, SEEK_SET, &fileInfo) == -EINVAL);
+
+    // the last block with a logical block number is the end of the file, nothing behind it changes the file
+    off_t lastBlock = (off_t) (MAX_FILE_BLOCKS - 1) * BLOCK_SIZE;
+    REQUIRE(fs->fuseWrite("/sparse", w, BLOCK_SIZE, (off_t) 1 << 40, &fileInfo) == -EFBIG);
+    REQUIRE(fs->fuseWrite("/sparse", w, BLOCK_SIZE, (off_t) 1 << 41, &fileInfo) == -EFBIG);
+    REQUIRE(fs->fuseWrite("/sparse", w, BLOCK_SIZE + 1, lastBlock, &fileInfo) == -EFBIG);
+    REQUIRE(fs->fuseTruncate("/sparse", lastBlock + BLOCK_SIZE + 1, &fileInfo) == -EFBIG);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 998);
+    REQUIRE(fs->fuseGetattr("/sparse", &s) == 0);
+    REQUIRE(s.st_size == 11 * BLOCK_SIZE);
+    REQUIRE(s.st_blocks == 2);
+    REQUIRE(fs->fuseRead("/sparse", r, BLOCK_SIZE, 0, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(memcmp(r, w, BLOCK_SIZE) == 0);
+
+    REQUIRE(fs->fuseWrite("/sparse", w + BLOCK_SIZE, BLOCK_SIZE, lastBlock, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(fs->fuseRead("/sparse", r, BLOCK_SIZE, lastBlock, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(memcmp(r, w + BLOCK_SIZE, BLOCK_SIZE) == 0);
+    REQUIRE(fs->fuseLseek("/sparse", 11 * BLOCK_SIZE, SEEK_DATA, &fileInfo) == lastBlock);
+    REQUIRE(fs->fuseTruncate("/sparse", 11 * BLOCK_SIZE, &fileInfo) == 0);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 998);
+    REQUIRE(fs->fuseRelease("/sparse", &fileInfo) == 0);
+
+    // the blocks the range covers completely are freed, the partly covered ones are zeroed
+    REQUIRE(fs->fuseOpen("/punched", &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite("/punched", w, 8 * BLOCK_SIZE, 0, &fileInfo) == 8 * BLOCK_SIZE);
+    REQUIRE(fs->fuseFallocate("/punched", FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, BLOCK_SIZE / 2,
+                              3 * BLOCK_SIZE, &fileInfo) == 0);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == 992);
+    REQUIRE(fs->fuseGetattr("/punched", &s) == 0);
+    REQUIRE(s.st_size == 8 * BLOCK_SIZE);
+    REQUIRE(s.st_blocks == 6);
+    REQUIRE(fs->fuseLseek("/punched", 0, SEEK_HOLE, &fileInfo) == BLOCK_SIZE);
+    REQUIRE(fs->fuseLseek("/punched", BLOCK_SIZE, SEEK_DATA, &fileInfo) == 3 * BLOCK_SIZE);
+    REQUIRE(fs->fuseRelease("/punched", &fileInfo) == 0);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    REQUIRE(fs->fuseGetattr("/sparse", &s) == 0);
+    REQUIRE(s.st_blocks == 2);
+    fsRead(fs, "/sparse", r, 11 * BLOCK_SIZE, 0);
+    REQUIRE(memcmp(r, w, BLOCK_SIZE) == 0);
+    REQUIRE(memcmp(r + BLOCK_SIZE, zeros, 9 * BLOCK_SIZE) == 0);
+    REQUIRE(memcmp(r + 10 * BLOCK_SIZE, w, BLOCK_SIZE) == 0);
+
+    REQUIRE(fs->fuseGetattr("/punched", &s) == 0);
+    REQUIRE(s.st_blocks == 6);
+    fsRead(fs, "/punched", r, 8 * BLOCK_SIZE, 0);
+    REQUIRE(memcmp(r, w, BLOCK_SIZE / 2) == 0);
+    REQUIRE(memcmp(r + BLOCK_SIZE / 2, zeros, 3 * BLOCK_SIZE) == 0);
+    REQUIRE(memcmp(r + 3 * BLOCK_SIZE + BLOCK_SIZE / 2, w + 3 * BLOCK_SIZE + BLOCK_SIZE / 2,
+                   4 * BLOCK_SIZE + BLOCK_SIZE / 2) == 0);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    delete [] zeros;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.12", "[Part_3]") {
+    printf("Testcase 3.12: Committed transactions are replayed after a torn checkpoint\n");
+
+    remove(FS_PATH);
+    remove(FS_COPY_PATH);
+    remove(FS_CHECKPOINT_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.dataBlocks = 5000;
+
+    char *r = new char[300 * BLOCK_SIZE];
+    char *w = new char[300 * BLOCK_SIZE];
+    gen_random(w, 300 * BLOCK_SIZE);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->blocks4JOURNAL > 0);
+    ulong posJournal = fs->posJOURNAL;
+    ulong journalEnd = fs->posJOURNAL + fs->blocks4JOURNAL;
+    ulong posData = fs->posDATA;
+
+    int32_t numFree;
+    {
+        // keep the committer thread out, the transactions are committed here
+        std::lock_guard<std::recursive_mutex> guard(fs->fsLock);
+
+        // two transactions, the second one changes blocks of the first one again
+        REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+        fsWrite(fs, "/a", w, 200 * BLOCK_SIZE, 0);
+        fsWrite(fs, "/b", w, 300 * BLOCK_SIZE, 0);
+        REQUIRE(fs->commitMetadata(true) == 0);
+        REQUIRE(fs->fuseUnlink("/a") == 0);
+        REQUIRE(fs->fuseRename("/b", "/c") == 0);
+        REQUIRE(fs->fuseMknod("/d", S_IFREG | 0644, 0) == 0);
+        fsWrite(fs, "/d", w + BLOCK_SIZE, 100 * BLOCK_SIZE, 0);
+        REQUIRE(fs->commitMetadata(true) == 0);
+        numFree = fs->mySuperBlock.numFreeBlocks;
+
+        // the container before and after the checkpoint
+        fsCopy(FS_PATH, FS_COPY_PATH);
+        REQUIRE(fs->checkpointJournal() == 0);
+        fsCopy(FS_PATH, FS_CHECKPOINT_PATH);
+    }
+
+    // only every other metadata block reached the container before the "crash"
+    FILE *torn = fopen(FS_COPY_PATH, "r+b");
+    FILE *done = fopen(FS_CHECKPOINT_PATH, "rb");
+    REQUIRE(torn != NULL);
+    REQUIRE(done != NULL);
+    char before[BLOCK_SIZE];
+    char after[BLOCK_SIZE];
+    int changed = 0;
+    for (ulong blockNo = 0; blockNo < posData; blockNo++) {
+        if (blockNo >= posJournal && blockNo < journalEnd) {
+            continue;
+        }
+        REQUIRE(fseek(torn, blockNo * BLOCK_SIZE, SEEK_SET) == 0);
+        REQUIRE(fread(before, BLOCK_SIZE, 1, torn) == 1);
+        REQUIRE(fseek(done, blockNo * BLOCK_SIZE, SEEK_SET) == 0);
+        REQUIRE(fread(after, BLOCK_SIZE, 1, done) == 1);
+        if (memcmp(before, after, BLOCK_SIZE) != 0 && changed++ % 2 == 0) {
+            REQUIRE(fseek(torn, blockNo * BLOCK_SIZE, SEEK_SET) == 0);
+            REQUIRE(fwrite(after, BLOCK_SIZE, 1, torn) == 1);
+        }
+    }
+    fclose(torn);
+    fclose(done);
+    REQUIRE(changed >= 2);
+
+    MyFsInfo copyInfo;
+    fsDefaults(&copyInfo);
+    copyInfo.contFile = (char *) FS_COPY_PATH;
+    TestOnDiskFS *copy = fsMount(&copyInfo);
+    struct stat s;
+    REQUIRE(copy->fuseGetattr("/a", &s) == -ENOENT);
+    REQUIRE(copy->fuseGetattr("/b", &s) == -ENOENT);
+    REQUIRE(copy->fuseGetattr("/c", &s) == 0);
+    REQUIRE(s.st_size == 300 * BLOCK_SIZE);
+    fsRead(copy, "/c", r, 300 * BLOCK_SIZE, 0);
+    REQUIRE(memcmp(r, w, 300 * BLOCK_SIZE) == 0);
+    fsRead(copy, "/d", r, 100 * BLOCK_SIZE, 0);
+    REQUIRE(memcmp(r, w + BLOCK_SIZE, 100 * BLOCK_SIZE) == 0);
+    REQUIRE(copy->mySuperBlock.numFreeBlocks == numFree);
+    fsCheckDmap(copy, 5000);
+    fsCheckFreeExtents(copy, 5000);
+    fsUnmount(copy);
+
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+    remove(FS_COPY_PATH);
+    remove(FS_CHECKPOINT_PATH);
+}
+
+TEST_CASE("T-3.13", "[Part_3]") {
+    printf("Testcase 3.13: Large changes are split into transactions that fit into the bounded journal\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    // the journal of this container would be larger than JOURNAL_MAX_SIZE without the bound
+    info.dataBlocks = 1 << 20;
+
+    size_t size = 3 * 1024 * 1024;
+    char *r = new char[size];
+    char *w = new char[size];
+    gen_random(w, size);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->blocks4JOURNAL * BLOCK_SIZE == JOURNAL_MAX_SIZE);
+    REQUIRE(fs->journalStep() > 0);
+    REQUIRE(fs->journalStep() < size / BLOCK_SIZE);
+    REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/data", S_IFREG | 0644, 0) == 0);
+
+    // the FAT and LMAP entries of 800000 blocks are more than the journal holds
+    struct fuse_file_info fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    uint64_t sequence = fs->journalSequence;
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_KEEP_SIZE, 0, (off_t) 800000 * BLOCK_SIZE, &fileInfo) == 0);
+    REQUIRE(fs->journalSequence - sequence >= 2);
+    REQUIRE(fs->journalBlocks(fs->journalBytes) <= fs->blocks4JOURNAL - 1);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    struct stat s;
+    REQUIRE(fs->fuseGetattr("/file", &s) == 0);
+    REQUIRE(s.st_size == 0);
+    REQUIRE(s.st_blocks == 800000);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == (1 << 20) - 800000);
+
+    // a write, a hole and a deletion of that many blocks are split into operations that fit
+    fsWrite(fs, "/data", w, size, 0);
+    REQUIRE(fs->fuseOpen("/file", &fileInfo) == 0);
+    sequence = fs->journalSequence;
+    REQUIRE(fs->fuseFallocate("/file", FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, (off_t) 400000 * BLOCK_SIZE,
+                              &fileInfo) == 0);
+    REQUIRE(fs->journalSequence - sequence >= 2);
+    REQUIRE(fs->journalBlocks(fs->journalBytes) <= fs->blocks4JOURNAL - 1);
+    REQUIRE(fs->fuseGetattr("/file", &s) == 0);
+    REQUIRE(s.st_blocks == 400000);
+    REQUIRE(fs->fuseRelease("/file", &fileInfo) == 0);
+    REQUIRE(fs->fuseUnlink("/file") == 0);
+    REQUIRE(fs->journalBlocks(fs->journalBytes) <= fs->blocks4JOURNAL - 1);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    REQUIRE(fs->fuseGetattr("/file", &s) == -ENOENT);
+    REQUIRE(fs->mySuperBlock.numFreeBlocks == (1 << 20) - size / BLOCK_SIZE);
+    fsRead(fs, "/data", r, size, 0);
+    REQUIRE(memcmp(r, w, size) == 0);
+    fsUnmount(fs);
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.14", "[Part_3]") {
+    printf("Testcase 3.14: A torn superblock leaves the other one current\n");
+
+    char *r = new char[20 * 1024];
+    char *w = new char[20 * 1024];
+    gen_random(w, 20 * 1024);
+
+    uint32_t blockSizes[] = {BLOCK_SIZE, 4096};
+    for (int i = 0; i < 2; i++) {
+        remove(FS_PATH);
+
+        MyFsInfo info;
+        fsDefaults(&info);
+        info.blockSize = blockSizes[i];
+        info.dataBlocks = 1000;
+        info.shadowPaging = 1;
+
+        // the commits alternate between the superblocks, generation 1 is in block 0
+        TestOnDiskFS *fs = fsMount(&info);
+        {
+            // keep the committer thread out, the changes are committed here
+            std::lock_guard<std::recursive_mutex> guard(fs->fsLock);
+            REQUIRE(fs->mySuperBlock.generation == 1);
+
+            REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+            fsWrite(fs, "/a", w, 20 * 1024, 0);
+            REQUIRE(fs->commitMetadata(true) == 0);
+            REQUIRE(fs->mySuperBlock.generation == 2);
+
+            REQUIRE(fs->fuseRename("/a", "/b") == 0);
+            REQUIRE(fs->fuseMknod("/c", S_IFREG | 0644, 0) == 0);
+            fsWrite(fs, "/c", w, 10 * 1024, 0);
+            REQUIRE(fs->commitMetadata(true) == 0);
+            fsCopy(FS_PATH, FS_COPY_PATH);
+
+            REQUIRE(fs->fuseUnlink("/c") == 0);
+            REQUIRE(fs->commitMetadata(true) == 0);
+            fsCopy(FS_PATH, FS_CHECKPOINT_PATH);
+        }
+        fsUnmount(fs);
+
+        // generation 3 in block 0 is torn, the container is mounted from generation 2 in block 1
+        fsCorrupt(FS_COPY_PATH, 0, 64);
+        MyFsInfo copyInfo;
+        fsDefaults(&copyInfo);
+        copyInfo.contFile = (char *) FS_COPY_PATH;
+        fs = fsMount(&copyInfo);
+        REQUIRE(fs->blockSize == blockSizes[i]);
+        REQUIRE(fs->mySuperBlock.generation == 2);
+        struct stat s;
+        REQUIRE(fs->fuseGetattr("/a", &s) == 0);
+        REQUIRE(fs->fuseGetattr("/b", &s) == -ENOENT);
+        REQUIRE(fs->fuseGetattr("/c", &s) == -ENOENT);
+        fsRead(fs, "/a", r, 20 * 1024, 0);
+        REQUIRE(memcmp(r, w, 20 * 1024) == 0);
+        fsCheckDmap(fs, 1000);
+        fsUnmount(fs);
+
+        // generation 4 in block 1 is torn, generation 3 in block 0 is current
+        fsCorrupt(FS_CHECKPOINT_PATH, blockSizes[i], 64);
+        copyInfo.contFile = (char *) FS_CHECKPOINT_PATH;
+        fs = fsMount(&copyInfo);
+        REQUIRE(fs->mySuperBlock.generation == 3);
+        REQUIRE(fs->fuseGetattr("/a", &s) == -ENOENT);
+        fsRead(fs, "/b", r, 20 * 1024, 0);
+        REQUIRE(memcmp(r, w, 20 * 1024) == 0);
+        fsRead(fs, "/c", r, 10 * 1024, 0);
+        REQUIRE(memcmp(r, w, 10 * 1024) == 0);
+        fsCheckDmap(fs, 1000);
+        fsUnmount(fs);
+    }
+
+    delete [] r;
+    delete [] w;
+    remove(FS_PATH);
+    remove(FS_COPY_PATH);
+    remove(FS_CHECKPOINT_PATH);
+}
+
+TEST_CASE("T-3.15", "[Part_3]") {
+    printf("Testcase 3.15: Reads update the access time as the atime mode asks for\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    time_t now = time(NULL);
+    time_t atime;
+
+    SECTION("strictatime") {
+        info.atimeMode = ATIME_STRICT;
+        TestOnDiskFS *fs = fsMount(&info);
+        REQUIRE(fsReadTouches(fs, now - 50, now - 100, &atime));
+        REQUIRE(atime >= now);
+        fsUnmount(fs);
+    }
+
+    SECTION("relatime") {
+        info.atimeMode = ATIME_RELATIME;
+        TestOnDiskFS *fs = fsMount(&info);
+        // an access time newer than the last change is kept for a day
+        REQUIRE_FALSE(fsReadTouches(fs, now - 50, now - 100, &atime));
+        REQUIRE(atime == now - 50);
+        REQUIRE(fsReadTouches(fs, now - 50, now - 10, &atime));
+        REQUIRE(atime >= now);
+        REQUIRE(fsReadTouches(fs, now - RELATIME_INTERVAL - 50, now - RELATIME_INTERVAL - 100, &atime));
+        REQUIRE(atime >= now);
+        fsUnmount(fs);
+    }
+
+    SECTION("noatime") {
+        info.atimeMode = ATIME_NOATIME;
+        TestOnDiskFS *fs = fsMount(&info);
+        REQUIRE_FALSE(fsReadTouches(fs, now - 50, now - 10, &atime));
+        REQUIRE(atime == now - 50);
+        fsUnmount(fs);
+    }
+
+    SECTION("lazytime") {
+        // the access time changes in memory only
+        info.lazyTime = 1;
+        TestOnDiskFS *fs = fsMount(&info);
+        REQUIRE_FALSE(fsReadTouches(fs, now - 50, now - 100, &atime));
+        REQUIRE(atime >= now);
+        REQUIRE(fs->lazyTimesPending);
+
+        // it is written with the next other change of the file
+        REQUIRE(fs->fuseChmod("/file", S_IFREG | 0600) == 0);
+        REQUIRE_FALSE(fs->myLazyTimes[fs->myPathIndex["/file"]]);
+        REQUIRE(fs->uncommitted);
+        fsUnmount(fs);
+
+        info.lazyTime = 0;
+        fs = fsMount(&info);
+        struct stat s;
+        REQUIRE(fs->fuseGetattr("/file", &s) == 0);
+        REQUIRE(s.st_atime == atime);
+        fsUnmount(fs);
+    }
+
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.16", "[Part_3]") {
+    printf("Testcase 3.16: Packed directory entries keep their paths in the name heap\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->packedRoot);
+    REQUIRE(fs->blocks4ROOT < NUM_DIR_ENTRIES / 4);
+
+    struct stat s;
+    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+        REQUIRE(fs->fuseMknod(fsLongPath(i, 100).c_str(), S_IFREG | 0644, 0) == 0);
+    }
+    REQUIRE(fs->namesEnd == NUM_DIR_ENTRIES * 100);
+
+    // every longer path goes behind the others, a full heap is compacted
+    for (size_t length = 101; length <= 120; length++) {
+        for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+            REQUIRE(fs->fuseRename(fsLongPath(i, length - 1).c_str(), fsLongPath(i, length).c_str()) == 0);
+            REQUIRE(fs->namesEnd <= fs->myNames.size());
+        }
+    }
+    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+        REQUIRE(fs->fuseGetattr(fsLongPath(i, 120).c_str(), &s) == 0);
+        REQUIRE(fs->fuseGetattr(fsLongPath(i, 119).c_str(), &s) == -ENOENT);
+    }
+
+    // a path that is not longer keeps the place of the last one
+    int index = fs->myPathIndex[fsLongPath(0, 120)];
+    uint32_t offset = fs->myNameOffsets[index];
+    uint32_t end = fs->namesEnd;
+    REQUIRE(fs->fuseRename(fsLongPath(0, 120).c_str(), "/short") == 0);
+    REQUIRE(fs->myNameOffsets[index] == offset);
+    REQUIRE(fs->namesEnd == end);
+
+    // so does a new file in the entry of a deleted one
+    index = fs->myPathIndex[fsLongPath(1, 120)];
+    offset = fs->myNameOffsets[index];
+    REQUIRE(fs->fuseUnlink(fsLongPath(1, 120).c_str()) == 0);
+    REQUIRE(fs->fuseMknod("/new", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->myPathIndex["/new"] == index);
+    REQUIRE(fs->myNameOffsets[index] == offset);
+    REQUIRE(fs->namesEnd == end);
+    fsUnmount(fs);
+
+    fs = fsMount(&info);
+    REQUIRE(fs->fuseGetattr("/short", &s) == 0);
+    REQUIRE(fs->fuseGetattr("/new", &s) == 0);
+    REQUIRE(fs->fuseGetattr(fsLongPath(0, 120).c_str(), &s) == -ENOENT);
+    REQUIRE(fs->fuseGetattr(fsLongPath(1, 120).c_str(), &s) == -ENOENT);
+    for (int i = 2; i < NUM_DIR_ENTRIES; i++) {
+        REQUIRE(fs->fuseGetattr(fsLongPath(i, 120).c_str(), &s) == 0);
+    }
+    fsUnmount(fs);
+
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.17", "[Part_3]") {
+    printf("Testcase 3.17: The path index follows renames and deletions on disk\n");
+
+    remove(FS_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+
+    char r[100];
+    char w[100];
+    gen_random(w, 100);
+
+    TestOnDiskFS *fs = fsMount(&info);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/c", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == -EEXIST);
+    fsWrite(fs, "/a", w, 100, 0);
+    fsCheckPathIndex(fs);
+
+    struct stat s;
+    int index = fs->myPathIndex["/a"];
+    REQUIRE(fs->fuseRename("/a", "/d") == 0);
+    REQUIRE(fs->myPathIndex["/d"] == index);
+    REQUIRE(fs->fuseGetattr("/a", &s) == -ENOENT);
+    fsRead(fs, "/d", r, 100, 0);
+    REQUIRE(memcmp(r, w, 100) == 0);
+    fsCheckPathIndex(fs);
+
+    // an existing path is not replaced
+    REQUIRE(fs->fuseRename("/b", "/c") == -EEXIST);
+    REQUIRE(fs->fuseRename("/a", "/e") == -ENOENT);
+    REQUIRE(fs->fuseGetattr("/b", &s) == 0);
+    REQUIRE(fs->fuseGetattr("/c", &s) == 0);
+    fsCheckPathIndex(fs);
+
+    REQUIRE(fs->fuseUnlink("/c") == 0);
+    REQUIRE(fs->fuseUnlink("/c") == -ENOENT);
+    REQUIRE(fs->fuseGetattr("/c", &s) == -ENOENT);
+    REQUIRE(fs->fuseRename("/b", "/c") == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    fsCheckPathIndex(fs);
+    fsUnmount(fs);
+
+    // the index is built when the container is read
+    fs = fsMount(&info);
+    REQUIRE(fs->myPathIndex.size() == 3);
+    fsCheckPathIndex(fs);
+    fsRead(fs, "/d", r, 100, 0);
+    REQUIRE(memcmp(r, w, 100) == 0);
+    fsUnmount(fs);
+
+    remove(FS_PATH);
+}
+
+TEST_CASE("T-3.18", "[Part_3]") {
+    printf("Testcase 3.18: The path index follows renames and deletions in memory\n");
+
+    MyFsInfo info;
+    fsDefaults(&info);
+
+    char r[100];
+    char w[100];
+    gen_random(w, 100);
+
+    MyInMemoryFS *fs = new MyInMemoryFS();
+    fs->mountMemory(&info);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/c", S_IFREG | 0644, 0) == 0);
+    REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == -EEXIST);
+    fsWrite(fs, "/a", w, 100, 0);
+    fsCheckPathIndex(fs);
+
+    struct stat s;
+    int index = fs->myPathIndex["/a"];
+    REQUIRE(fs->fuseRename("/a", "/d") == 0);
+    REQUIRE(fs->myPathIndex["/d"] == index);
+    REQUIRE(fs->fuseGetattr("/a", &s) == -ENOENT);
+    fsRead(fs, "/d", r, 100, 0);
+    REQUIRE(memcmp(r, w, 100) == 0);
+    fsCheckPathIndex(fs);
+
+    // an existing path is not replaced, neither file changes
+    index = fs->myPathIndex["/c"];
+    REQUIRE(fs->fuseRename("/b", "/c") == -EEXIST);
+    REQUIRE(fs->fuseRename("/a", "/e") == -ENOENT);
+    REQUIRE(fs->fuseGetattr("/b", &s) == 0);
+    REQUIRE(fs->myPathIndex["/c"] == index);
+    REQUIRE(strcmp(fs->myFsFiles[index].cPath, "/c") == 0);
+    fsCheckPathIndex(fs);
+
+    REQUIRE(fs->fuseUnlink("/c") == 0);
+    REQUIRE(fs->fuseUnlink("/c") == -ENOENT);
+    REQUIRE(fs->fuseGetattr("/c", &s) == -ENOENT);
+    REQUIRE(fs->fuseRename("/b", "/c") == 0);
+    REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+    fsCheckPathIndex(fs);
+
+    fs->fuseDestroy();
+    delete fs;
+}
+
+// ***
+// *** Helper functions
+// ***
+
+void fsDefaults(MyFsInfo *info) {
+    memset(info, 0, sizeof(MyFsInfo));
+    info->logFile = (char *) "/dev/null";
+    info->contFile = (char *) FS_PATH;
+}
+
+TestOnDiskFS *fsMount(MyFsInfo *info) {
+    TestOnDiskFS *fs = new TestOnDiskFS();
+    fs->mountContainer(info);
+    return fs;
+}
+
+void fsUnmount(TestOnDiskFS *fs) {
+    fs->fuseDestroy();
+    delete fs;
+}
+
+void fsWrite(MyFS *fs, const char *path, const char *buf, size_t size, off_t offset) {
+    struct fuse_file_info fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+
+    REQUIRE(fs->fuseOpen(path, &fileInfo) == 0);
+    REQUIRE(fs->fuseWrite(path, buf, size, offset, &fileInfo) == (int) size);
+    REQUIRE(fs->fuseRelease(path, &fileInfo) == 0);
+}
+
+void fsRead(MyFS *fs, const char *path, char *buf, size_t size, off_t offset) {
+    struct fuse_file_info fileInfo;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+
+    REQUIRE(fs->fuseOpen(path, &fileInfo) == 0);
+    REQUIRE(fs->fuseRead(path, buf, size, offset, &fileInfo) == (int) size);
+    REQUIRE(fs->fuseRelease(path, &fileInfo) == 0);
+}
+
+void fsCopy(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    REQUIRE(in != NULL);
+    REQUIRE(out != NULL);
+
+    char buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        REQUIRE(fwrite(buf, 1, n, out) == n);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+/// returns the access time of path in a copy of the container as it is on disk right now, like after a crash
+time_t fsCopyAtime(const char *path) {
+    fsCopy(FS_PATH, FS_COPY_PATH);
+
+    MyFsInfo info;
+    fsDefaults(&info);
+    info.contFile = (char *) FS_COPY_PATH;
+    TestOnDiskFS *copy = fsMount(&info);
+
+    struct stat s;
+    REQUIRE(copy->fuseGetattr(path, &s) == 0);
+    fsUnmount(copy);
+    remove(FS_COPY_PATH);
+
+    return s.st_atime;
+}
+
+/// compares the bitmap, its summary and scanDmap() with the state of every block
+void fsCheckDmap(TestOnDiskFS *fs, size_t numBlocks) {
+    size_t numFree = 0;
+    for (size_t i = 0; i < fs->myDmap.size() * 64; i++) {
+        // blocks behind the data segment are never empty
+        if (i >= numBlocks) {
+            REQUIRE_FALSE(fs->isFreeBlock(i));
+        } else if (fs->isFreeBlock(i)) {
+            numFree++;
+        }
+    }
+    REQUIRE(numFree == (size_t) fs->mySuperBlock.numFreeBlocks);
+
+    for (size_t word = 0; word < fs->myDmap.size(); word++) {
+        bool summary = (fs->myDmapSummary[word / 64] >> (word % 64)) & 1;
+        REQUIRE(summary == (fs->myDmap[word] != 0));
+    }
+
+    for (size_t blockNo = 0; blockNo < numBlocks; blockNo += 7) {
+        size_t nextFree = blockNo;
+        while (nextFree < numBlocks && !fs->isFreeBlock(nextFree)) {
+            nextFree++;
+        }
+        size_t nextUsed = blockNo;
+        while (nextUsed < numBlocks && fs->isFreeBlock(nextUsed)) {
+            nextUsed++;
+        }
+        REQUIRE(fs->scanDmap(blockNo, true) == (nextFree < numBlocks ? nextFree : fs->myDmap.size() * 64));
+        REQUIRE(fs->scanDmap(blockNo, false) == nextUsed);
+    }
+}
+
+/// compares myFreeExtents and myFreeBySize with the runs of empty blocks in the bitmap, blocks freed since the last
+/// commit are in none of them
+void fsCheckFreeExtents(TestOnDiskFS *fs, size_t numBlocks) {
+    std::vector<bool> free(numBlocks);
+    for (size_t i = 0; i < numBlocks; i++) {
+        free[i] = fs->isFreeBlock(i);
+    }
+    for (size_t i = 0; i < fs->myPendingFrees.size(); i++) {
+        for (int32_t b = 0; b < fs->myPendingFrees[i].second; b++) {
+            REQUIRE(free[fs->myPendingFrees[i].first + b]);
+            free[fs->myPendingFrees[i].first + b] = false;
+        }
+    }
+
+    std::map<int32_t, int32_t> runs;
+    size_t blockNo = 0;
+    while (blockNo < numBlocks) {
+        if (!free[blockNo]) {
+            blockNo++;
+            continue;
+        }
+        size_t end = blockNo;
+        while (end < numBlocks && free[end]) {
+            end++;
+        }
+        runs[blockNo] = end - blockNo;
+        blockNo = end;
+    }
+
+    REQUIRE(fs->myFreeExtents == runs);
+    REQUIRE(fs->myFreeBySize.size() == runs.size());
+    for (std::map<int32_t, int32_t>::iterator it = runs.begin(); it != runs.end(); ++it) {
+        REQUIRE(fs->myFreeBySize.count(std::make_pair(it->second, it->first)) == 1);
+    }
+}
+
+std::vector<Extent> fsExtents(TestOnDiskFS *fs, const char *path) {
+    int index = fs->myPathIndex[path];
+    fs->buildExtents(index);
+    return fs->myExtents[index];
+}
+
+void fsCorrupt(const char *path, off_t offset, size_t length) {
+    std::vector<char> garbage(length);
+    gen_random(garbage.data(), length);
+
+    FILE *file = fopen(path, "r+b");
+    REQUIRE(file != NULL);
+    REQUIRE(fseek(file, offset, SEEK_SET) == 0);
+    REQUIRE(fwrite(garbage.data(), length, 1, file) == 1);
+    fclose(file);
+}
+
+/// reads "/file" with the given access time and time of the last change, creating it first if needed
+/// \return true if the read changed the metadata in the container, i.e. the directory entry has to be written
+bool fsReadTouches(TestOnDiskFS *fs, time_t atime, time_t changed, time_t *newAtime) {
+    // keep the committer thread out
+    std::lock_guard<std::recursive_mutex> guard(fs->fsLock);
+
+    char buf[100];
+    struct stat s;
+    if (fs->fuseGetattr("/file", &s) != 0) {
+        REQUIRE(fs->fuseMknod("/file", S_IFREG | 0644, 0) == 0);
+        fsWrite(fs, "/file", buf, 100, 0);
+    }
+    int index = fs->myPathIndex["/file"];
+    fs->myRoot[index].atime = atime;
+    fs->myRoot[index].mtime = fs->myRoot[index].ctime = changed;
+    REQUIRE(fs->commitMetadata(true) == 0);
+
+    fsRead(fs, "/file", buf, 100, 0);
+    *newAtime = fs->myRoot[index].atime;
+    return fs->uncommitted;
+}
+
+/// path of "length" characters, starting with "/" and the number id
+std::string fsLongPath(int id, size_t length) {
+    std::string path = "/" + std::to_string(id) + "-";
+    path.resize(length, 'x');
+    return path;
+}
+
+void fsCheckPathIndex(TestOnDiskFS *fs) {
+    size_t numFiles = 0;
+    for (size_t i = 0; i < fs->myRoot.size(); i++) {
+        if (!fs->myFsEmpty[i]) {
+            REQUIRE(fs->myPathIndex.count(fs->myRoot[i].cPath) == 1);
+            REQUIRE(fs->myPathIndex[fs->myRoot[i].cPath] == (int) i);
+            numFiles++;
+        }
+    }
+    REQUIRE(fs->myPathIndex.size() == numFiles);
+}
 
-// TODO: Implement your helper functions here!
\ No newline at end of file
+void fsCheckPathIndex(MyInMemoryFS *fs) {
+    size_t numFiles = 0;
+    for (size_t i = 0; i < NUM_DIR_ENTRIES; i++) {
+        if (!fs->myFsEmpty[i]) {
+            REQUIRE(fs->myPathIndex.count(fs->myFsFiles[i].cPath) == 1);
+            REQUIRE(fs->myPathIndex[fs->myFsFiles[i].cPath] == (int) i);
+            numFiles++;
+        }
+    }
+    REQUIRE(fs->myPathIndex.size() == numFiles);
+}